@@ -39,7 +39,6 @@ from pybind.exceptions import CppException
 # Module
 mod = Module('backends')
 mod.AddInclude('python/weights.h')
-mod.AddInitialization('lczero::InitializeMagicBitboards();')
 ex = mod.AddException(
     CppException('LczeroException', cpp_name='lczero::Exception'))
 
@@ -0,0 +1,313 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "benchmark/autotune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "chess/board.h"
+#include "mcts/node.h"
+#include "mcts/params.h"
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/files.h"
+#include "utils/filesystem.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kBackendsId{
+    "backends", "",
+    "Comma separated list of backends to try. Defaults to the CPU backends "
+    "this binary was built with."};
+const OptionId kBatchSizesId{"batch-sizes", "",
+                             "Comma separated list of batch sizes to try."};
+const OptionId kThreadCountsId{
+    "thread-counts", "",
+    "Comma separated list of thread counts to try. Defaults to powers of two "
+    "up to the number of CPU cores."};
+const OptionId kBatchesId{"batches", "",
+                          "Number of batches each thread runs per "
+                          "measurement."};
+const OptionId kFenId{"fen", "", "Benchmark initial position FEN."};
+const OptionId kClippyThresholdId{"clippy-threshold", "",
+                                  "Ratio of nps improvement necessary for each "
+                                  "doubling of batchsize to be considered "
+                                  "best."};
+
+const char* kCpuBackends[] = {"blas", "eigen", "onednn", "onnx-cpu"};
+
+uint64_t HashBytes(const char* data, size_t size) {
+  uint64_t hash = size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = HashCat(hash, word);
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, data + i, size - i);
+  return HashCat(hash, tail);
+}
+
+std::string GetCpuModel() {
+#ifdef _WIN32
+  const char* id = std::getenv("PROCESSOR_IDENTIFIER");
+  if (id != nullptr) return id;
+#else
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") != 0) continue;
+    const auto colon = line.find(':');
+    if (colon != std::string::npos) return Trim(line.substr(colon + 1));
+  }
+#endif
+  return "unknown";
+}
+
+// Identifies the contents of @weights_path without reading the whole file,
+// as this runs on every engine start.
+uint64_t HashWeightsFile(const std::string& weights_path) {
+  constexpr size_t kHeaderSize = 64 * 1024;
+  std::string header(kHeaderSize, '\0');
+  std::ifstream file(weights_path, std::ios::binary);
+  file.read(header.data(), header.size());
+  header.resize(file.gcount());
+  return HashCat({GetFileSize(weights_path),
+                  static_cast<uint64_t>(GetFileTime(weights_path)),
+                  HashBytes(header.data(), header.size())});
+}
+
+// Name of the file holding the autotune result for @weights_path on this CPU.
+std::string GetResultFilename(const std::string& weights_path) {
+  const std::string cpu = GetCpuModel();
+  std::ostringstream oss;
+  oss << GetLc0CacheDirectory() << "autotune-" << std::hex << std::setfill('0')
+      << std::setw(16) << HashWeightsFile(weights_path) << '-'
+      << std::setw(16) << HashBytes(cpu.data(), cpu.size()) << ".txt";
+  return oss.str();
+}
+
+struct Measurement {
+  std::string backend;
+  int threads = 0;
+  int batch_size = 0;
+  double nps = 0.0;
+};
+
+// Runs @batches computations of @batch_size copies of @input on each of
+// @threads threads and returns the total number of evaluations per second.
+double Measure(Network* network, const InputPlanes& input, int threads,
+               int batch_size, int batches) {
+  auto compute = [&](int count) {
+    for (int j = 0; j < count; j++) {
+      auto computation = network->NewComputation();
+      for (int k = 0; k < batch_size; k++) {
+        computation->AddPackedInput(input.data(), {});
+      }
+      computation->ComputeBlocking();
+    }
+  };
+  // Lets the backend allocate buffers for this batch size outside the timing.
+  compute(1);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) workers.emplace_back(compute, batches);
+  for (auto& worker : workers) worker.join();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  return static_cast<double>(threads) * batches * batch_size / time.count();
+}
+
+}  // namespace
+
+void Autotune::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  std::vector<std::string> backends;
+  const auto available = NetworkFactory::Get()->GetBackendsList();
+  for (const auto* backend : kCpuBackends) {
+    if (std::find(available.begin(), available.end(), backend) !=
+        available.end()) {
+      backends.emplace_back(backend);
+    }
+  }
+  std::vector<std::string> threads;
+  for (int i = 1; i <= std::max(1u, std::thread::hardware_concurrency());
+       i *= 2) {
+    threads.push_back(std::to_string(i));
+  }
+  options.Add<StringOption>(kBackendsId) = StrJoin(backends, ",");
+  options.Add<StringOption>(kBatchSizesId) = "1,8,16,32,64,128,256";
+  options.Add<StringOption>(kThreadCountsId) = StrJoin(threads, ",");
+  options.Add<IntOption>(kBatchesId, 1, 999999999) = 10;
+  options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<FloatOption>(kClippyThresholdId, 0.0f, 1.0f) = 0.15f;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto option_dict = options.GetOptionsDict();
+    const auto weights_path = NetworkFactory::GetWeightsPath(option_dict);
+    if (weights_path.empty()) throw Exception("Autotune needs a network.");
+    const std::optional<WeightsFile> weights =
+        LoadWeightsFromFile(weights_path);
+
+    auto batch_sizes =
+        ParseIntList(option_dict.Get<std::string>(kBatchSizesId));
+    auto thread_counts =
+        ParseIntList(option_dict.Get<std::string>(kThreadCountsId));
+    std::sort(batch_sizes.begin(), batch_sizes.end());
+    std::sort(thread_counts.begin(), thread_counts.end());
+    const int batches = option_dict.Get<int>(kBatchesId);
+    const float threshold = option_dict.Get<float>(kClippyThresholdId);
+
+    NodeTree tree;
+    tree.ResetToPosition(option_dict.Get<std::string>(kFenId), {});
+
+    std::optional<Measurement> best;
+    for (const auto& backend :
+         StrSplit(option_dict.Get<std::string>(kBackendsId), ",")) {
+      OptionsDict network_options(&option_dict);
+      network_options.AddSubdictFromString(
+          option_dict.Get<std::string>(NetworkFactory::kBackendOptionsId));
+      std::unique_ptr<Network> network;
+      try {
+        network =
+            NetworkFactory::Get()->Create(backend, weights, network_options);
+      } catch (Exception& ex) {
+        std::cout << "Skipping backend " << backend << ": " << ex.what()
+                  << std::endl;
+        continue;
+      }
+      const auto input = EncodePositionForNN(
+          network->GetCapabilities().input_format, tree.GetPositionHistory(),
+          8, FillEmptyHistory::ALWAYS, nullptr);
+
+      for (const int thread_count : thread_counts) {
+        // The best batch size for this thread count. Larger batches have to
+        // pay for their latency with a throughput gain of @threshold for each
+        // doubling, as the batch sizes tried need not be contiguous.
+        Measurement candidate{backend, thread_count, 0, 0.0};
+        for (const int batch_size : batch_sizes) {
+          const double nps = Measure(network.get(), input, thread_count,
+                                     batch_size, batches);
+          std::cout << std::left << std::setw(10) << backend << " threads "
+                    << std::right << std::setw(3) << thread_count
+                    << " batch " << std::setw(4) << batch_size << ": "
+                    << std::fixed << std::setprecision(0) << std::setw(8)
+                    << nps << " nps" << std::endl;
+          if (candidate.batch_size == 0 ||
+              nps > candidate.nps *
+                        std::pow(1.0 + threshold,
+                                 std::log2(static_cast<double>(batch_size) /
+                                           candidate.batch_size))) {
+            candidate.batch_size = batch_size;
+            candidate.nps = nps;
+          }
+        }
+        if (!best || candidate.nps > best->nps) best = candidate;
+      }
+    }
+    if (!best) throw Exception("No backend could be benchmarked.");
+
+    std::ostringstream result;
+    result << "# Autotune result for " << weights_path << std::endl;
+    result << "# CPU: " << GetCpuModel() << std::endl;
+    result << "# Throughput: " << std::fixed << std::setprecision(0)
+           << best->nps << " nps" << std::endl;
+    result << "--" << NetworkFactory::kBackendId.long_flag() << '='
+           << best->backend << std::endl;
+    const auto backend_options =
+        option_dict.Get<std::string>(NetworkFactory::kBackendOptionsId);
+    if (!backend_options.empty()) {
+      result << "--" << NetworkFactory::kBackendOptionsId.long_flag() << '='
+             << backend_options << std::endl;
+    }
+    result << "--threads=" << best->threads << std::endl;
+    result << "--" << SearchParams::kMiniBatchSizeId.long_flag() << '='
+           << best->batch_size << std::endl;
+
+    const auto filename = GetResultFilename(weights_path);
+    WriteStringToFile(filename, result.str());
+    std::cout << std::endl
+              << "Best configuration: backend " << best->backend
+              << ", threads " << best->threads << ", minibatch-size "
+              << best->batch_size << "." << std::endl;
+    std::cout << "Saved to " << filename << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+bool ApplyAutotuneResult(OptionsParser* options) {
+  try {
+    const auto& dict = options->GetOptionsDict();
+    // Tuned thread counts and batch sizes do not carry over to other backends.
+    if (!dict.IsDefault<std::string>(NetworkFactory::kBackendId)) return false;
+    const auto weights_path = NetworkFactory::GetWeightsPath(dict);
+    if (weights_path.empty()) return false;
+    const auto filename = GetResultFilename(weights_path);
+    std::ifstream input(filename);
+    if (!input) return false;
+
+    CERR << "Applying autotuned configuration from " << filename;
+    std::string line;
+    while (std::getline(input, line)) {
+      line = Trim(line);
+      if (line.empty() || line[0] == '#') continue;
+      const auto equals = line.find('=');
+      if (line.compare(0, 2, "--") != 0 || equals == std::string::npos ||
+          !options->SetDefaultFlag(line.substr(2, equals - 2),
+                                   line.substr(equals + 1))) {
+        CERR << "Ignoring autotune line: " << line;
+      }
+    }
+    return true;
+  } catch (Exception& ex) {
+    CERR << "Cannot apply autotune result: " << ex.what();
+    return false;
+  }
+}
+
+}  // namespace lczero
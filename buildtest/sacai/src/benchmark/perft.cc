@@ -0,0 +1,187 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "benchmark/perft.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "chess/board.h"
+#include "utils/exception.h"
+#include "utils/hashcat.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kThreadsOptionId{"threads", "Threads",
+                                "Number of (CPU) worker threads to use.", 't'};
+const OptionId kFenId{"fen", "", "Position to count the move tree of."};
+const OptionId kDepthId{"depth", "", "Depth of the move tree, in plies."};
+const OptionId kDivideId{"divide", "",
+                         "Show the count below each of the root moves."};
+const OptionId kHashId{"hash", "",
+                       "Size in MiB of the table of subtree counts shared by "
+                       "the threads, 0 to disable it."};
+
+// Lockless table of subtree counts. The key is stored xored with the count,
+// so that entries torn by concurrent writes don't match.
+class PerftTable {
+ public:
+  explicit PerftTable(size_t megabytes) {
+    size_t size = 1;
+    while (size * 2 * sizeof(Entry) <= megabytes << 20) size *= 2;
+    if (megabytes > 0) {
+      entries_ = std::make_unique<Entry[]>(size);
+      mask_ = size - 1;
+    }
+  }
+
+  bool enabled() const { return entries_ != nullptr; }
+
+  bool Find(uint64_t key, uint64_t* count) const {
+    const auto& entry = entries_[key & mask_];
+    const uint64_t value = entry.count.load(std::memory_order_relaxed);
+    if ((entry.check.load(std::memory_order_relaxed) ^ value) != key) {
+      return false;
+    }
+    *count = value;
+    return true;
+  }
+
+  void Store(uint64_t key, uint64_t count) {
+    auto& entry = entries_[key & mask_];
+    entry.check.store(key ^ count, std::memory_order_relaxed);
+    entry.count.store(count, std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> count{0};
+  };
+
+  std::unique_ptr<Entry[]> entries_;
+  size_t mask_ = 0;
+};
+
+uint64_t CountLeaves(const ChessBoard& board, int depth, PerftTable* table) {
+  std::array<Move, ChessBoard::kMaxLegalMoves> moves;
+  const int count = board.GenerateLegalMoves(moves.data());
+  // Leaves are only counted, not visited.
+  if (depth == 1) return count;
+  uint64_t key = 0;
+  if (table->enabled()) {
+    key = HashCat(board.Hash(), depth);
+    uint64_t total;
+    if (table->Find(key, &total)) return total;
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < count; i++) {
+    ChessBoard child = board;
+    child.ApplyMove(moves[i]);
+    child.Mirror();
+    total += CountLeaves(child, depth - 1, table);
+  }
+  if (table->enabled()) table->Store(key, total);
+  return total;
+}
+
+}  // namespace
+
+void PerftBenchmark::Run() {
+  OptionsParser options;
+  options.Add<IntOption>(kThreadsOptionId, 1, 128) =
+      std::max(1u, std::thread::hardware_concurrency());
+  options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<IntOption>(kDepthId, 1, 20) = 5;
+  options.Add<BoolOption>(kDivideId) = false;
+  options.Add<IntOption>(kHashId, 0, 65536) = 0;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    ChessBoard board;
+    board.SetFromFen(option_dict.Get<std::string>(kFenId));
+    const int depth = option_dict.Get<int>(kDepthId);
+    PerftTable table(option_dict.Get<int>(kHashId));
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto root_moves = board.GenerateLegalMoves();
+    std::vector<uint64_t> counts(root_moves.size(), 1);
+    if (depth > 1) {
+      // Root moves are handed out one at a time, so that the threads finish
+      // about together even when the subtrees differ in size.
+      std::atomic<size_t> next{0};
+      std::vector<std::thread> threads;
+      const int thread_count =
+          std::min<int>(option_dict.Get<int>(kThreadsOptionId),
+                        std::max<size_t>(root_moves.size(), 1));
+      for (int i = 0; i < thread_count; i++) {
+        threads.emplace_back([&]() {
+          for (size_t idx = next++; idx < root_moves.size(); idx = next++) {
+            ChessBoard child = board;
+            child.ApplyMove(root_moves[idx]);
+            child.Mirror();
+            counts[idx] = CountLeaves(child, depth - 1, &table);
+          }
+        });
+      }
+      for (auto& thread : threads) thread.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < root_moves.size(); i++) {
+      total += counts[i];
+      if (option_dict.Get<bool>(kDivideId)) {
+        Move move = root_moves[i];
+        if (board.flipped()) move.Mirror();
+        std::cout << move.as_string() << ": " << counts[i] << std::endl;
+      }
+    }
+    const std::chrono::duration<double> time = end - start;
+    std::cout << "Nodes: " << total << std::endl;
+    std::cout << "Time: " << std::fixed << std::setprecision(3) << time.count()
+              << "s" << std::endl;
+    std::cout << "Nodes/s: " << std::setprecision(0)
+              << total / std::max(time.count(), 1e-9) << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -27,9 +27,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <initializer_list>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "utils/bititer.h"
@@ -253,6 +258,15 @@ class Move {
   // 0 .. 16384, knight promotion and no promotion is the same.
   uint16_t as_packed_int() const;
 
+  // The encoding described below, e.g. to store moves in files. Unlike
+  // as_packed_int() it keeps all promotions apart, FromRawInt() reverses it.
+  uint16_t as_raw_int() const { return data_; }
+  static Move FromRawInt(uint16_t raw) {
+    Move move;
+    move.data_ = raw;
+    return move;
+  }
+
   // 0 .. 1857, to use in neural networks.
   // Transform is a bit field which describes a transform to be applied to the
   // the move before converting it to an index.
@@ -295,6 +309,96 @@ class Move {
   };
 };
 
-using MoveList = std::vector<Move>;
+// List of moves kept inline, with room for the legal moves of any position, so
+// that generating moves doesn't allocate. Supports the parts of the
+// std::vector interface used for move lists.
+class MoveList {
+ public:
+  static constexpr size_t kCapacity = 256;
+
+  using value_type = Move;
+  using size_type = size_t;
+  using reference = Move&;
+  using const_reference = const Move&;
+  using iterator = Move*;
+  using const_iterator = const Move*;
+
+  // The storage is left uninitialized, only the moves in use are ever read.
+  MoveList() {}
+  MoveList(std::initializer_list<Move> moves)
+      : MoveList(moves.begin(), moves.end()) {}
+  template <typename Iterator>
+  MoveList(Iterator first, Iterator last) {
+    for (; first != last; ++first) push_back(*first);
+  }
+  // Only the moves in use are copied.
+  MoveList(const MoveList& other) : size_(other.size_) {
+    std::copy(other.begin(), other.end(), moves_);
+  }
+  MoveList& operator=(const MoveList& other) {
+    size_ = other.size_;
+    std::copy(other.begin(), other.end(), moves_);
+    return *this;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  static constexpr size_t capacity() { return kCapacity; }
+  // Only checks that @size moves fit, as the room is always there.
+  void reserve([[maybe_unused]] size_t size) const {
+    assert(size <= kCapacity);
+  }
+
+  Move* data() { return moves_; }
+  const Move* data() const { return moves_; }
+  iterator begin() { return moves_; }
+  iterator end() { return moves_ + size_; }
+  const_iterator begin() const { return moves_; }
+  const_iterator end() const { return moves_ + size_; }
+
+  Move& operator[](size_t idx) { return moves_[idx]; }
+  const Move& operator[](size_t idx) const { return moves_[idx]; }
+  Move& front() { return moves_[0]; }
+  const Move& front() const { return moves_[0]; }
+  Move& back() { return moves_[size_ - 1]; }
+  const Move& back() const { return moves_[size_ - 1]; }
+
+  void push_back(Move move) {
+    assert(size_ < kCapacity);
+    moves_[size_++] = move;
+  }
+  template <typename... Args>
+  Move& emplace_back(Args&&... args) {
+    assert(size_ < kCapacity);
+    return moves_[size_++] = Move(std::forward<Args>(args)...);
+  }
+  void pop_back() { --size_; }
+  void clear() { size_ = 0; }
+  // Moves added by growing are null moves, as with std::vector.
+  void resize(size_t size) {
+    assert(size <= kCapacity);
+    std::fill(moves_ + std::min(size, size_), moves_ + size, Move());
+    size_ = size;
+  }
+  // Like resize(), but moves added by growing are left uninitialized and must
+  // be written through data().
+  void resize_for_overwrite(size_t size) {
+    assert(size <= kCapacity);
+    size_ = size;
+  }
+
+  bool operator==(const MoveList& other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+  bool operator!=(const MoveList& other) const { return !operator==(other); }
+
+ private:
+  size_t size_ = 0;
+  // In a union so that constructing a list does not zero the whole array.
+  static_assert(std::is_trivially_copyable_v<Move>);
+  union {
+    Move moves_[kCapacity];
+  };
+};
 
 }  // namespace lczero
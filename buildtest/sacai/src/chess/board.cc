@@ -28,10 +28,12 @@
 #include "chess/board.h"
 
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
+#include <utility>
 
 #include "utils/exception.h"
 
@@ -49,8 +51,50 @@ const ChessBoard ChessBoard::kStartposBoard(ChessBoard::kStartposFen);
 
 const BitBoard ChessBoard::kPawnMask = 0x00FFFFFFFFFFFF00ULL;
 
+namespace {
+// Bitboards of the hash. The keys of the pieces are those of the absolute
+// (white's point of view) squares, so that Mirror() only changes the side to
+// move.
+enum HashKind { kWhiteHash, kBlackHash, kRooksHash, kBishopsHash, kPawnsHash };
+
+struct ZobristKeys {
+  std::uint64_t squares[5][64] = {};
+  // Kings of white and black.
+  std::uint64_t kings[2][64] = {};
+  // Indexed by castling rights from white's point of view.
+  std::uint64_t castlings[16] = {};
+  std::uint64_t black_to_move = 0;
+};
+
+constexpr ZobristKeys MakeZobristKeys() {
+  ZobristKeys keys;
+  // Splitmix64.
+  std::uint64_t state = 0x5ACA1ULL;
+  auto next = [&state]() {
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  };
+  for (auto& kind : keys.squares) {
+    for (auto& key : kind) key = next();
+  }
+  for (auto& color : keys.kings) {
+    for (auto& key : color) key = next();
+  }
+  // No rights hash to zero, so that they leave the hash unchanged.
+  for (int i = 1; i < 16; i++) keys.castlings[i] = next();
+  keys.black_to_move = next();
+  return keys;
+}
+
+constexpr ZobristKeys kZobristKeys = MakeZobristKeys();
+}  // namespace
+
 void ChessBoard::Clear() {
   std::memset(reinterpret_cast<void*>(this), 0, sizeof(ChessBoard));
+  // Not zero, the cleared board has both kings on a1.
+  hash_ = ComputeHash();
 }
 
 void ChessBoard::Mirror() {
@@ -65,16 +109,49 @@ void ChessBoard::Mirror() {
   std::swap(our_king_, their_king_);
   castlings_.Mirror();
   flipped_ = !flipped_;
+  hash_ ^= kZobristKeys.black_to_move;
+}
+
+uint64_t ChessBoard::SquaresHash(int kind, std::uint64_t squares) const {
+  BitBoard absolute(squares);
+  if (flipped_) absolute.Mirror();
+  uint64_t hash = 0;
+  for (auto square : absolute) {
+    hash ^= kZobristKeys.squares[kind][square.as_int()];
+  }
+  return hash;
+}
+
+uint64_t ChessBoard::ComputeHash() const {
+  auto castlings = castlings_;
+  if (flipped_) castlings.Mirror();
+  BoardSquare our_king = our_king_;
+  BoardSquare their_king = their_king_;
+  if (flipped_) {
+    our_king.Mirror();
+    their_king.Mirror();
+  }
+  return SquaresHash(flipped_ ? kBlackHash : kWhiteHash,
+                     our_pieces_.as_int()) ^
+         SquaresHash(flipped_ ? kWhiteHash : kBlackHash,
+                     their_pieces_.as_int()) ^
+         SquaresHash(kRooksHash, rooks_.as_int()) ^
+         SquaresHash(kBishopsHash, bishops_.as_int()) ^
+         SquaresHash(kPawnsHash, pawns_.as_int()) ^
+         kZobristKeys.kings[flipped_][our_king.as_int()] ^
+         kZobristKeys.kings[!flipped_][their_king.as_int()] ^
+         kZobristKeys.castlings[castlings.as_int()] ^
+         (flipped_ ? kZobristKeys.black_to_move : 0);
 }
 
 namespace {
 static const std::pair<int, int> kKingMoves[] = {
     {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
 
-static const std::pair<int, int> kRookDirections[] = {
+static constexpr std::pair<int, int> kRookDirections[] = {
     {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
 
-static const std::pair<int, int> kBishopDirections[] = {
+static constexpr std::pair<int, int> kBishopDirections[] = {
     {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
 
 // Which squares can rook attack from every of squares.
@@ -189,7 +266,7 @@ struct MagicParams {
   // Relevant occupancy mask.
   uint64_t mask_;
   // Pointer to lookup table.
-  BitBoard* attacks_table_;
+  const uint64_t* attacks_table_;
 #if defined(NO_PEXT)
   // Magic number.
   uint64_t magic_number_;
@@ -202,7 +279,7 @@ struct MagicParams {
 // Magic numbers determined via trial and error with random number generator
 // such that the number of relevant occupancy bits suffice to index the attacks
 // tables with only constructive collisions.
-static const BitBoard kRookMagicNumbers[] = {
+static constexpr uint64_t kRookMagicNumbers[] = {
     0x088000102088C001ULL, 0x10C0200040001000ULL, 0x83001041000B2000ULL,
     0x0680280080041000ULL, 0x488004000A080080ULL, 0x0100180400010002ULL,
     0x040001C401021008ULL, 0x02000C04A980C302ULL, 0x0000800040082084ULL,
@@ -225,7 +302,7 @@ static const BitBoard kRookMagicNumbers[] = {
     0x2001008440001021ULL, 0x2002008830204082ULL, 0x0010145000082101ULL,
     0x01A2001004200842ULL, 0x1007000608040041ULL, 0x000A08100203028CULL,
     0x02D4048040290402ULL};
-static const BitBoard kBishopMagicNumbers[] = {
+static constexpr uint64_t kBishopMagicNumbers[] = {
     0x0008201802242020ULL, 0x0021040424806220ULL, 0x4006360602013080ULL,
     0x0004410020408002ULL, 0x2102021009001140ULL, 0x08C2021004000001ULL,
     0x6001031120200820ULL, 0x1018310402201410ULL, 0x401CE00210820484ULL,
@@ -250,184 +327,171 @@ static const BitBoard kBishopMagicNumbers[] = {
     0x0240080802809010ULL};
 #endif
 
-// Magic parameters for rooks/bishops.
-static MagicParams rook_magic_params[64];
-static MagicParams bishop_magic_params[64];
-
-// Precomputed attacks bitboard tables.
-static BitBoard rook_attacks_table[102400];
-static BitBoard bishop_attacks_table[5248];
-
-// Builds rook or bishop attacks table.
-static void BuildAttacksTable(MagicParams* magic_params,
-                              BitBoard* attacks_table,
-                              const std::pair<int, int>* directions) {
-  // Offset into lookup table.
-  uint32_t table_offset = 0;
-
-  // Initialize for all board squares.
-  for (unsigned square = 0; square < 64; square++) {
-    const BoardSquare b_sq(square);
-
-    // Calculate relevant occupancy masks.
-    BitBoard mask = {0};
-
-    for (int j = 0; j < 4; j++) {
-      auto direction = directions[j];
-      auto dst_row = b_sq.row();
-      auto dst_col = b_sq.col();
-      while (true) {
-        dst_row += direction.first;
-        dst_col += direction.second;
-        // If the next square in this direction is invalid, the current square
-        // is at the board's edge and should not be added.
-        if (!BoardSquare::IsValid(dst_row + direction.first,
-                                  dst_col + direction.second))
-          break;
-        const BoardSquare destination(dst_row, dst_col);
-        mask.set(destination);
+// Returns the squares reached from @square in the four @directions, up to and
+// including the first @occupied square in each. With @relevant_only, the last
+// square before the edge of the board is left out, as its occupancy doesn't
+// matter.
+static constexpr uint64_t SlidingAttacks(
+    int square, const std::pair<int, int>* directions, uint64_t occupied,
+    bool relevant_only) {
+  uint64_t attacks = 0;
+  for (int j = 0; j < 4; j++) {
+    const auto direction = directions[j];
+    int dst_row = square / 8 + direction.first;
+    int dst_col = square % 8 + direction.second;
+    while (dst_row >= 0 && dst_row < 8 && dst_col >= 0 && dst_col < 8) {
+      const int next_row = dst_row + direction.first;
+      const int next_col = dst_col + direction.second;
+      if (relevant_only &&
+          !(next_row >= 0 && next_row < 8 && next_col >= 0 && next_col < 8)) {
+        break;
       }
+      const uint64_t destination = 1ULL << (dst_row * 8 + dst_col);
+      attacks |= destination;
+      if (occupied & destination) break;
+      dst_row = next_row;
+      dst_col = next_col;
     }
+  }
+  return attacks;
+}
 
-    // Set mask.
-    magic_params[square].mask_ = mask.as_int();
+static constexpr const std::pair<int, int>* SliderDirections(bool rook) {
+  return rook ? kRookDirections : kBishopDirections;
+}
 
-    // Cache relevant occupancy board squares.
-    std::vector<BoardSquare> occupancy_squares;
+static constexpr uint64_t RelevantMask(bool rook, int square) {
+  return SlidingAttacks(square, SliderDirections(rook), 0, true);
+}
 
-    for (auto occ_sq : BitBoard(magic_params[square].mask_)) {
-      occupancy_squares.emplace_back(occ_sq);
-    }
+static constexpr int RelevantBits(bool rook, int square) {
+  int bits = 0;
+  for (uint64_t mask = RelevantMask(rook, square); mask; mask &= mask - 1) {
+    bits++;
+  }
+  return bits;
+}
 
+static constexpr MagicParams MakeMagicParams(bool rook, int square,
+                                             const uint64_t* attacks_table) {
+  MagicParams params{};
+  // Set relevant occupancy mask.
+  params.mask_ = RelevantMask(rook, square);
+  // Set pointer to lookup table.
+  params.attacks_table_ = attacks_table;
 #if defined(NO_PEXT)
-    // Set number of shifted bits. The magic numbers have been chosen such that
-    // the number of relevant occupancy bits suffice to index the attacks table.
-    magic_params[square].shift_bits_ = 64 - occupancy_squares.size();
+  params.magic_number_ =
+      rook ? kRookMagicNumbers[square] : kBishopMagicNumbers[square];
+  // Set number of shifted bits. The magic numbers have been chosen such that
+  // the number of relevant occupancy bits suffice to index the attacks table.
+  params.shift_bits_ = 64 - RelevantBits(rook, square);
 #endif
+  return params;
+}
 
-    // Set pointer to lookup table.
-    magic_params[square].attacks_table_ = &attacks_table[table_offset];
-
-    // Clear attacks table (used for sanity check later on).
-    for (int i = 0; i < (1 << occupancy_squares.size()); i++) {
-      attacks_table[table_offset + i] = 0;
-    }
-
-    // Build square attacks table for every possible relevant occupancy
-    // bitboard.
-    for (int i = 0; i < (1 << occupancy_squares.size()); i++) {
-      BitBoard occupancy(0);
-
-      for (size_t bit = 0; bit < occupancy_squares.size(); bit++) {
-        occupancy.set_if(occupancy_squares[bit], (1 << bit) & i);
-      }
-
-      // Calculate attacks bitboard corresponding to this occupancy bitboard.
-      BitBoard attacks(0);
-
-      for (int j = 0; j < 4; j++) {
-        auto direction = directions[j];
-        auto dst_row = b_sq.row();
-        auto dst_col = b_sq.col();
-        while (true) {
-          dst_row += direction.first;
-          dst_col += direction.second;
-          if (!BoardSquare::IsValid(dst_row, dst_col)) break;
-          const BoardSquare destination(dst_row, dst_col);
-          attacks.set(destination);
-          if (occupancy.get(destination)) break;
-        }
-      }
+// Builds the rook or bishop attacks table of a square, for every possible
+// relevant occupancy bitboard.
+template <size_t kTableSize>
+static constexpr std::array<uint64_t, kTableSize> BuildAttacksTable(
+    bool rook, int square) {
+  std::array<uint64_t, kTableSize> attacks_table{};
+  [[maybe_unused]] const auto params = MakeMagicParams(rook, square, nullptr);
+  const uint64_t mask = RelevantMask(rook, square);
+  // The subsets of the mask are enumerated in the order of their pext index.
+  uint64_t occupancy = 0;
+  uint64_t pext_index = 0;
+  do {
+    // Calculate attacks bitboard corresponding to this occupancy bitboard.
+    const uint64_t attacks =
+        SlidingAttacks(square, SliderDirections(rook), occupancy, false);
 
 #if defined(NO_PEXT)
-      // Calculate magic index.
-      uint64_t index = occupancy.as_int();
-      index *= magic_params[square].magic_number_;
-      index >>= magic_params[square].shift_bits_;
-
-      // Sanity check. The magic numbers have been chosen such that
-      // the number of relevant occupancy bits suffice to index the attacks
-      // table. If the table already contains an attacks bitboard, possible
-      // collisions should be constructive.
-      if (attacks_table[table_offset + index] != 0 &&
-          attacks_table[table_offset + index] != attacks) {
-        throw Exception("Invalid magic number!");
-      }
+    // Calculate magic index.
+    const uint64_t index =
+        (occupancy * params.magic_number_) >> params.shift_bits_;
+
+    // Sanity check. The magic numbers have been chosen such that
+    // the number of relevant occupancy bits suffice to index the attacks
+    // table. If the table already contains an attacks bitboard, possible
+    // collisions should be constructive. Evaluating the throw fails the
+    // compilation.
+    if (attacks_table[index] != 0 && attacks_table[index] != attacks) {
+      throw Exception("Invalid magic number!");
+    }
 #else
-      uint64_t index =
-          _pext_u64(occupancy.as_int(), magic_params[square].mask_);
+    const uint64_t index = pext_index;
 #endif
 
-      // Update table.
-      attacks_table[table_offset + index] = attacks;
-    }
+    // Update table.
+    attacks_table[index] = attacks;
+    occupancy = (occupancy - mask) & mask;
+    pext_index++;
+  } while (occupancy != 0);
+  return attacks_table;
+}
 
-    // Update table offset.
-    table_offset += (1 << occupancy_squares.size());
-  }
+// Precomputed attacks bitboard tables, generated at compile time. Each square
+// is a separate constant evaluation, to stay within the limits of compilers.
+template <bool kRook, int kSquare>
+static constexpr auto kAttacksTable =
+    BuildAttacksTable<(size_t{1} << RelevantBits(kRook, kSquare))>(kRook,
+                                                                    kSquare);
+
+template <bool kRook, size_t... kSquares>
+static constexpr std::array<MagicParams, 64> BuildMagicParams(
+    std::index_sequence<kSquares...>) {
+  return {{MakeMagicParams(kRook, kSquares,
+                           kAttacksTable<kRook, kSquares>.data())...}};
 }
 
+// Magic parameters for rooks/bishops.
+static constexpr auto kRookMagicParams =
+    BuildMagicParams<true>(std::make_index_sequence<64>());
+static constexpr auto kBishopMagicParams =
+    BuildMagicParams<false>(std::make_index_sequence<64>());
+
 // Returns the rook attacks bitboard for the given rook board square and the
 // given occupied piece bitboard.
 static inline BitBoard GetRookAttacks(const BoardSquare rook_square,
                                       const BitBoard pieces) {
-  // Calculate magic index.
-  const uint8_t square = rook_square.as_int();
+  const auto& params = kRookMagicParams[rook_square.as_int()];
 
+  // Calculate magic index.
 #if defined(NO_PEXT)
-  uint64_t index = pieces.as_int() & rook_magic_params[square].mask_;
-  index *= rook_magic_params[square].magic_number_;
-  index >>= rook_magic_params[square].shift_bits_;
+  uint64_t index = pieces.as_int() & params.mask_;
+  index *= params.magic_number_;
+  index >>= params.shift_bits_;
 #else
-  uint64_t index = _pext_u64(pieces.as_int(), rook_magic_params[square].mask_);
+  uint64_t index = _pext_u64(pieces.as_int(), params.mask_);
 #endif
 
   // Return attacks bitboard.
-  return rook_magic_params[square].attacks_table_[index];
+  return params.attacks_table_[index];
 }
 
 // Returns the bishop attacks bitboard for the given bishop board square and
 // the given occupied piece bitboard.
 static inline BitBoard GetBishopAttacks(const BoardSquare bishop_square,
                                         const BitBoard pieces) {
-  // Calculate magic index.
-  const uint8_t square = bishop_square.as_int();
+  const auto& params = kBishopMagicParams[bishop_square.as_int()];
 
+  // Calculate magic index.
 #if defined(NO_PEXT)
-  uint64_t index = pieces.as_int() & bishop_magic_params[square].mask_;
-  index *= bishop_magic_params[square].magic_number_;
-  index >>= bishop_magic_params[square].shift_bits_;
+  uint64_t index = pieces.as_int() & params.mask_;
+  index *= params.magic_number_;
+  index >>= params.shift_bits_;
 #else
-  uint64_t index =
-      _pext_u64(pieces.as_int(), bishop_magic_params[square].mask_);
+  uint64_t index = _pext_u64(pieces.as_int(), params.mask_);
 #endif
 
   // Return attacks bitboard.
-  return bishop_magic_params[square].attacks_table_[index];
+  return params.attacks_table_[index];
 }
 
 }  // namespace
 
-void InitializeMagicBitboards() {
-#if defined(NO_PEXT)
-  // Set magic numbers for all board squares.
-  for (unsigned square = 0; square < 64; square++) {
-    rook_magic_params[square].magic_number_ =
-        kRookMagicNumbers[square].as_int();
-    bishop_magic_params[square].magic_number_ =
-        kBishopMagicNumbers[square].as_int();
-  }
-#endif
-
-  // Build attacks tables.
-  BuildAttacksTable(rook_magic_params, rook_attacks_table, kRookDirections);
-  BuildAttacksTable(bishop_magic_params, bishop_attacks_table,
-                    kBishopDirections);
-}
-
 MoveList ChessBoard::GeneratePseudolegalMoves() const {
   MoveList result;
-  result.reserve(60);
   for (auto source : our_pieces_) {
     // King
     if (source == our_king_) {
@@ -569,6 +633,35 @@ MoveList ChessBoard::GeneratePseudolegalMoves() const {
 }  // namespace lczero
 
 bool ChessBoard::ApplyMove(Move move) {
+  const ChessBoard before = *this;
+  const bool reset_50_moves = MovePieces(move);
+  // Only the few changed squares are hashed.
+  auto castlings = castlings_;
+  auto castlings_before = before.castlings_;
+  BoardSquare king_before = before.our_king_;
+  BoardSquare king = our_king_;
+  if (flipped_) {
+    castlings.Mirror();
+    castlings_before.Mirror();
+    king_before.Mirror();
+    king.Mirror();
+  }
+  hash_ ^= SquaresHash(flipped_ ? kBlackHash : kWhiteHash,
+                       our_pieces_.as_int() ^ before.our_pieces_.as_int()) ^
+           SquaresHash(flipped_ ? kWhiteHash : kBlackHash,
+                       their_pieces_.as_int() ^ before.their_pieces_.as_int()) ^
+           SquaresHash(kRooksHash, rooks_.as_int() ^ before.rooks_.as_int()) ^
+           SquaresHash(kBishopsHash,
+                       bishops_.as_int() ^ before.bishops_.as_int()) ^
+           SquaresHash(kPawnsHash, pawns_.as_int() ^ before.pawns_.as_int()) ^
+           kZobristKeys.kings[flipped_][king_before.as_int()] ^
+           kZobristKeys.kings[flipped_][king.as_int()] ^
+           kZobristKeys.castlings[castlings_before.as_int()] ^
+           kZobristKeys.castlings[castlings.as_int()];
+  return reset_50_moves;
+}
+
+bool ChessBoard::MovePieces(Move move) {
   const auto& from = move.from();
   const auto& to = move.to();
   const auto from_row = from.row();
@@ -695,6 +788,11 @@ bool ChessBoard::ApplyMove(Move move) {
 }
 
 bool ChessBoard::IsUnderAttack(BoardSquare square) const {
+  return IsUnderAttack(square, their_pieces_, our_pieces_ | their_pieces_);
+}
+
+bool ChessBoard::IsUnderAttack(BoardSquare square, BitBoard theirs,
+                               BitBoard occupied) const {
   const int row = square.row();
   const int col = square.col();
   // Check king.
@@ -704,24 +802,21 @@ bool ChessBoard::IsUnderAttack(BoardSquare square) const {
     if (std::abs(krow - row) <= 1 && std::abs(kcol - col) <= 1) return true;
   }
   // Check rooks (and queens).
-  if (GetRookAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & rooks_)) {
+  if (GetRookAttacks(square, occupied).intersects(theirs & rooks_)) {
     return true;
   }
   // Check bishops.
-  if (GetBishopAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & bishops_)) {
+  if (GetBishopAttacks(square, occupied).intersects(theirs & bishops_)) {
     return true;
   }
   // Check pawns.
-  if (kPawnAttacks[square.as_int()].intersects(their_pieces_ & pawns_)) {
+  if (kPawnAttacks[square.as_int()].intersects(theirs & pawns_)) {
     return true;
   }
   // Check knights.
   {
-    if (kKnightAttacks[square.as_int()].intersects(their_pieces_ - their_king_ -
-                                                   rooks_ - bishops_ -
-                                                   (pawns_ & kPawnMask))) {
+    if (kKnightAttacks[square.as_int()].intersects(
+            theirs - their_king_ - rooks_ - bishops_ - (pawns_ & kPawnMask))) {
       return true;
     }
   }
@@ -958,19 +1053,195 @@ bool ChessBoard::IsLegalMove(Move move,
 }
 
 MoveList ChessBoard::GenerateLegalMoves() const {
-  const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
-  MoveList result = GeneratePseudolegalMoves();
-  result.erase(
-      std::remove_if(result.begin(), result.end(),
-                     [&](Move m) { return !IsLegalMove(m, king_attack_info); }),
-      result.end());
+  static_assert(kMaxLegalMoves <= MoveList::kCapacity);
+  MoveList result;
+  result.resize_for_overwrite(kMaxLegalMoves);
+  result.resize_for_overwrite(GenerateLegalMoves(result.data()));
   return result;
 }
 
+namespace {
+// Squares on the line through @king and @piece, except these two.
+BitBoard PinRay(BoardSquare king, BoardSquare piece) {
+  if (king.row() == piece.row() || king.col() == piece.col()) {
+    return kRookAttacks[king.as_int()] & kRookAttacks[piece.as_int()];
+  }
+  return kBishopAttacks[king.as_int()] & kBishopAttacks[piece.as_int()];
+}
+}  // namespace
+
+int ChessBoard::GenerateLegalMoves(Move* moves) const {
+  const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+  // Pieces other than the king have to capture the checking piece or block
+  // its line when in check.
+  const BitBoard check_mask = king_attack_info.in_check()
+                                  ? king_attack_info.attack_lines_
+                                  : BitBoard(~0ULL);
+  int count = 0;
+  for (auto source : our_pieces_) {
+    // King
+    if (source == our_king_) {
+      // The king doesn't shield the squares behind it from sliders.
+      const BitBoard without_king = occupied - our_king_;
+      for (const auto& delta : kKingMoves) {
+        const auto dst_row = source.row() + delta.first;
+        const auto dst_col = source.col() + delta.second;
+        if (!BoardSquare::IsValid(dst_row, dst_col)) continue;
+        const BoardSquare destination(dst_row, dst_col);
+        if (our_pieces_.get(destination)) continue;
+        if (IsUnderAttack(destination, their_pieces_, without_king)) continue;
+        moves[count++] = Move(source, destination);
+      }
+      // Castlings, same checks as in GeneratePseudolegalMoves().
+      auto walk_free = [this](int from, int to, int rook, int king) {
+        for (int i = from; i <= to; ++i) {
+          if (i == rook || i == king) continue;
+          if (our_pieces_.get(i) || their_pieces_.get(i)) return false;
+        }
+        return true;
+      };
+      auto range_attacked = [this](int from, int to) {
+        if (from == to) return IsUnderAttack(from);
+        const int increment = from < to ? 1 : -1;
+        while (from != to) {
+          if (IsUnderAttack(from)) return true;
+          from += increment;
+        }
+        return false;
+      };
+      // The destination of the king is checked with the pieces where they
+      // are after castling, the rook may have been shielding it.
+      auto destination_safe = [&](BoardSquare rook, BoardSquare king_dst,
+                                  BoardSquare rook_dst) {
+        BitBoard after = occupied - our_king_ - rook;
+        after.set(king_dst);
+        after.set(rook_dst);
+        return !IsUnderAttack(king_dst, their_pieces_, after);
+      };
+      const uint8_t king = source.col();
+      if (castlings_.we_can_000()) {
+        const uint8_t qrook = castlings_.queenside_rook();
+        const BoardSquare rook(RANK_1, qrook);
+        if (walk_free(std::min(static_cast<uint8_t>(C1), qrook),
+                      std::max(static_cast<uint8_t>(D1), king), qrook, king) &&
+            !range_attacked(king, C1) && destination_safe(rook, C1, D1)) {
+          moves[count++] = Move(source, rook);
+        }
+      }
+      if (castlings_.we_can_00()) {
+        const uint8_t krook = castlings_.kingside_rook();
+        const BoardSquare rook(RANK_1, krook);
+        if (walk_free(std::min(static_cast<uint8_t>(F1), king),
+                      std::max(static_cast<uint8_t>(G1), krook), krook, king) &&
+            !range_attacked(king, G1) && destination_safe(rook, G1, F1)) {
+          moves[count++] = Move(source, rook);
+        }
+      }
+      continue;
+    }
+    // Only the king can get out of a double check.
+    if (king_attack_info.in_double_check()) continue;
+    // Squares the piece may move to, apart from en passant captures.
+    BitBoard targets = check_mask - our_pieces_;
+    if (king_attack_info.is_pinned(source)) {
+      targets &= PinRay(our_king_, source);
+    }
+    bool processed_piece = false;
+    // Rook (and queen)
+    if (rooks_.get(source)) {
+      processed_piece = true;
+      for (const auto& destination :
+           GetRookAttacks(source, occupied) & targets) {
+        moves[count++] = Move(source, destination);
+      }
+    }
+    // Bishop (and queen)
+    if (bishops_.get(source)) {
+      processed_piece = true;
+      for (const auto& destination :
+           GetBishopAttacks(source, occupied) & targets) {
+        moves[count++] = Move(source, destination);
+      }
+    }
+    if (processed_piece) continue;
+    // Pawns.
+    if ((pawns_ & kPawnMask).get(source)) {
+      // Moves forward.
+      {
+        const auto dst_row = source.row() + 1;
+        const auto dst_col = source.col();
+        const BoardSquare destination(dst_row, dst_col);
+
+        if (!occupied.get(destination)) {
+          if (dst_row != RANK_8) {
+            if (targets.get(destination)) {
+              moves[count++] = Move(source, destination);
+            }
+            // Maybe it'll be possible to move two squares.
+            const BoardSquare double_push(RANK_4, dst_col);
+            if (dst_row == RANK_3 && !occupied.get(double_push) &&
+                targets.get(double_push)) {
+              moves[count++] = Move(source, double_push);
+            }
+          } else if (targets.get(destination)) {
+            // Promotions
+            for (auto promotion : kPromotions) {
+              moves[count++] = Move(source, destination, promotion);
+            }
+          }
+        }
+      }
+      // Captures.
+      {
+        for (auto direction : {-1, 1}) {
+          const auto dst_row = source.row() + 1;
+          const auto dst_col = source.col() + direction;
+          if (dst_col < 0 || dst_col >= 8) continue;
+          const BoardSquare destination(dst_row, dst_col);
+          if (their_pieces_.get(destination)) {
+            if (!targets.get(destination)) continue;
+            if (dst_row == RANK_8) {
+              // Promotion.
+              for (auto promotion : kPromotions) {
+                moves[count++] = Move(source, destination, promotion);
+              }
+            } else {
+              // Ordinary capture.
+              moves[count++] = Move(source, destination);
+            }
+          } else if (dst_row == RANK_6 && pawns_.get(RANK_8, dst_col)) {
+            // En passant. Both pawns leave their rank, which may uncover an
+            // attack on the king along it or on a diagonal, and the captured
+            // pawn may be the one giving check.
+            const BoardSquare captured(RANK_5, dst_col);
+            BitBoard after = occupied - source - captured;
+            after.set(destination);
+            if (!IsUnderAttack(our_king_, their_pieces_ - captured, after)) {
+              moves[count++] = Move(source, destination);
+            }
+          }
+        }
+      }
+      continue;
+    }
+    // Knight.
+    {
+      for (const auto destination : kKnightAttacks[source.as_int()] & targets) {
+        moves[count++] = Move(source, destination);
+      }
+    }
+  }
+  assert(count <= kMaxLegalMoves);
+  return count;
+}
+
 void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
   Clear();
   int row = 7;
   int col = 0;
+  int our_kings = 0;
+  int their_kings = 0;
 
   // Remove any trailing whitespaces to detect eof after the last field.
   fen.erase(std::find_if(fen.rbegin(), fen.rend(),
@@ -1020,8 +1291,10 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
 
     if (c == 'K') {
       our_king_.set(row, col);
+      ++our_kings;
     } else if (c == 'k') {
       their_king_.set(row, col);
+      ++their_kings;
     } else if (c == 'R' || c == 'r') {
       rooks_.set(row, col);
     } else if (c == 'B' || c == 'b') {
@@ -1042,6 +1315,30 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
     ++col;
   }
 
+  // Move generation writes into fixed-size buffers sized for legal positions,
+  // so reject material that cannot arise in a game.
+  if (our_kings != 1 || their_kings != 1) {
+    throw Exception("Bad fen string (need exactly one king per side): " + fen);
+  }
+  if (our_pieces_.count() > 16 || their_pieces_.count() > 16) {
+    throw Exception("Bad fen string (more than 16 pieces per side): " + fen);
+  }
+  if ((our_pieces_ & pawns_).count() > 8 ||
+      (their_pieces_ & pawns_).count() > 8) {
+    throw Exception("Bad fen string (more than 8 pawns per side): " + fen);
+  }
+  for (const auto& side : {our_pieces_, their_pieces_}) {
+    // Every piece beyond the initial set must come from a promoted pawn.
+    const auto excess = [&](const BitBoard& pieces, int initial) {
+      return std::max((side & pieces).count() - initial, 0);
+    };
+    const int promoted = excess(queens(), 1) + excess(rooks(), 2) +
+                         excess(bishops(), 2) + excess(knights(), 2);
+    if (promoted > 8 - (side & pawns_).count()) {
+      throw Exception("Bad fen string (too many promoted pieces): " + fen);
+    }
+  }
+
   if (castlings != "-") {
     uint8_t left_rook = FILE_A;
     uint8_t right_rook = FILE_H;
@@ -1108,6 +1405,7 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
     pawns_.set((square.row() == RANK_3) ? RANK_1 : RANK_8, square.col());
   }
 
+  hash_ = ComputeHash();
   if (who_to_move == "b" || who_to_move == "B") {
     Mirror();
   } else if (who_to_move != "w" && who_to_move != "W") {
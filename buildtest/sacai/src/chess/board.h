@@ -35,9 +35,6 @@
 
 namespace lczero {
 
-// Initializes internal magic bitboard structures.
-void InitializeMagicBitboards();
-
 // Represents king attack info used during legal move detection.
 class KingAttackInfo {
  public:
@@ -59,12 +56,14 @@ class KingAttackInfo {
 // Unlike most chess engines, the board is mirrored for black.
 class ChessBoard {
  public:
-  ChessBoard() = default;
+  ChessBoard() { Clear(); }
   ChessBoard(const std::string& fen) { SetFromFen(fen); }
 
   static const char* kStartposFen;
   static const ChessBoard kStartposBoard;
   static const BitBoard kPawnMask;
+  // Room needed for the legal moves of any position (218 at most).
+  static constexpr int kMaxLegalMoves = 256;
 
   // Sets position from FEN string.
   // If @rule50_ply and @moves are not nullptr, they are filled with number
@@ -96,6 +95,11 @@ class ChessBoard {
   bool HasMatingMaterial() const;
   // Generates legal moves.
   MoveList GenerateLegalMoves() const;
+  // Writes the legal moves to @moves, which must have room for kMaxLegalMoves
+  // of them, and returns how many there are. They come in the same order as
+  // from GeneratePseudolegalMoves(), but are generated legal directly from the
+  // pins and checks of the king.
+  int GenerateLegalMoves(Move* moves) const;
   // Check whether pseudolegal move is legal.
   bool IsLegalMove(Move move, const KingAttackInfo& king_attack_info) const;
   // Returns whether two moves are actually the same move in the position.
@@ -105,14 +109,9 @@ class ChessBoard {
   // Returns the same move but with castling encoded in modern way.
   Move GetModernMove(Move move) const;
 
-  uint64_t Hash() const {
-    return HashCat({our_pieces_.as_int(), their_pieces_.as_int(),
-                    rooks_.as_int(), bishops_.as_int(), pawns_.as_int(),
-                    (static_cast<uint32_t>(our_king_.as_int()) << 24) |
-                        (static_cast<uint32_t>(their_king_.as_int()) << 16) |
-                        (static_cast<uint32_t>(castlings_.as_int()) << 8) |
-                        static_cast<uint32_t>(flipped_)});
-  }
+  // Zobrist hash of the position. It is kept up to date by ApplyMove() and
+  // Mirror() rather than computed on each call.
+  uint64_t Hash() const { return hash_; }
 
   class Castlings {
    public:
@@ -218,7 +217,7 @@ class ChessBoard {
   bool flipped() const { return flipped_; }
 
   bool operator==(const ChessBoard& other) const {
-    return (our_pieces_ == other.our_pieces_) &&
+    return (hash_ == other.hash_) && (our_pieces_ == other.our_pieces_) &&
            (their_pieces_ == other.their_pieces_) && (rooks_ == other.rooks_) &&
            (bishops_ == other.bishops_) && (pawns_ == other.pawns_) &&
            (our_king_ == other.our_king_) &&
@@ -254,6 +253,17 @@ class ChessBoard {
   };
 
  private:
+  // ApplyMove() without the update of the hash.
+  bool MovePieces(Move move);
+  // Returns the hash of the @squares set in a bitboard of the @kind.
+  uint64_t SquaresHash(int kind, std::uint64_t squares) const;
+  // Computes the hash from scratch.
+  uint64_t ComputeHash() const;
+  // Checks if the square is under attack from "their" pieces in @theirs, with
+  // pieces on the @occupied squares.
+  bool IsUnderAttack(BoardSquare square, BitBoard theirs,
+                     BitBoard occupied) const;
+
   // All white pieces.
   BitBoard our_pieces_;
   // All black pieces.
@@ -272,6 +282,8 @@ class ChessBoard {
   BoardSquare their_king_;
   Castlings castlings_;
   bool flipped_ = false;  // aka "Black to move".
+  // Zobrist hash, always equal to ComputeHash().
+  std::uint64_t hash_ = 0;
 };
 
 }  // namespace lczero
@@ -20,6 +20,7 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
 #include <iostream>
 
 #include "chess/bitboard.h"
@@ -210,6 +211,55 @@ TEST(ChessBoard, MoveGenPosition6) {
   EXPECT_EQ(Perft(board, 4), 3894594);
 }
 
+namespace {
+// Positions with discovered checks by en passant, pins, check evasions and
+// castling next to checks.
+const struct {
+  const char* const fen;
+  const int depth;
+  const int perft;
+} kTrickyPositions[] = {
+    {"3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888},
+    {"8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 6, 1015133},
+    {"8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},
+    {"5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},
+    {"3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},
+    {"r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},
+    {"r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},
+    {"8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", 5, 1004658},
+    {"4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},
+    {"8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},
+    {"K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},
+    {"8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527},
+};
+}  // namespace
+
+TEST(ChessBoard, MoveGenTrickyPositions) {
+  for (const auto& x : kTrickyPositions) {
+    ChessBoard board;
+    board.SetFromFen(x.fen);
+    EXPECT_EQ(Perft(board, x.depth), x.perft) << "Position: [" << x.fen << "]";
+  }
+}
+
+TEST(ChessBoard, LegalMovesIntoBuffer) {
+  ChessBoard board;
+  board.SetFromFen(
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  std::array<Move, ChessBoard::kMaxLegalMoves> moves;
+  const int count = board.GenerateLegalMoves(moves.data());
+  const auto legal_moves = board.GenerateLegalMoves();
+  ASSERT_EQ(count, 48);
+  ASSERT_EQ(legal_moves.size(), 48u);
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(moves[i].as_packed_int(), legal_moves[i].as_packed_int());
+    EXPECT_TRUE(board.IsLegalMove(moves[i], board.GenerateKingAttackInfo()));
+  }
+  // The position with the most legal moves known.
+  board.SetFromFen("R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1");
+  EXPECT_EQ(board.GenerateLegalMoves(moves.data()), 218);
+}
+
 namespace {
 const struct {
   const char* const fen;
@@ -2276,6 +2326,17 @@ TEST(ChessBoard, InvalidFEN) {
   TestInvalid("rnbqkbnr/ppp2ppp/4p3/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq A6 0 3");
 }
 
+// Impossible material could overflow the legal move buffer.
+TEST(ChessBoard, InvalidMaterialFEN) {
+  // 276 legal moves.
+  TestInvalid("BQQQQQQk/Q6Q/Q6Q/Q6Q/Q6Q/Q6Q/Q6Q/KQQQQQQQ w - - 0 1");
+  TestInvalid("4k3/pppppppp/p7/8/8/8/PPPPPPPP/4K3 w - - 0 1");
+  TestInvalid("4k3/8/8/8/8/8/8/8 w - - 0 1");
+  TestInvalid("4k3/8/8/8/8/8/8/3KK3 w - - 0 1");
+  TestInvalid("QQQQQQQk/QQQQ4/8/8/8/8/8/K6Q w - - 0 1");
+  TestInvalid("4k3/8/8/8/8/8/PPPPPPPP/NNNK4 w - - 0 1");
+}
+
 // Default promotion to knight was leaving an en-passant flag set.
 TEST(ChessBoard, InvalidEnPassantFromKnightPromotion) {
   ChessBoard board;
@@ -2288,6 +2349,5 @@ TEST(ChessBoard, InvalidEnPassantFromKnightPromotion) {
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
@@ -0,0 +1,193 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/book.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "utils/endian.h"
+#include "utils/exception.h"
+#include "utils/random.h"
+
+namespace lczero {
+namespace {
+
+constexpr char kFileMagic[8] = {'L', 'C', '0', 'B', 'O', 'O', 'K', '1'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kFileHeaderSize = 24;
+constexpr size_t kEntrySize = 16;
+// Number of entries from which the writer starts merging them.
+constexpr size_t kMinCompactSize = 1 << 20;
+
+template <typename T>
+void WriteValue(std::ofstream* output, T value) {
+  char bytes[sizeof(T)];
+  StoreLittleEndian(value, bytes);
+  output->write(bytes, sizeof(T));
+}
+
+template <typename T>
+T Read(const char* data) {
+  return LoadLittleEndian<T>(data);
+}
+
+}  // namespace
+
+void BookWriter::AddOpening(const Opening& opening, int max_plies) {
+  ChessBoard board(opening.start_fen);
+  const int plies = std::min<int>(max_plies, opening.moves.size());
+  for (int i = 0; i < plies; i++) {
+    Move move = opening.moves[i];
+    if (board.flipped()) move.Mirror();
+    const auto legal_moves = board.GenerateLegalMoves();
+    if (std::find(legal_moves.begin(), legal_moves.end(), move) ==
+        legal_moves.end()) {
+      break;
+    }
+    entries_.push_back({board.Hash(), move.as_raw_int(), 1});
+    board.ApplyMove(move);
+    board.Mirror();
+  }
+  if (entries_.size() >= std::max(kMinCompactSize, 2 * compacted_size_)) {
+    Compact();
+  }
+}
+
+void BookWriter::Compact() {
+  std::sort(entries_.begin(), entries_.end(),
+            [](const BookEntry& a, const BookEntry& b) {
+              return a.hash != b.hash ? a.hash < b.hash : a.move < b.move;
+            });
+  size_t size = 0;
+  for (const auto& entry : entries_) {
+    if (size > 0 && entries_[size - 1].hash == entry.hash &&
+        entries_[size - 1].move == entry.move) {
+      auto& weight = entries_[size - 1].weight;
+      weight = std::min<uint64_t>(uint64_t{weight} + entry.weight,
+                                  std::numeric_limits<uint32_t>::max());
+    } else {
+      entries_[size++] = entry;
+    }
+  }
+  entries_.resize(size);
+  compacted_size_ = size;
+}
+
+uint64_t BookWriter::Write(const std::string& filename, uint32_t min_weight) {
+  Compact();
+  uint64_t count = 0;
+  for (const auto& entry : entries_) count += entry.weight >= min_weight;
+
+  std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+  if (!output) throw Exception("Cannot create book file " + filename);
+  output.write(kFileMagic, sizeof(kFileMagic));
+  WriteValue(&output, kVersion);
+  WriteValue(&output, uint32_t{0});
+  WriteValue(&output, count);
+  for (const auto& entry : entries_) {
+    if (entry.weight < min_weight) continue;
+    WriteValue(&output, entry.hash);
+    WriteValue(&output, entry.move);
+    WriteValue(&output, uint16_t{0});
+    WriteValue(&output, entry.weight);
+  }
+  output.close();
+  if (!output) throw Exception("Error writing book file " + filename);
+  return count;
+}
+
+BookReader::BookReader(const std::string& filename) : file_(filename) {
+  if (file_.size() < kFileHeaderSize ||
+      std::memcmp(file_.data(), kFileMagic, sizeof(kFileMagic)) != 0) {
+    throw Exception(filename + " is not a book file.");
+  }
+  if (Read<uint32_t>(file_.data() + 8) != kVersion) {
+    throw Exception("Unsupported version of book file " + filename);
+  }
+  size_ = Read<uint64_t>(file_.data() + 16);
+  if (size_ != (file_.size() - kFileHeaderSize) / kEntrySize) {
+    throw Exception("Corrupt book file " + filename);
+  }
+}
+
+BookEntry BookReader::GetEntry(uint64_t i) const {
+  const char* data = file_.data() + kFileHeaderSize + i * kEntrySize;
+  return {Read<uint64_t>(data), Read<uint16_t>(data + 8),
+          Read<uint32_t>(data + 12)};
+}
+
+std::vector<std::pair<Move, uint32_t>> BookReader::GetMoves(
+    const ChessBoard& board) const {
+  const uint64_t hash = board.Hash();
+  uint64_t lo = 0;
+  uint64_t hi = size_;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    if (GetEntry(mid).hash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  std::vector<std::pair<Move, uint32_t>> moves;
+  MoveList legal_moves;
+  for (; lo < size_; lo++) {
+    const auto entry = GetEntry(lo);
+    if (entry.hash != hash) break;
+    // Hash collisions are unlikely, but would lead to illegal moves.
+    if (legal_moves.empty()) legal_moves = board.GenerateLegalMoves();
+    const Move move = Move::FromRawInt(entry.move);
+    if (std::find(legal_moves.begin(), legal_moves.end(), move) !=
+        legal_moves.end()) {
+      moves.emplace_back(move, entry.weight);
+    }
+  }
+  return moves;
+}
+
+Move BookReader::PickMove(const ChessBoard& board, uint32_t min_weight) const {
+  auto moves = GetMoves(board);
+  moves.erase(std::remove_if(moves.begin(), moves.end(),
+                             [&](const auto& move) {
+                               return move.second < min_weight;
+                             }),
+              moves.end());
+  if (moves.empty()) return Move();
+  double total = 0.0;
+  for (const auto& move : moves) total += move.second;
+  double pick = Random::Get().GetDouble(total);
+  for (const auto& move : moves) {
+    if (pick < move.second) return move.first;
+    pick -= move.second;
+  }
+  return moves.back().first;
+}
+
+}  // namespace lczero
@@ -0,0 +1,96 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chess/board.h"
+#include "chess/pgn.h"
+#include "utils/filesystem.h"
+
+namespace lczero {
+
+// Opening books in a compact binary format, which are looked up in place in
+// the mapped file.
+//
+// File layout (little endian):
+//   header:  "LC0BOOK1", uint32 version, uint32 reserved, uint64 entry count
+//   entries: sorted by hash and then move: uint64 position hash, uint16 move,
+//            uint16 reserved, uint32 weight.
+// The position hash is ChessBoard::Hash(), and moves are from the point of
+// view of the side to move, as ChessBoard generates them. The weight of a move
+// is the number of games in which it was played.
+
+struct BookEntry {
+  uint64_t hash;
+  uint16_t move;
+  uint32_t weight;
+};
+
+class BookWriter {
+ public:
+  // Adds the moves of the first @max_plies plies of @opening. Counting stops
+  // at the first illegal move.
+  void AddOpening(const Opening& opening, int max_plies);
+  // Writes the moves with at least @min_weight to @filename. Returns the
+  // number of entries written.
+  uint64_t Write(const std::string& filename, uint32_t min_weight);
+
+ private:
+  // Sorts the entries and merges those of the same move.
+  void Compact();
+
+  std::vector<BookEntry> entries_;
+  size_t compacted_size_ = 0;
+};
+
+class BookReader {
+ public:
+  // Maps @filename. Throws exception if it is not a book.
+  explicit BookReader(const std::string& filename);
+
+  // Returns the legal book moves of @board with their weights.
+  std::vector<std::pair<Move, uint32_t>> GetMoves(
+      const ChessBoard& board) const;
+  // Picks one of the book moves of @board with at least @min_weight, at random
+  // in proportion to the weights. Returns Move() if there is none.
+  Move PickMove(const ChessBoard& board, uint32_t min_weight) const;
+
+  uint64_t size() const { return size_; }
+
+ private:
+  BookEntry GetEntry(uint64_t i) const;
+
+  MappedFile file_;
+  uint64_t size_ = 0;
+};
+
+}  // namespace lczero
@@ -0,0 +1,107 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/book.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+const std::string kBookFile = "book_test.bin";
+
+Opening MakeOpening(const std::vector<std::string>& moves) {
+  Opening opening;
+  for (const auto& move : moves) opening.moves.emplace_back(move);
+  return opening;
+}
+
+}  // namespace
+
+TEST(Book, RoundTrip) {
+  BookWriter writer;
+  writer.AddOpening(MakeOpening({"e2e4", "e7e5", "g1f3"}), 20);
+  writer.AddOpening(MakeOpening({"e2e4", "c7c5", "g1f3"}), 20);
+  writer.AddOpening(MakeOpening({"d2d4", "d7d5", "c2c4"}), 2);
+  // Stops at the illegal move.
+  writer.AddOpening(MakeOpening({"e2e4", "e7e6", "e4e6", "d7d5"}), 20);
+  EXPECT_EQ(writer.Write(kBookFile, 1), 8u);
+
+  BookReader reader(kBookFile);
+  EXPECT_EQ(reader.size(), 8u);
+  ChessBoard board(ChessBoard::kStartposFen);
+  auto moves = reader.GetMoves(board);
+  ASSERT_EQ(moves.size(), 2u);
+  for (const auto& move : moves) {
+    if (move.first == Move("e2e4")) {
+      EXPECT_EQ(move.second, 3u);
+    } else {
+      EXPECT_EQ(move.first, Move("d2d4"));
+      EXPECT_EQ(move.second, 1u);
+    }
+  }
+  EXPECT_EQ(reader.PickMove(board, 2), Move("e2e4"));
+  EXPECT_FALSE(reader.PickMove(board, 4));
+
+  // Moves of black are from its point of view.
+  board.ApplyMove(Move("e2e4"));
+  board.Mirror();
+  moves = reader.GetMoves(board);
+  EXPECT_EQ(moves.size(), 3u);
+  EXPECT_NE(std::find(moves.begin(), moves.end(),
+                      std::make_pair(Move("c7c5", true), 1u)),
+            moves.end());
+
+  // Not in the book beyond the given plies.
+  board.SetFromFen(
+      "rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq - 0 2");
+  EXPECT_TRUE(reader.GetMoves(board).empty());
+  std::remove(kBookFile.c_str());
+}
+
+TEST(Book, NotABook) {
+  {
+    std::ofstream output(kBookFile, std::ios::binary | std::ios::trunc);
+    output << "something else entirely";
+  }
+  EXPECT_THROW(BookReader reader(kBookFile), Exception);
+  std::remove(kBookFile.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,494 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/pgn.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <exception>
+#include <thread>
+
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+#include "utils/random.h"
+
+namespace lczero {
+namespace {
+
+// Approximate size of the chunks parsed in parallel.
+constexpr size_t kChunkSize = 1 << 20;
+
+// Tag lines and empty lines end the move text of a game.
+bool IsTagOrEmptyLine(std::string_view line) {
+  if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+  return line.empty() || line[0] == '[';
+}
+
+// Returns the start of the first line at or after @from which ends the move
+// text of a game, or npos if there is none. The games after it can be parsed
+// independently of those before.
+size_t FindGameBoundary(std::string_view text, size_t from) {
+  if (from >= text.size()) return std::string_view::npos;
+  size_t begin = from;
+  if (begin > 0 && text[begin - 1] != '\n') {
+    begin = text.find('\n', begin);
+    if (begin == std::string_view::npos) return begin;
+    begin++;
+  }
+  bool after_move_text = false;
+  while (begin < text.size()) {
+    size_t end = text.find('\n', begin);
+    if (end == std::string_view::npos) end = text.size();
+    const bool tag_or_empty =
+        IsTagOrEmptyLine(text.substr(begin, end - begin));
+    if (tag_or_empty && after_move_text) return begin;
+    after_move_text = !tag_or_empty;
+    begin = end + 1;
+  }
+  return std::string_view::npos;
+}
+
+Move::Promotion PieceToPromotion(int p) {
+  switch (p) {
+    case -1:
+      return Move::Promotion::None;
+    case 2:
+      return Move::Promotion::Queen;
+    case 3:
+      return Move::Promotion::Bishop;
+    case 4:
+      return Move::Promotion::Knight;
+    case 5:
+      return Move::Promotion::Rook;
+    default:
+      // 0 and 1 are pawn and king, which are not legal promotions, other
+      // numbers don't correspond to a known piece type.
+      CERR << "Unexpected promotion!!";
+      throw Exception("Trying to create a move with illegal promotion.");
+  }
+}
+
+Move SanToMove(std::string_view san, const ChessBoard& board) {
+  int p = 0;
+  size_t idx = 0;
+  if (san[0] == 'K') {
+    p = 1;
+  } else if (san[0] == 'Q') {
+    p = 2;
+  } else if (san[0] == 'B') {
+    p = 3;
+  } else if (san[0] == 'N') {
+    p = 4;
+  } else if (san[0] == 'R') {
+    p = 5;
+  } else if (san[0] == 'O' && san.size() > 2 && san[1] == '-' &&
+             san[2] == 'O') {
+    Move m;
+    auto king_board = board.kings() & board.ours();
+    BoardSquare king_sq(GetLowestBit(king_board.as_int()));
+    if (san.size() > 4 && san[3] == '-' && san[4] == 'O') {
+      m = Move(BoardSquare(0, king_sq.col()),
+               BoardSquare(0, board.castlings().queenside_rook()));
+    } else {
+      m = Move(BoardSquare(0, king_sq.col()),
+               BoardSquare(0, board.castlings().kingside_rook()));
+    }
+    return m;
+  }
+  if (p != 0) idx++;
+  // Formats e4 1e5 de5 d1e5 - with optional x's - followed by =Q for
+  // promotions, and even more characters after that also optional.
+  int r1 = -1;
+  int c1 = -1;
+  int r2 = -1;
+  int c2 = -1;
+  int p2 = -1;
+  bool pPending = false;
+  for (; idx < san.size(); idx++) {
+    if (san[idx] == 'x') continue;
+    if (san[idx] == '=') {
+      pPending = true;
+      continue;
+    }
+    if (san[idx] >= '1' && san[idx] <= '8') {
+      r1 = r2;
+      r2 = san[idx] - '1';
+      continue;
+    }
+    if (san[idx] >= 'a' && san[idx] <= 'h') {
+      c1 = c2;
+      c2 = san[idx] - 'a';
+      continue;
+    }
+    if (pPending) {
+      if (san[idx] == 'Q') {
+        p2 = 2;
+      } else if (san[idx] == 'B') {
+        p2 = 3;
+      } else if (san[idx] == 'N') {
+        p2 = 4;
+      } else if (san[idx] == 'R') {
+        p2 = 5;
+      }
+      pPending = false;
+      break;
+    }
+    break;
+  }
+  if (r1 == -1 || c1 == -1) {
+    // Need to find the from cell based on piece.
+    int sr1 = r1;
+    int sr2 = r2;
+    if (board.flipped()) {
+      if (sr1 != -1) sr1 = 7 - sr1;
+      sr2 = 7 - sr2;
+    }
+    BitBoard searchBits;
+    if (p == 0) {
+      searchBits = (board.pawns() & board.ours());
+    } else if (p == 1) {
+      searchBits = (board.kings() & board.ours());
+    } else if (p == 2) {
+      searchBits = (board.queens() & board.ours());
+    } else if (p == 3) {
+      searchBits = (board.bishops() & board.ours());
+    } else if (p == 4) {
+      searchBits = (board.knights() & board.ours());
+    } else if (p == 5) {
+      searchBits = (board.rooks() & board.ours());
+    }
+    auto plm = board.GenerateLegalMoves();
+    int pr1 = -1;
+    int pc1 = -1;
+    for (BoardSquare sq : searchBits) {
+      if (sr1 != -1 && sq.row() != sr1) continue;
+      if (c1 != -1 && sq.col() != c1) continue;
+      if (std::find(plm.begin(), plm.end(),
+                    Move(sq, BoardSquare(sr2, c2), PieceToPromotion(p2))) ==
+          plm.end()) {
+        continue;
+      }
+      if (pc1 != -1) {
+        CERR << "Ambiguous!!";
+        throw Exception("Opening book move seems ambiguous.");
+      }
+      pr1 = sq.row();
+      pc1 = sq.col();
+    }
+    if (pc1 == -1) {
+      CERR << "No Match!!";
+      throw Exception("Opening book move seems illegal.");
+    }
+    r1 = pr1;
+    c1 = pc1;
+    if (board.flipped()) {
+      r1 = 7 - r1;
+    }
+  }
+  Move m(BoardSquare(r1, c1), BoardSquare(r2, c2), PieceToPromotion(p2));
+  if (board.flipped()) m.Mirror();
+  return m;
+}
+
+// Parses the games of a chunk, line by line.
+class ChunkParser {
+ public:
+  explicit ChunkParser(OpeningBook* openings) : openings_(openings) {}
+
+  void ParseLine(std::string_view text) {
+    if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+    // TODO: support line breaks in tags to ensure they are properly ignored.
+    if (text.empty() || text[0] == '[') {
+      if (started_) {
+        Flush();
+        started_ = false;
+      }
+      constexpr std::string_view kFenTag = "[FEN \"";
+      if (text.size() >= kFenTag.size() &&
+          std::equal(kFenTag.begin(), kFenTag.end(), text.begin(),
+                     [](char a, char b) {
+                       return a == std::toupper(static_cast<unsigned char>(b));
+                     })) {
+        const auto start_trimmed = text.substr(kFenTag.size());
+        cur_startpos_ = start_trimmed.substr(0, start_trimmed.find('"'));
+        cur_board_.SetFromFen(cur_startpos_);
+      }
+      return;
+    }
+    // Must have at least one non-tag non-empty line in order to be considered
+    // a game.
+    started_ = true;
+    line_.assign(text);
+    // Handle braced comments.
+    size_t cur_offset = 0;
+    while (true) {
+      if (in_comment_) {
+        const size_t close = line_.find('}', cur_offset);
+        if (close == std::string::npos) break;
+        line_.erase(cur_offset, close + 1 - cur_offset);
+        in_comment_ = false;
+      } else {
+        const size_t open = line_.find('{', cur_offset);
+        if (open == std::string::npos) break;
+        cur_offset = open;
+        in_comment_ = true;
+      }
+    }
+    if (in_comment_) line_.resize(cur_offset);
+    // Trim trailing comment.
+    const size_t semicolon = line_.find(';');
+    if (semicolon != std::string::npos) line_.resize(semicolon);
+    constexpr const char* kWhitespace = " \t\v\f\r";
+    std::string_view rest = line_;
+    while (!rest.empty()) {
+      const size_t begin = rest.find_first_not_of(kWhitespace);
+      if (begin == std::string_view::npos) break;
+      rest.remove_prefix(begin);
+      const size_t end = std::min(rest.find_first_of(kWhitespace), rest.size());
+      ParseWord(rest.substr(0, end));
+      rest.remove_prefix(end);
+    }
+  }
+
+  void Finish() {
+    if (started_) Flush();
+  }
+
+ private:
+  void ParseWord(std::string_view word) {
+    if (word.size() < 2) return;
+    // Trim move numbers from front.
+    const auto idx = word.find('.');
+    if (idx != std::string_view::npos &&
+        std::all_of(word.begin(), word.begin() + idx,
+                    [](char c) { return c >= '0' && c <= '9'; })) {
+      word.remove_prefix(idx + 1);
+    }
+    // Pure move numbers can be skipped.
+    if (word.size() < 2) return;
+    // Ignore score line.
+    if (word == "1/2-1/2" || word == "1-0" || word == "0-1" || word == "*") {
+      return;
+    }
+    cur_game_.push_back(SanToMove(word, cur_board_));
+    cur_board_.ApplyMove(cur_game_.back());
+    // Board ApplyMove wants mirrored for black, but outside code wants
+    // normal, so mirror it back again.
+    // Check equal to 0 since we've already added the position.
+    if ((cur_game_.size() % 2) == 0) {
+      cur_game_.back().Mirror();
+    }
+    cur_board_.Mirror();
+  }
+
+  void Flush() {
+    openings_->Add(cur_startpos_, cur_game_);
+    cur_game_.clear();
+    cur_board_ = ChessBoard::kStartposBoard;
+    cur_startpos_ = ChessBoard::kStartposFen;
+  }
+
+  OpeningBook* const openings_;
+  ChessBoard cur_board_ = ChessBoard::kStartposBoard;
+  std::vector<Move> cur_game_;
+  std::string cur_startpos_ = ChessBoard::kStartposFen;
+  std::string line_;
+  bool in_comment_ = false;
+  bool started_ = false;
+};
+
+void ParseChunk(std::string_view text, OpeningBook* openings) {
+  ChunkParser parser(openings);
+  while (!text.empty()) {
+    const size_t end = std::min(text.find('\n'), text.size());
+    parser.ParseLine(text.substr(0, end));
+    text.remove_prefix(std::min(end + 1, text.size()));
+  }
+  parser.Finish();
+}
+
+}  // namespace
+
+Opening OpeningBook::operator[](size_t idx) const {
+  const Entry& entry = entries_[idx];
+  Opening opening{fens_[entry.start_fen], {}};
+  opening.moves.reserve(entry.size);
+  for (size_t i = 0; i < entry.size; i++) {
+    opening.moves.push_back(Move::FromRawInt(moves_[entry.offset + i]));
+  }
+  return opening;
+}
+
+uint32_t OpeningBook::AddFen(const std::string& fen) {
+  const auto iter = fen_indices_.emplace(fen, fens_.size()).first;
+  if (iter->second == fens_.size()) fens_.push_back(fen);
+  return iter->second;
+}
+
+void OpeningBook::Add(const std::string& start_fen,
+                      const std::vector<Move>& moves) {
+  entries_.push_back({moves_.size(), static_cast<uint32_t>(moves.size()),
+                      AddFen(start_fen)});
+  for (Move move : moves) moves_.push_back(move.as_raw_int());
+}
+
+void OpeningBook::Add(const OpeningBook& other, size_t idx) {
+  entries_.emplace_back();
+  Replace(entries_.size() - 1, other, idx);
+}
+
+void OpeningBook::Replace(size_t idx, const OpeningBook& other,
+                          size_t other_idx) {
+  const Entry& from = other.entries_[other_idx];
+  Entry& to = entries_[idx];
+  // The moves are overwritten in place if they fit, the space of replaced
+  // moves is not reclaimed otherwise.
+  if (from.size > to.size) {
+    to.offset = moves_.size();
+    moves_.resize(moves_.size() + from.size);
+  }
+  to.size = from.size;
+  to.start_fen = AddFen(other.fens_[from.start_fen]);
+  std::copy_n(other.moves_.begin() + from.offset, from.size,
+              moves_.begin() + to.offset);
+}
+
+void OpeningBook::Shuffle() {
+  Random::Get().Shuffle(entries_.begin(), entries_.end());
+}
+
+PgnReader::PgnReader(size_t max_openings)
+    : max_openings_(max_openings),
+      threads_(std::max(1u, std::thread::hardware_concurrency())) {}
+
+void PgnReader::AddPgnFile(const std::string& filepath) {
+  const gzFile file = gzopen(filepath.c_str(), "r");
+  if (!file) {
+    throw Exception(errno == ENOENT ? "Opening book file not found."
+                                    : "Error opening opening book file.");
+  }
+  if (gzdirect(file)) {
+    // Not compressed, parsed straight from the mapped file.
+    gzclose(file);
+    MappedFile mapped(filepath);
+    AddPgnText(std::string_view(mapped.data(), mapped.size()), true);
+    return;
+  }
+  // Compressed files are decompressed a few chunks at a time, the games after
+  // the last boundary are carried over to the next read.
+  const size_t read_size = kChunkSize * threads_;
+  std::string buffer;
+  while (true) {
+    const size_t carried = buffer.size();
+    buffer.resize(carried + read_size);
+    const int read = gzread(file, &buffer[carried], read_size);
+    if (read < 0) {
+      gzclose(file);
+      throw Exception("Error reading opening book file.");
+    }
+    buffer.resize(carried + read);
+    try {
+      buffer.erase(0, AddPgnText(buffer, read == 0));
+    } catch (...) {
+      gzclose(file);
+      throw;
+    }
+    if (read == 0) break;
+  }
+  gzclose(file);
+}
+
+size_t PgnReader::AddPgnText(std::string_view text, bool last) {
+  std::vector<std::string_view> chunks;
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = FindGameBoundary(text, begin + kChunkSize);
+    if (end == std::string_view::npos) {
+      if (!last) break;
+      end = text.size();
+    }
+    chunks.push_back(text.substr(begin, end - begin));
+    begin = end;
+    if (chunks.size() == threads_) {
+      ParseChunks(chunks);
+      chunks.clear();
+    }
+  }
+  ParseChunks(chunks);
+  return begin;
+}
+
+void PgnReader::ParseChunks(const std::vector<std::string_view>& chunks) {
+  std::vector<OpeningBook> parsed(chunks.size());
+  std::vector<std::exception_ptr> errors(chunks.size());
+  const auto parse = [&](size_t i) {
+    try {
+      ParseChunk(chunks[i], &parsed[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < chunks.size(); i++) threads.emplace_back(parse, i);
+  if (!chunks.empty()) parse(0);
+  for (auto& thread : threads) thread.join();
+  // Errors are reported, and games added, in file order.
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (errors[i]) std::rethrow_exception(errors[i]);
+    Merge(parsed[i]);
+  }
+}
+
+void PgnReader::Merge(const OpeningBook& chunk) {
+  for (size_t i = 0; i < chunk.size(); i++) {
+    read_++;
+    if (max_openings_ == 0 || openings_.size() < max_openings_) {
+      openings_.Add(chunk, i);
+      continue;
+    }
+    // Reservoir sampling: the opening replaces a sampled one with probability
+    // max_openings_ / read_.
+    const auto idx = static_cast<uint64_t>(
+        Random::Get().GetDouble(static_cast<double>(read_)));
+    if (idx < max_openings_) openings_.Replace(idx, chunk, i);
+  }
+}
+
+std::vector<Opening> PgnReader::GetGames() const {
+  std::vector<Opening> games;
+  games.reserve(openings_.size());
+  for (size_t i = 0; i < openings_.size(); i++) {
+    games.push_back(openings_[i]);
+  }
+  return games;
+}
+
+}  // namespace lczero
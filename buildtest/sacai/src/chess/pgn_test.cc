@@ -0,0 +1,166 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "chess/pgn.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <string>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+const std::string kPgnFile = "pgn_test.pgn";
+
+void WriteFile(const std::string& filename, const std::string& text) {
+  std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+  output << text;
+}
+
+// Appends all games of @plies moves from @board, in long algebraic notation,
+// until there are @count of them.
+void MakeGames(const ChessBoard& board, int plies, size_t count,
+               std::vector<Move>* moves, std::vector<Opening>* games) {
+  if (moves->size() == static_cast<size_t>(plies)) {
+    games->push_back({ChessBoard::kStartposFen, *moves});
+    return;
+  }
+  for (Move move : board.GenerateLegalMoves()) {
+    if (games->size() == count) return;
+    ChessBoard child = board;
+    child.ApplyMove(move);
+    child.Mirror();
+    if (board.flipped()) move.Mirror();
+    moves->push_back(move);
+    MakeGames(child, plies, count, moves, games);
+    moves->pop_back();
+  }
+}
+
+std::string ToPgn(const std::vector<Opening>& games) {
+  std::string pgn;
+  for (size_t i = 0; i < games.size(); i++) {
+    pgn += "[Event \"Game " + std::to_string(i) + "\"]\n\n";
+    for (size_t j = 0; j < games[i].moves.size(); j++) {
+      if (j % 2 == 0) pgn += std::to_string(j / 2 + 1) + ". ";
+      pgn += games[i].moves[j].as_string() + " ";
+    }
+    pgn += "*\n\n";
+  }
+  return pgn;
+}
+
+void ExpectSameGames(const std::vector<Opening>& a,
+                     const std::vector<Opening>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    EXPECT_EQ(a[i].start_fen, b[i].start_fen) << i;
+    EXPECT_EQ(a[i].moves, b[i].moves) << i;
+  }
+}
+
+}  // namespace
+
+TEST(PgnReader, ReadsGames) {
+  WriteFile(kPgnFile,
+            "[Event \"a\"]\r\n"
+            "[FEN \"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1\"]\r\n\r\n"
+            "1. O-O-O {castles\r\nqueenside} O-O 2. Rd7 ; comment\r\n"
+            "Rf1+ 0-1\r\n\r\n"
+            "1. e4 c5 2. Nf3 *\n"
+            "[Event \"b\"]\n"
+            "1. e4 d5 2. exd5 c6 3. dxc6 Qb6 4. cxb7 Qa6 5. bxa8=N 1-0\n");
+  PgnReader reader;
+  reader.AddPgnFile(kPgnFile);
+  const auto games = reader.GetGames();
+  std::remove(kPgnFile.c_str());
+  ASSERT_EQ(games.size(), 3u);
+  EXPECT_EQ(games[0].start_fen, "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+  EXPECT_EQ(games[0].moves,
+            std::vector<Move>({"e1a1", "e8h8", "d1d7", "f8f1"}));
+  EXPECT_EQ(games[1].start_fen, ChessBoard::kStartposFen);
+  EXPECT_EQ(games[1].moves, std::vector<Move>({"e2e4", "c7c5", "g1f3"}));
+  ASSERT_EQ(games[2].moves.size(), 9u);
+  EXPECT_EQ(games[2].moves.back(), Move("b7a8n"));
+}
+
+TEST(PgnReader, ChunksMatchWholeFile) {
+  // Enough games to span several chunks.
+  std::vector<Opening> games;
+  std::vector<Move> moves;
+  MakeGames(ChessBoard::kStartposBoard, 4, 50000, &moves, &games);
+  const std::string pgn = ToPgn(games);
+  ASSERT_GT(pgn.size(), 1u << 21);
+
+  WriteFile(kPgnFile, pgn);
+  PgnReader reader;
+  reader.AddPgnFile(kPgnFile);
+  ExpectSameGames(reader.GetGames(), games);
+
+  const gzFile file = gzopen(kPgnFile.c_str(), "wb");
+  ASSERT_TRUE(file);
+  gzwrite(file, pgn.data(), pgn.size());
+  gzclose(file);
+  PgnReader gz_reader;
+  gz_reader.AddPgnFile(kPgnFile);
+  ExpectSameGames(gz_reader.GetGames(), games);
+  std::remove(kPgnFile.c_str());
+}
+
+TEST(PgnReader, SamplesOpenings) {
+  std::vector<Opening> games;
+  std::vector<Move> moves;
+  MakeGames(ChessBoard::kStartposBoard, 4, 20000, &moves, &games);
+  WriteFile(kPgnFile, ToPgn(games));
+  PgnReader reader(100);
+  reader.AddPgnFile(kPgnFile);
+  std::remove(kPgnFile.c_str());
+  const OpeningBook openings = reader.ReleaseOpenings();
+  ASSERT_EQ(openings.size(), 100u);
+  // All sampled openings are distinct games of the file, not only the first.
+  std::set<size_t> sampled;
+  for (size_t i = 0; i < openings.size(); i++) {
+    const auto opening = openings[i];
+    const auto iter =
+        std::find_if(games.begin(), games.end(), [&](const Opening& game) {
+          return game.moves == opening.moves;
+        });
+    ASSERT_NE(iter, games.end());
+    sampled.insert(iter - games.begin());
+  }
+  EXPECT_EQ(sampled.size(), 100u);
+  EXPECT_GT(*sampled.rbegin(), games.size() / 2);
+}
+
+TEST(PgnReader, MissingFile) {
+  PgnReader reader;
+  EXPECT_THROW(reader.AddPgnFile("pgn_test_missing.pgn"), Exception);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
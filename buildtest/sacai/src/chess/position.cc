@@ -27,6 +27,7 @@
 
 #include "chess/position.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdlib>
@@ -60,6 +61,19 @@ char GetPieceAt(const lczero::ChessBoard& board, int row, int col) {
 
 }  // namespace
 namespace lczero {
+namespace {
+// Base of the rolling hash of the history.
+constexpr uint64_t kHistoryHashBase = 0x9E3779B97F4A7C15ULL;
+
+uint64_t HistoryHashBasePower(int exponent) {
+  uint64_t result = 1;
+  for (uint64_t base = kHistoryHashBase; exponent; exponent >>= 1) {
+    if (exponent & 1) result *= base;
+    base *= base;
+  }
+  return result;
+}
+}  // namespace
 
 Position::Position(const Position& parent, Move m)
     : rule50_ply_(parent.rule50_ply_ + 1), ply_count_(parent.ply_count_ + 1) {
@@ -110,8 +124,19 @@ GameResult PositionHistory::ComputeGameResult() const {
 
 void PositionHistory::Reset(const ChessBoard& board, int rule50_ply,
                             int game_ply) {
+  base_ = nullptr;
+  base_length_ = 0;
   positions_.clear();
   positions_.emplace_back(board, rule50_ply, game_ply);
+  hashes_.assign(
+      1, {positions_.back().GetBoard().Hash(), positions_.back().Hash()});
+}
+
+void PositionHistory::ExtendFrom(const PositionHistory& base) {
+  base_ = &base;
+  base_length_ = base.GetLength();
+  positions_.clear();
+  hashes_.clear();
 }
 
 void PositionHistory::Append(Move m) {
@@ -119,45 +144,57 @@ void PositionHistory::Append(Move m) {
   //                has a bug in implementation of emplace_back, when
   //                reallocation happens. (it also reallocates Last())
   positions_.push_back(Position(Last(), m));
+  const uint64_t prefix = GetHashesAt(GetLength() - 2).prefix;
+  hashes_.push_back({positions_.back().GetBoard().Hash(), 0});
   int cycle_length;
   int repetitions = ComputeLastMoveRepetitions(&cycle_length);
   positions_.back().SetRepetitions(repetitions, cycle_length);
+  hashes_.back().prefix =
+      prefix * kHistoryHashBase + positions_.back().Hash();
 }
 
 int PositionHistory::ComputeLastMoveRepetitions(int* cycle_length) const {
   *cycle_length = 0;
-  const auto& last = positions_.back();
-  // TODO(crem) implement hash/cache based solution.
+  const auto& last = Last();
   if (last.GetRule50Ply() < 4) return 0;
 
-  for (int idx = positions_.size() - 3; idx >= 0; idx -= 2) {
-    const auto& pos = positions_[idx];
+  // Positions before the last zeroing move can't repeat, and only every other
+  // one has the same side to move. The board hashes are scanned, and boards
+  // only compared when they match.
+  const int size = GetLength();
+  const int first = std::max(0, size - 1 - last.GetRule50Ply());
+  const uint64_t key = hashes_.back().board;
+  for (int idx = size - 3; idx >= first; idx -= 2) {
+    if (GetHashesAt(idx).board != key) continue;
+    const auto& pos = GetPositionAt(idx);
     if (pos.GetBoard() == last.GetBoard()) {
-      *cycle_length = positions_.size() - 1 - idx;
+      *cycle_length = size - 1 - idx;
       return 1 + pos.GetRepetitions();
     }
-    if (pos.GetRule50Ply() < 2) return 0;
   }
   return 0;
 }
 
 bool PositionHistory::DidRepeatSinceLastZeroingMove() const {
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
-       ++iter) {
-    if (iter->GetRepetitions() > 0) return true;
-    if (iter->GetRule50Ply() == 0) return false;
+  for (int idx = GetLength() - 1; idx >= 0; --idx) {
+    const auto& pos = GetPositionAt(idx);
+    if (pos.GetRepetitions() > 0) return true;
+    if (pos.GetRule50Ply() == 0) return false;
   }
   return false;
 }
 
 uint64_t PositionHistory::HashLast(int positions) const {
-  uint64_t hash = positions;
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
-       ++iter) {
-    if (!positions--) break;
-    hash = HashCat(hash, iter->Hash());
+  const int length = GetLength();
+  const int count = std::min(std::max(positions, 0), length);
+  // Sum of the hashes of the last @count positions, times powers of the base.
+  uint64_t hash = GetHashesAt(length - 1).prefix;
+  if (count < length) {
+    hash -= GetHashesAt(length - count - 1).prefix *
+            HistoryHashBasePower(count);
   }
-  return HashCat(hash, Last().GetRule50Ply());
+  return HashCat({hash, static_cast<uint64_t>(positions),
+                  static_cast<uint64_t>(Last().GetRule50Ply())});
 }
 
 std::string GetFen(const Position& pos) {
@@ -27,7 +27,9 @@
 
 #pragma once
 
+#include <cassert>
 #include <string>
+#include <vector>
 
 #include "chess/board.h"
 
@@ -106,34 +108,55 @@ class PositionHistory {
   PositionHistory& operator=(PositionHistory&& other) = default;  
 
   // Returns first position of the game (or fen from which it was initialized).
-  const Position& Starting() const { return positions_.front(); }
+  const Position& Starting() const { return GetPositionAt(0); }
 
   // Returns the latest position of the game.
-  const Position& Last() const { return positions_.back(); }
+  const Position& Last() const {
+    return positions_.empty() ? base_->Last() : positions_.back();
+  }
 
   // N-th position of the game, 0-based.
-  const Position& GetPositionAt(int idx) const { return positions_[idx]; }
+  const Position& GetPositionAt(int idx) const {
+    return idx < base_length_ ? base_->GetPositionAt(idx)
+                              : positions_[idx - base_length_];
+  }
 
-  // Trims position to a given size.
+  // Trims position to a given size, which can't be less than the length of
+  // the base history.
   void Trim(int size) {
-    positions_.erase(positions_.begin() + size, positions_.end());
+    assert(size >= base_length_);
+    positions_.erase(positions_.begin() + (size - base_length_),
+                     positions_.end());
+    hashes_.resize(size - base_length_);
   }
 
   // Can be used to reduce allocation cost while performing a sequence of moves
   // in succession.
-  void Reserve(int size) { positions_.reserve(size); }
+  void Reserve(int size) {
+    positions_.reserve(size);
+    hashes_.reserve(size);
+  }
 
   // Number of positions in history.
-  int GetLength() const { return positions_.size(); }
+  int GetLength() const { return base_length_ + positions_.size(); }
 
   // Resets the position to a given state.
   void Reset(const ChessBoard& board, int rule50_ply, int game_ply);
 
+  // Resets the history to the positions of @base, which are referenced rather
+  // than copied. Positions appended later are kept in this history only.
+  // @base must outlive this history and not change while it is referenced.
+  void ExtendFrom(const PositionHistory& base);
+
   // Appends a position to history.
   void Append(Move m);
 
   // Pops last move from history.
-  void Pop() { positions_.pop_back(); }
+  void Pop() {
+    assert(!positions_.empty());
+    positions_.pop_back();
+    hashes_.pop_back();
+  }
 
   // Finds the endgame state (win/lose/draw/nothing) for the last position.
   GameResult ComputeGameResult() const;
@@ -141,16 +164,33 @@ class PositionHistory {
   // Returns whether next move is history should be black's.
   bool IsBlackToMove() const { return Last().IsBlackToMove(); }
 
-  // Builds a hash from last X positions.
+  // Builds a hash from last X positions, in constant time.
   uint64_t HashLast(int positions) const;
 
   // Checks for any repetitions since the last time 50 move rule was reset.
   bool DidRepeatSinceLastZeroingMove() const;
 
  private:
+  struct Hashes {
+    // Hash of the board, to look for repetitions in a compact array.
+    uint64_t board;
+    // Rolling (polynomial) hash of the positions up to this one, from which
+    // the hash of the last positions is derived.
+    uint64_t prefix;
+  };
+
+  const Hashes& GetHashesAt(int idx) const {
+    return idx < base_length_ ? base_->GetHashesAt(idx)
+                              : hashes_[idx - base_length_];
+  }
   int ComputeLastMoveRepetitions(int* cycle_length) const;
 
+  // History the first positions belong to, if any.
+  const PositionHistory* base_ = nullptr;
+  int base_length_ = 0;
+  // Positions after those of the base history.
   std::vector<Position> positions_;
+  std::vector<Hashes> hashes_;
 };
 
 }  // namespace lczero
@@ -21,6 +21,7 @@
 #include <gtest/gtest.h>
 
 #include <iostream>
+#include <random>
 
 #include "utils/string.h"
 
@@ -161,10 +162,126 @@ TEST(PositionHistory, DidRepeatSinceLastZeroingMoveNeverRepeated) {
   EXPECT_FALSE(history.DidRepeatSinceLastZeroingMove());
 }
 
+TEST(Position, IncrementalHashMatchesFen) {
+  const std::vector<std::string> source_fens = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+      "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"};
+  std::mt19937 gen(42);
+  for (const auto& fen : source_fens) {
+    for (int game = 0; game < 20; game++) {
+      ChessBoard board(fen);
+      PositionHistory history;
+      history.Reset(board, 0, 0);
+      for (int ply = 0; ply < 60; ply++) {
+        const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+        if (moves.empty()) break;
+        history.Append(moves[gen() % moves.size()]);
+        const Position& pos = history.Last();
+        EXPECT_EQ(pos.GetBoard().Hash(), ChessBoard(GetFen(pos)).Hash())
+            << GetFen(pos);
+      }
+    }
+  }
+}
+
+TEST(PositionHistory, HashLastCoversLastPositions) {
+  ChessBoard board(ChessBoard::kStartposFen);
+  PositionHistory shuffled;
+  shuffled.Reset(board, 0, 0);
+  for (const char* move : {"g1f3", "g8f6", "f3g1", "f6g8", "e2e4", "e7e5"}) {
+    shuffled.Append(Move(move, shuffled.IsBlackToMove()));
+  }
+  PositionHistory direct;
+  direct.Reset(board, 0, 0);
+  for (const char* move : {"e2e4", "e7e5"}) {
+    direct.Append(Move(move, direct.IsBlackToMove()));
+  }
+  EXPECT_EQ(shuffled.HashLast(1), direct.HashLast(1));
+  EXPECT_EQ(shuffled.HashLast(2), direct.HashLast(2));
+  // The starting position was repeated in the shuffled history.
+  EXPECT_NE(shuffled.HashLast(3), direct.HashLast(3));
+  EXPECT_NE(shuffled.HashLast(8), direct.HashLast(8));
+
+  const uint64_t hash = shuffled.HashLast(4);
+  shuffled.Pop();
+  shuffled.Trim(shuffled.GetLength() - 1);
+  EXPECT_NE(shuffled.HashLast(4), hash);
+  shuffled.Append(Move("e2e4", false));
+  shuffled.Append(Move("e7e5", true));
+  EXPECT_EQ(shuffled.HashLast(4), hash);
+}
+
+TEST(PositionHistory, RepetitionsMatchBoardScan) {
+  std::mt19937 gen(7);
+  for (const char* fen : {"8/8/8/4k3/8/8/2K5/R7 w - - 0 1",
+                          "4k3/8/8/8/8/8/8/RN2K1NR b - - 10 40"}) {
+    ChessBoard board(fen);
+    PositionHistory history;
+    history.Reset(board, 0, 0);
+    for (int ply = 0; ply < 300; ply++) {
+      const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (moves.empty()) break;
+      history.Append(moves[gen() % moves.size()]);
+      // The latest earlier occurrence of the board, if any since the last
+      // zeroing move.
+      const Position& last = history.Last();
+      int repetitions = 0;
+      int cycle_length = 0;
+      for (int idx = history.GetLength() - 3;
+           idx >= 0 && history.GetLength() - 1 - idx <= last.GetRule50Ply();
+           idx -= 2) {
+        const Position& pos = history.GetPositionAt(idx);
+        if (pos.GetBoard() == last.GetBoard()) {
+          repetitions = pos.GetRepetitions() + 1;
+          cycle_length = history.GetLength() - 1 - idx;
+          break;
+        }
+      }
+      EXPECT_EQ(last.GetRepetitions(), repetitions);
+      EXPECT_EQ(last.GetPliesSincePrevRepetition(), cycle_length);
+    }
+  }
+}
+
+TEST(PositionHistory, ExtendFromMatchesCopy) {
+  ChessBoard board("3b4/rp1r1k2/8/1RP2p1p/p1KP4/P3P2P/5P2/1R2B3 b - - 2 30");
+  PositionHistory base;
+  base.Reset(board, 2, 30);
+  for (const char* move : {"f7f8", "f2f4", "d7h7", "c4d3"}) {
+    base.Append(Move(move, base.IsBlackToMove()));
+  }
+  PositionHistory copy(base);
+  PositionHistory extended;
+  extended.ExtendFrom(base);
+  EXPECT_EQ(extended.GetLength(), base.GetLength());
+  EXPECT_EQ(extended.HashLast(3), base.HashLast(3));
+  for (int round = 0; round < 2; round++) {
+    for (const char* move : {"h7d7", "d3c4", "d7e7", "c4b4"}) {
+      copy.Append(Move(move, copy.IsBlackToMove()));
+      extended.Append(Move(move, extended.IsBlackToMove()));
+      ASSERT_EQ(extended.GetLength(), copy.GetLength());
+      EXPECT_EQ(extended.Last().GetBoard(), copy.Last().GetBoard());
+      EXPECT_EQ(extended.Last().GetRepetitions(),
+                copy.Last().GetRepetitions());
+      EXPECT_EQ(extended.HashLast(8), copy.HashLast(8));
+      EXPECT_EQ(extended.DidRepeatSinceLastZeroingMove(),
+                copy.DidRepeatSinceLastZeroingMove());
+    }
+    EXPECT_TRUE(extended.DidRepeatSinceLastZeroingMove());
+    copy.Trim(base.GetLength());
+    extended.Pop();
+    extended.Trim(base.GetLength());
+    EXPECT_EQ(extended.Last().GetBoard(), base.Last().GetBoard());
+    EXPECT_EQ(extended.HashLast(3), base.HashLast(3));
+  }
+  EXPECT_EQ(base.GetLength(), 5);
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
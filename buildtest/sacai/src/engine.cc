@@ -31,6 +31,7 @@
 #include <cmath>
 #include <functional>
 
+#include "benchmark/autotune.h"
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
 #include "utils/configfile.h"
@@ -51,6 +52,16 @@ const OptionId kSyzygyTablebaseId{
     "List of Syzygy tablebase directories, list entries separated by system "
     "separator (\";\" for Windows, \":\" for Linux).",
     's'};
+const OptionId kSyzygyCacheSizeId{
+    "syzygy-cache-size", "SyzygyCacheSize",
+    "Memory in MiB for caching Syzygy probe results, 0 disables the cache."};
+const OptionId kBookFileId{
+    "book", "BookFile",
+    "Opening book built with the makebook mode. Positions found in it are "
+    "played from the book without search."};
+const OptionId kBookMinWeightId{
+    "book-min-weight", "BookMinWeight",
+    "Book moves played in fewer games than this are ignored."};
 const OptionId kPonderId{"ponder", "Ponder",
                          "This option is ignored. Here to please chess GUIs."};
 const OptionId kUciChess960{
@@ -66,17 +77,24 @@ const OptionId kStrictUciTiming{"strict-uci-timing", "StrictTiming",
                                 "only then starts timing."};
 const OptionId kPreload{"preload", "",
                         "Initialize backend and load net on engine startup."};
+const OptionId kAutotuneId{
+    "autotune", "",
+    "Use the backend configuration stored by the autotune mode for this "
+    "network and CPU, unless a backend is given explicitly."};
 
 MoveList StringsToMovelist(const std::vector<std::string>& moves,
                            const ChessBoard& board) {
   MoveList result;
   if (moves.size()) {
-    result.reserve(moves.size());
     const auto legal_moves = board.GenerateLegalMoves();
     const auto end = legal_moves.end();
     for (const auto& move : moves) {
       const auto m = board.GetModernMove({move, board.flipped()});
-      if (std::find(legal_moves.begin(), end, m) != end) result.emplace_back(m);
+      // Repeated moves are skipped, so that the list has room for all.
+      if (std::find(legal_moves.begin(), end, m) != end &&
+          std::find(result.begin(), result.end(), m) == result.end()) {
+        result.emplace_back(m);
+      }
     }
     if (result.empty()) throw Exception("No legal searchmoves.");
   }
@@ -100,6 +118,10 @@ void EngineController::PopulateOptions(OptionsParser* options) {
   SearchParams::Populate(options);
 
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<IntOption>(kSyzygyCacheSizeId, 0, 65536) =
+      SyzygyTablebase::kDefaultCacheSize;
+  options->Add<StringOption>(kBookFileId);
+  options->Add<IntOption>(kBookMinWeightId, 1, 999999999) = 1;
   // Add "Ponder" option to signal to GUIs that we support pondering.
   // This option is currently not used by lc0 in any way.
   options->Add<BoolOption>(kPonderId) = true;
@@ -136,6 +158,24 @@ void EngineController::UpdateFromUciOptions() {
       tb_paths_ = tb_paths;
     }
   }
+  if (syzygy_tb_) {
+    syzygy_tb_->set_cache_size(options_.Get<int>(kSyzygyCacheSizeId));
+  }
+
+  // Opening book.
+  std::string book_path = options_.Get<std::string>(kBookFileId);
+  if (book_path != book_path_) {
+    book_.reset();
+    book_path_ = book_path;
+    if (!book_path.empty()) {
+      CERR << "Loading opening book from " << book_path;
+      try {
+        book_ = std::make_unique<BookReader>(book_path);
+      } catch (const Exception& e) {
+        CERR << "Failed to load opening book: " << e.what();
+      }
+    }
+  }
 
   // Network.
   const auto network_configuration =
@@ -292,6 +332,24 @@ void EngineController::Go(const GoParams& params) {
     responder = std::make_unique<MovesLeftResponseFilter>(std::move(responder));
   }
 
+  // Book moves are played right away, unless the search is open ended or
+  // restricted to some moves.
+  if (book_ && !params.infinite && !params.ponder &&
+      params.searchmoves.empty()) {
+    Move move = book_->PickMove(tree_->HeadPosition().GetBoard(),
+                                options_.Get<int>(kBookMinWeightId));
+    if (move) {
+      if (tree_->IsBlackToMove()) move.Mirror();
+      std::vector<ThinkingInfo> infos(1);
+      infos[0].pv.push_back(move);
+      infos[0].comment = "book move";
+      responder->OutputThinkingInfo(&infos);
+      BestMoveInfo info(move);
+      responder->OutputBestMove(&info);
+      return;
+    }
+  }
+
   auto stopper = time_manager_->GetStopper(params, *tree_.get());
   search_ = std::make_unique<Search>(
       *tree_, network_.get(), std::move(responder),
@@ -322,12 +380,14 @@ EngineLoop::EngineLoop()
           options_.GetOptionsDict()) {
   engine_.PopulateOptions(&options_);
   options_.Add<StringOption>(kLogFileId);
+  options_.Add<BoolOption>(kAutotuneId) = true;
 }
 
 void EngineLoop::RunLoop() {
   if (!ConfigFile::Init() || !options_.ProcessAllFlags()) return;
   const auto options = options_.GetOptionsDict();
   Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+  if (options.Get<bool>(kAutotuneId)) ApplyAutotuneResult(&options_);
   if (options.Get<bool>(kPreload)) engine_.NewGame();
   UciLoop::RunLoop();
 }
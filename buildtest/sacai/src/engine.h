@@ -29,6 +29,7 @@
 
 #include <optional>
 
+#include "chess/book.h"
 #include "chess/uciloop.h"
 #include "mcts/search.h"
 #include "neural/cache.h"
@@ -96,12 +97,14 @@ class EngineController {
   std::unique_ptr<Search> search_;
   std::unique_ptr<NodeTree> tree_;
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;
+  std::unique_ptr<BookReader> book_;
   std::unique_ptr<Network> network_;
   NNCache cache_;
 
-  // Store current TB and network settings to track when they change so that
-  // they are reloaded.
+  // Store current TB, book and network settings to track when they change so
+  // that they are reloaded.
   std::string tb_paths_;
+  std::string book_path_;
   NetworkFactory::BackendConfiguration network_configuration_;
 
   // The current position as given with SetPosition. For normal (ie. non-ponder)
@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "lc0ctl/makebook.h"
+
+#include "chess/book.h"
+#include "chess/pgn.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kPgnFileId{
+    "pgn", "PgnFile",
+    "PGN file with the games to build the book from, optionally gzipped."};
+const OptionId kOutputFileId{"output", "OutputFile",
+                             "Path of the book to write."};
+const OptionId kBookPliesId{"book-plies", "BookPlies",
+                            "Number of plies of each game added to the book."};
+const OptionId kMinWeightId{
+    "min-weight", "MinWeight",
+    "Moves played in fewer games than this are left out of the book."};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kPgnFileId);
+  options->Add<StringOption>(kOutputFileId);
+  options->Add<IntOption>(kBookPliesId, 1, 1000) = 20;
+  options->Add<IntOption>(kMinWeightId, 1, 999999999) = 1;
+  if (!options->ProcessAllFlags()) return false;
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kPgnFileId);
+  dict.EnsureExists<std::string>(kOutputFileId);
+  return true;
+}
+
+}  // namespace
+
+void MakeBookCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+
+  PgnReader reader;
+  reader.AddPgnFile(dict.Get<std::string>(kPgnFileId));
+  const OpeningBook games = reader.ReleaseOpenings();
+  COUT << "Read " << games.size() << " games.";
+
+  BookWriter writer;
+  const int plies = dict.Get<int>(kBookPliesId);
+  for (size_t i = 0; i < games.size(); i++) {
+    writer.AddOpening(games[i], plies);
+  }
+  const auto entries = writer.Write(dict.Get<std::string>(kOutputFileId),
+                                    dict.Get<int>(kMinWeightId));
+  COUT << "Wrote " << entries << " book moves to "
+       << dict.Get<std::string>(kOutputFileId) << ".";
+}
+
+}  // namespace lczero
@@ -0,0 +1,128 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "lc0ctl/tracesummary.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "neural/trace.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kTraceFilenameId{"trace", "TraceFile",
+                                "Path of the trace to summarize."};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kTraceFilenameId);
+  if (!options->ProcessAllFlags()) return false;
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kTraceFilenameId);
+  return true;
+}
+
+std::string Justify(std::string str, size_t length = 30) {
+  if (str.size() + 2 < length) {
+    str = std::string(length - 2 - str.size(), ' ') + str;
+  }
+  str += ": ";
+  return str;
+}
+
+std::string Percent(uint64_t count, uint64_t total) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1)
+      << (total == 0 ? 0.0 : 100.0 * count / total) << "%";
+  return oss.str();
+}
+
+}  // namespace
+
+void SummarizeTraceCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const TraceReader reader(dict.Get<std::string>(kTraceFilenameId));
+
+  // Batch sizes by power of two buckets: 1, 2-3, 4-7, ...
+  std::vector<uint64_t> buckets;
+  uint64_t batches = 0;
+  uint64_t samples = 0;
+  uint64_t values = 0;
+  size_t min_batch = 0;
+  size_t max_batch = 0;
+  reader.ForEachBatch([&](const TraceBatch& batch) {
+    size_t bucket = 0;
+    while ((size_t{2} << bucket) <= batch.size()) ++bucket;
+    if (buckets.size() <= bucket) buckets.resize(bucket + 1);
+    ++buckets[bucket];
+    min_batch = batches == 0 ? batch.size() : std::min(min_batch, batch.size());
+    max_batch = std::max(max_batch, batch.size());
+    ++batches;
+    samples += batch.size();
+    for (const auto& sample : batch) values += sample.values.size();
+  });
+  const uint64_t unique = reader.CountUniqueHashes();
+
+  COUT << "\nTrace";
+  COUT << "~~~~~";
+  COUT << Justify("File size") << reader.file_size() << " bytes";
+  COUT << Justify("Chunks") << reader.chunks();
+  COUT << Justify("Index")
+       << (reader.has_index() ? "present" : "missing, rebuilt by scanning");
+  COUT << Justify("Batches") << batches;
+  COUT << Justify("Samples") << samples;
+  COUT << Justify("Unique positions") << unique << " ("
+       << Percent(unique, samples) << ")";
+  if (samples > 0) {
+    COUT << Justify("Bytes per sample") << reader.file_size() / samples;
+    COUT << Justify("Values per sample")
+         << static_cast<double>(values) / samples;
+  }
+  if (batches == 0) return;
+
+  COUT << "\nBatch sizes";
+  COUT << "~~~~~~~~~~~";
+  COUT << Justify("Minimum") << min_batch;
+  COUT << Justify("Average") << static_cast<double>(samples) / batches;
+  COUT << Justify("Maximum") << max_batch;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    const size_t low = size_t{1} << i;
+    const size_t high = (size_t{2} << i) - 1;
+    COUT << Justify(low == high ? std::to_string(low)
+                                : std::to_string(low) + "-" +
+                                      std::to_string(high))
+         << buckets[i] << " (" << Percent(buckets[i], batches) << ")";
+  }
+}
+
+}  // namespace lczero
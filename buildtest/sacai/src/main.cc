@@ -25,13 +25,17 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "benchmark/autotune.h"
 #include "benchmark/backendbench.h"
+#include "benchmark/perft.h"
 #include "benchmark/benchmark.h"
 #include "chess/board.h"
 #include "engine.h"
 #include "lc0ctl/describenet.h"
 #include "lc0ctl/leela2onnx.h"
+#include "lc0ctl/makebook.h"
 #include "lc0ctl/onnx2leela.h"
+#include "lc0ctl/tracesummary.h"
 #include "selfplay/loop.h"
 #include "utils/commandline.h"
 #include "utils/esc_codes.h"
@@ -55,7 +59,6 @@ int main(int argc, const char** argv) {
   try {
     Numa::Init();
     Numa::BindThread(0);
-    InitializeMagicBitboards();
 
     CommandLine::Init(argc, argv);
     CommandLine::RegisterMode("uci", "(default) Act as UCI engine");
@@ -63,11 +66,20 @@ int main(int argc, const char** argv) {
     CommandLine::RegisterMode("benchmark", "Quick benchmark");
     CommandLine::RegisterMode("backendbench",
                               "Quick benchmark of backend only");
+    CommandLine::RegisterMode("autotune",
+                              "Find and store the fastest CPU backend setup.");
+    CommandLine::RegisterMode("perft",
+                              "Count the move tree of a position, to "
+                              "benchmark move generation.");
     CommandLine::RegisterMode("leela2onnx", "Convert Leela network to ONNX.");
     CommandLine::RegisterMode("onnx2leela",
                               "Convert ONNX network to Leela net.");
     CommandLine::RegisterMode("describenet",
                               "Shows details about the Leela network.");
+    CommandLine::RegisterMode("tracesummary",
+                              "Shows statistics of a recorded backend trace.");
+    CommandLine::RegisterMode("makebook",
+                              "Build an opening book from PGN games.");
 
     if (CommandLine::ConsumeCommand("selfplay")) {
       // Selfplay mode.
@@ -81,12 +93,24 @@ int main(int argc, const char** argv) {
       // Backend Benchmark mode.
       BackendBenchmark benchmark;
       benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("autotune")) {
+      // Backend autotune mode.
+      Autotune autotune;
+      autotune.Run();
+    } else if (CommandLine::ConsumeCommand("perft")) {
+      // Move generation benchmark mode.
+      PerftBenchmark perft;
+      perft.Run();
     } else if (CommandLine::ConsumeCommand("leela2onnx")) {
       lczero::ConvertLeelaToOnnx();
     } else if (CommandLine::ConsumeCommand("onnx2leela")) {
       lczero::ConvertOnnxToLeela();
     } else if (CommandLine::ConsumeCommand("describenet")) {
       lczero::DescribeNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("tracesummary")) {
+      lczero::SummarizeTraceCmd();
+    } else if (CommandLine::ConsumeCommand("makebook")) {
+      lczero::MakeBookCmd();
     } else {
       // Consuming optional "uci" mode.
       CommandLine::ConsumeCommand("uci");
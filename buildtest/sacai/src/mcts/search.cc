@@ -42,6 +42,7 @@
 #include "neural/encoder.h"
 #include "utils/fastmath.h"
 #include "utils/random.h"
+#include "utils/softmax.h"
 
 namespace lczero {
 
@@ -163,6 +164,8 @@ Search::Search(const NodeTree& tree, Network* network,
       searchmoves_(searchmoves),
       start_time_(start_time),
       initial_visits_(root_node_->GetN()),
+      tb_cache_start_(syzygy_tb ? syzygy_tb->cache_stats()
+                                : SyzygyProbeCache::Stats{}),
       root_move_filter_(MakeRootMoveFilter(
           searchmoves_, syzygy_tb_, played_history_,
           params_.GetSyzygyFastPlay(), &tb_hits_, &root_is_in_dtz_)),
@@ -509,7 +512,8 @@ NNCacheLock Search::GetCachedNNEval(const Node* node) const {
   for (; node != root_node_; node = node->GetParent()) {
     moves.push_back(node->GetOwnEdge()->GetMove());
   }
-  PositionHistory history(played_history_);
+  PositionHistory history;
+  history.ExtendFrom(played_history_);
   for (auto iter = moves.rbegin(), end = moves.rend(); iter != end; ++iter) {
     history.Append(*iter);
   }
@@ -541,6 +545,13 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
     BestMoveInfo info(final_bestmove_, final_pondermove_);
     uci_responder_->OutputBestMove(&info);
     stopper_->OnSearchDone(stats);
+    if (syzygy_tb_) {
+      const auto tb_cache = syzygy_tb_->cache_stats();
+      LOGFILE << "Tablebase hits: " << tb_hits_.load(std::memory_order_acquire)
+              << ", probe cache hits: " << tb_cache.hits - tb_cache_start_.hits
+              << " of " << tb_cache.probes - tb_cache_start_.probes
+              << " probes.";
+    }
     bestmove_is_sent_ = true;
     current_best_edge_ = EdgeAndNode();
   }
@@ -1138,6 +1149,7 @@ void SearchWorker::InitializeIteration(
   computation_->Reserve(params_.GetMiniBatchSize());
   minibatch_.clear();
   minibatch_.reserve(2 * params_.GetMiniBatchSize());
+  input_batch_.Clear();
 }
 
 // 2. Gather minibatch.
@@ -1295,6 +1307,8 @@ void SearchWorker::GatherMinibatch2() {
       ++non_collisions;
       ++minibatch_size;
     }
+    // Room for the planes of every new entry, filled in place by the tasks.
+    input_batch_.Resize(static_cast<int>(minibatch_.size()));
 
     bool needs_wait = false;
     int ppt_start = new_start;
@@ -1372,7 +1386,7 @@ void SearchWorker::GatherMinibatch2() {
                                      std::move(minibatch_[i].lock));
       } else {
         computation_->AddInput(minibatch_[i].hash,
-                               std::move(minibatch_[i].input_planes),
+                               input_batch_[minibatch_[i].input_idx],
                                std::move(minibatch_[i].probabilities_to_cache));
       }
     }
@@ -1405,8 +1419,8 @@ void SearchWorker::GatherMinibatch2() {
 
 void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
                                      TaskWorkspace* workspace) {
-  auto& history = workspace->history;
-  history = search_->played_history_;
+  auto& path = workspace->path;
+  const auto& history = path.history;
 
   for (int i = start_idx; i < end_idx; i++) {
     auto& picked_node = minibatch_[i];
@@ -1417,7 +1431,7 @@ void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
     // of the game), it means that we already visited this node before.
     if (picked_node.IsExtendable()) {
       // Node was never visited, extend it.
-      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &history);
+      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &path);
       if (!node->IsTerminal()) {
         picked_node.nn_queried = true;
         const auto hash = history.HashLast(params_.GetCacheHistoryLength() + 1);
@@ -1426,9 +1440,10 @@ void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
         picked_node.is_cache_hit = picked_node.lock;
         if (!picked_node.is_cache_hit) {
           int transform;
-          picked_node.input_planes = EncodePositionForNN(
-              search_->network_->GetCapabilities().input_format, history, 8,
-              params_.GetHistoryFill(), &transform);
+          picked_node.input_idx = i;
+          path.encoder.Encode(search_->network_->GetCapabilities().input_format,
+                              history, 8, params_.GetHistoryFill(), &transform,
+                              input_batch_[i]);
           picked_node.probability_transform = transform;
 
           std::vector<uint16_t>& moves = picked_node.probabilities_to_cache;
@@ -1885,18 +1900,49 @@ void SearchWorker::PickNodesToExtendTask(Node* node, int base_depth,
   }
 }
 
+void SearchWorker::SearchPath::Follow(const PositionHistory& played,
+                                      const std::vector<Move>& moves_to_node) {
+  if (history.GetLength() < played.GetLength()) {
+    // The positions of the played history are shared, not copied.
+    history.ExtendFrom(played);
+    moves.clear();
+    encoder.Reset(played.GetLength());
+  }
+  // Keep the positions of the common prefix.
+  size_t common = 0;
+  while (common < moves.size() && common < moves_to_node.size() &&
+         moves[common] == moves_to_node[common]) {
+    common++;
+  }
+  history.Trim(played.GetLength() + common);
+  moves.resize(common);
+  encoder.Trim(history.GetLength());
+  for (size_t i = common; i < moves_to_node.size(); i++) {
+    Append(moves_to_node[i]);
+  }
+}
+
+void SearchWorker::SearchPath::Append(Move move) {
+  history.Append(move);
+  moves.push_back(move);
+}
+
+void SearchWorker::SearchPath::Pop() {
+  history.Pop();
+  moves.pop_back();
+  encoder.Trim(history.GetLength());
+}
+
 void SearchWorker::ExtendNode(Node* node, int depth,
                               const std::vector<Move>& moves_to_node,
-                              PositionHistory* history) {
-  // Initialize position sequence with pre-move position.
-  history->Trim(search_->played_history_.GetLength());
-  for (size_t i = 0; i < moves_to_node.size(); i++) {
-    history->Append(moves_to_node[i]);
-  }
+                              SearchPath* path) {
+  // Positions shared with the previously extended node are kept.
+  path->Follow(search_->played_history_, moves_to_node);
+  const auto& history = path->history;
 
   // We don't need the mutex because other threads will see that N=0 and
   // N-in-flight=1 and will not touch this node.
-  const auto& board = history->Last().GetBoard();
+  const auto& board = history.Last().GetBoard();
   auto legal_moves = board.GenerateLegalMoves();
 
   // Check whether it's a draw/lose by position. Importantly, we must check
@@ -1919,12 +1965,12 @@ void SearchWorker::ExtendNode(Node* node, int depth,
       return;
     }
 
-    if (history->Last().GetRule50Ply() >= 100) {
+    if (history.Last().GetRule50Ply() >= 100) {
       node->MakeTerminal(GameResult::DRAW);
       return;
     }
 
-    const auto repetitions = history->Last().GetRepetitions();
+    const auto repetitions = history.Last().GetRepetitions();
     // Mark two-fold repetitions as draws according to settings.
     // Depth starts with 1 at root, so number of plies in PV is depth - 1.
     if (repetitions >= 2) {
@@ -1932,8 +1978,8 @@ void SearchWorker::ExtendNode(Node* node, int depth,
       return;
     } else if (repetitions == 1 && depth - 1 >= 4 &&
                params_.GetTwoFoldDraws() &&
-               depth - 1 >= history->Last().GetPliesSincePrevRepetition()) {
-      const auto cycle_length = history->Last().GetPliesSincePrevRepetition();
+               depth - 1 >= history.Last().GetPliesSincePrevRepetition()) {
+      const auto cycle_length = history.Last().GetPliesSincePrevRepetition();
       // use plies since first repetition as moves left; exact if forced draw.
       node->MakeTerminal(GameResult::DRAW, (float)cycle_length,
                          Node::Terminal::TwoFold);
@@ -1943,12 +1989,12 @@ void SearchWorker::ExtendNode(Node* node, int depth,
     // Neither by-position or by-rule termination, but maybe it's a TB position.
     if (search_->syzygy_tb_ && !search_->root_is_in_dtz_ &&
         board.castlings().no_legal_castle() &&
-        history->Last().GetRule50Ply() == 0 &&
+        history.Last().GetRule50Ply() == 0 &&
         (board.ours() | board.theirs()).count() <=
             search_->syzygy_tb_->max_cardinality()) {
       ProbeState state;
       const WDLScore wdl =
-          search_->syzygy_tb_->probe_wdl(history->Last(), &state);
+          search_->syzygy_tb_->probe_wdl(history.Last(), &state);
       // Only fail state means the WDL is wrong, probe_wdl may produce correct
       // result with a stat other than OK.
       if (state != FAIL) {
@@ -2152,8 +2198,8 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
 
 void SearchWorker::ExtendNode(Node* node, int depth) {
   std::vector<Move> to_add;
-  // Could instead reserve one more than the difference between history_.size()
-  // and history_.capacity().
+  // Could instead reserve one more than the difference between
+  // path_.history.size() and path_.history.capacity().
   to_add.reserve(60);
   // Need a lock to walk parents of leaf in case MakeSolid is concurrently
   // adjusting parent chain.
@@ -2168,19 +2214,20 @@ void SearchWorker::ExtendNode(Node* node, int depth) {
   }
   std::reverse(to_add.begin(), to_add.end());
 
-  ExtendNode(node, depth, to_add, &history_);
+  ExtendNode(node, depth, to_add, &path_);
 }
 
 // Returns whether node was already in cache.
 bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
                                         int* transform_out) {
-  const auto hash = history_.HashLast(params_.GetCacheHistoryLength() + 1);
+  const auto& history = path_.history;
+  const auto hash = history.HashLast(params_.GetCacheHistoryLength() + 1);
   // If already in cache, no need to do anything.
   if (add_if_cached) {
     if (computation_->AddInputByHash(hash)) {
       if (transform_out) {
         *transform_out = TransformForPosition(
-            search_->network_->GetCapabilities().input_format, history_);
+            search_->network_->GetCapabilities().input_format, history);
       }
       return true;
     }
@@ -2188,15 +2235,16 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
     if (search_->cache_->ContainsKey(hash)) {
       if (transform_out) {
         *transform_out = TransformForPosition(
-            search_->network_->GetCapabilities().input_format, history_);
+            search_->network_->GetCapabilities().input_format, history);
       }
       return true;
     }
   }
   int transform;
-  auto planes =
-      EncodePositionForNN(search_->network_->GetCapabilities().input_format,
-                          history_, 8, params_.GetHistoryFill(), &transform);
+  std::array<InputPlane, kInputPlanes> planes;
+  path_.encoder.Encode(search_->network_->GetCapabilities().input_format,
+                       history, 8, params_.GetHistoryFill(), &transform,
+                       planes.data());
 
   std::vector<uint16_t> moves;
 
@@ -2209,7 +2257,7 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
   } else {
     // Cache pseudolegal moves. A bit of a waste, but faster.
     const auto& pseudolegal_moves =
-        history_.Last().GetBoard().GeneratePseudolegalMoves();
+        history.Last().GetBoard().GeneratePseudolegalMoves();
     moves.reserve(pseudolegal_moves.size());
     for (auto iter = pseudolegal_moves.begin(), end = pseudolegal_moves.end();
          iter != end; ++iter) {
@@ -2217,7 +2265,7 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
     }
   }
 
-  computation_->AddInput(hash, std::move(planes), std::move(moves));
+  computation_->AddInput(hash, planes.data(), std::move(moves));
   if (transform_out) *transform_out = transform;
   return false;
 }
@@ -2243,7 +2291,7 @@ void SearchWorker::MaybePrefetchIntoCache() {
   if (search_->stop_.load(std::memory_order_acquire)) return;
   if (computation_->GetCacheMisses() > 0 &&
       computation_->GetCacheMisses() < params_.GetMaxPrefetchBatch()) {
-    history_.Trim(search_->played_history_.GetLength());
+    path_.Follow(search_->played_history_, {});
     SharedMutex::SharedLock lock(search_->nodes_mutex_);
     PrefetchIntoCache(
         search_->root_node_,
@@ -2330,10 +2378,10 @@ int SearchWorker::PrefetchIntoCache(Node* node, int budget, bool is_odd_depth) {
         budget_to_spend = budget;
       }
     }
-    history_.Append(edge.GetMove());
+    path_.Append(edge.GetMove());
     const int budget_spent =
         PrefetchIntoCache(edge.node(), budget_to_spend, !is_odd_depth);
-    history_.Pop();
+    path_.Pop();
     budget -= budget_spent;
     total_budget_spent += budget_spent;
   }
@@ -2375,33 +2423,24 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process,
   node_to_process->d = computation.GetDVal(idx_in_computation);
   node_to_process->m = computation.GetMVal(idx_in_computation);
   // ...and secondly, the policy data.
-  // Calculate maximum first.
-  float max_p = -std::numeric_limits<float>::infinity();
-  // Intermediate array to store values when processing policy.
+  // Intermediate arrays to store values when processing policy.
   // There are never more than 256 valid legal moves in any legal position.
+  std::array<uint16_t, 256> move_ids;
   std::array<float, 256> intermediate;
   int counter = 0;
   for (auto& edge : node->Edges()) {
-    float p = computation.GetPVal(
-        idx_in_computation,
-        edge.GetMove().as_nn_index(node_to_process->probability_transform));
-    intermediate[counter++] = p;
-    max_p = std::max(max_p, p);
-  }
-  float total = 0.0;
-  for (int i = 0; i < counter; i++) {
-    // Perform softmax and take into account policy softmax temperature T.
-    // Note that we want to calculate (exp(p-max_p))^(1/T) = exp((p-max_p)/T).
-    float p =
-        FastExp((intermediate[i] - max_p) / params_.GetPolicySoftmaxTemp());
-    intermediate[i] = p;
-    total += p;
-  }
+    move_ids[counter++] =
+        edge.GetMove().as_nn_index(node_to_process->probability_transform);
+  }
+  computation.GetPVals(idx_in_computation, move_ids.data(), counter,
+                       intermediate.data());
+  // Perform softmax and take into account policy softmax temperature T.
+  // Note that we want to calculate (exp(p-max_p))^(1/T) = exp((p-max_p)/T).
+  SoftmaxWithTemperature(intermediate.data(), counter,
+                         params_.GetPolicySoftmaxTemp());
   counter = 0;
-  // Normalize P values to add up to 1.0.
-  const float scale = total > 0.0f ? 1.0f / total : 1.0f;
   for (auto& edge : node->Edges()) {
-    edge.edge()->SetP(intermediate[counter++] * scale);
+    edge.edge()->SetP(intermediate[counter++]);
   }
   // Add Dirichlet noise if enabled and at root.
   if (params_.GetNoiseEpsilon() && node == search_->root_node_) {
@@ -40,6 +40,7 @@
 #include "mcts/params.h"
 #include "mcts/stoppers/timemgr.h"
 #include "neural/cache.h"
+#include "neural/encoder.h"
 #include "neural/network.h"
 #include "syzygy/syzygy.h"
 #include "utils/logging.h"
@@ -177,6 +178,9 @@ class Search {
   bool root_is_in_dtz_ = false;
   // tb_hits_ must be initialized before root_move_filter_.
   std::atomic<int> tb_hits_{0};
+  // Probe cache statistics before the search, so that those of the root
+  // probes are counted too.
+  const SyzygyProbeCache::Stats tb_cache_start_;
   const MoveList root_move_filter_;
 
   mutable SharedMutex nodes_mutex_;
@@ -212,7 +216,6 @@ class SearchWorker {
  public:
   SearchWorker(Search* search, const SearchParams& params, int id)
       : search_(search),
-        history_(search_->played_history_),
         params_(params),
         moves_left_support_(search_->network_->GetCapabilities().moves_left !=
                             pblczero::NetworkFormat::MOVES_LEFT_NONE) {
@@ -328,7 +331,8 @@ class SearchWorker {
     uint64_t hash;
     NNCacheLock lock;
     std::vector<uint16_t> probabilities_to_cache;
-    InputPlanes input_planes;
+    // Sample of SearchWorker::input_batch_ holding the encoded position.
+    int input_idx = -1;
     mutable int last_idx = 0;
     bool ooo_completed = false;
 
@@ -368,6 +372,11 @@ class SearchWorker {
       return 0;
     }
 
+    void GetPVals(int, const uint16_t* move_ids, int count,
+                  float* output) const {
+      for (int i = 0; i < count; i++) output[i] = GetPVal(0, move_ids[i]);
+    }
+
    private:
     NodeToProcess(Node* node, uint16_t depth, bool is_collision, int multivisit,
                   int max_count)
@@ -378,6 +387,26 @@ class SearchWorker {
           is_collision(is_collision) {}
   };
 
+  // Positions along the path to a node, extending the played history by
+  // reference. Positions shared with the previous path, and their encodings,
+  // are kept.
+  struct SearchPath {
+    PositionHistory history;
+    // Moves played from the end of the played history.
+    std::vector<Move> moves;
+    IncrementalEncoder encoder;
+
+    SearchPath() {
+      history.Reserve(30);
+      moves.reserve(30);
+    }
+    // Makes the path follow @moves_to_node from the end of @played.
+    void Follow(const PositionHistory& played,
+                const std::vector<Move>& moves_to_node);
+    void Append(Move move);
+    void Pop();
+  };
+
   // Holds per task worker scratch data
   struct TaskWorkspace {
     std::array<Node::Iterator, 256> cur_iters;
@@ -386,14 +415,13 @@ class SearchWorker {
     std::vector<int> vtp_last_filled;
     std::vector<int> current_path;
     std::vector<Move> moves_to_path;
-    PositionHistory history;
+    SearchPath path;
     TaskWorkspace() {
       vtp_buffer.reserve(30);
       visits_to_perform.reserve(30);
       vtp_last_filled.reserve(30);
       current_path.reserve(30);
       moves_to_path.reserve(30);
-      history.Reserve(30);
     }
   };
 
@@ -443,7 +471,7 @@ class SearchWorker {
   void ProcessPickedTask(int batch_start, int batch_end,
                          TaskWorkspace* workspace);
   void ExtendNode(Node* node, int depth, const std::vector<Move>& moves_to_add,
-                  PositionHistory* history);
+                  SearchPath* path);
   template <typename Computation>
   void FetchSingleNodeResult(NodeToProcess* node_to_process,
                              const Computation& computation,
@@ -456,9 +484,12 @@ class SearchWorker {
   Search* const search_;
   // List of nodes to process.
   std::vector<NodeToProcess> minibatch_;
+  // Encoded positions of the minibatch_ entries being gathered, which are
+  // copied to the computation at the end of each gathering round.
+  InputBatch input_batch_;
   std::unique_ptr<CachingComputation> computation_;
-  // History is reset and extended by PickNodeToExtend().
-  PositionHistory history_;
+  // Path is reset and extended by PickNodeToExtend().
+  SearchPath path_;
   int number_out_of_order_ = 0;
   const SearchParams& params_;
   std::unique_ptr<Node> precached_node_;
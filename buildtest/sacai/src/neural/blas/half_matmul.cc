@@ -0,0 +1,563 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "neural/blas/half_matmul.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "utils/fp16_utils.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_HALF_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace lczero {
+namespace {
+
+constexpr size_t kRowBlock = HalfMatrix::kRowBlock;
+constexpr size_t kColumnGroup = HalfMatrix::kColumnGroup;
+// Elements of one column group of a row block, 64 bytes.
+constexpr size_t kGroupSize = kRowBlock * kColumnGroup;
+
+// Position of element (@row, @col) in a matrix packed with @groups column
+// groups.
+template <HalfFormat format>
+size_t PackedIndex(size_t row, size_t col, size_t groups) {
+  const auto group =
+      (row / kRowBlock * groups + col / kColumnGroup) * kGroupSize;
+  if (format == HalfFormat::kBf16) {
+    return group + row % kRowBlock * kColumnGroup + col % kColumnGroup;
+  }
+  return group + col % kColumnGroup * kRowBlock + row % kRowBlock;
+}
+
+// Computes output[n * output_stride + r] for all rows r and vectors n. The
+// weights are packed as described in HalfMatrix, with @groups column groups.
+using HalfKernel = void (*)(const uint16_t* weights, size_t rows,
+                            size_t groups, const uint16_t* input, size_t count,
+                            float* output, size_t output_stride);
+
+// Converts @size floats.
+using ConvertKernel = void (*)(const float* input, size_t size,
+                               uint16_t* output);
+
+template <HalfFormat format, float (*ToFloat)(uint16_t)>
+void MultiplyScalar(const uint16_t* weights, size_t rows, size_t groups,
+                    const uint16_t* input, size_t count, float* output,
+                    size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  for (size_t n = 0; n < count; n++) {
+    const uint16_t* x = input + n * stride;
+    for (size_t r = 0; r < rows; r++) {
+      float acc = 0.0f;
+      for (size_t c = 0; c < stride; c++) {
+        acc += ToFloat(weights[PackedIndex<format>(r, c, groups)]) *
+               ToFloat(x[c]);
+      }
+      output[n * output_stride + r] = acc;
+    }
+  }
+}
+
+template <uint16_t (*FromFloat)(float)>
+void ConvertScalar(const float* input, size_t size, uint16_t* output) {
+  for (size_t k = 0; k < size; k++) output[k] = FromFloat(input[k]);
+}
+
+#ifdef USE_HALF_X86_KERNELS
+
+// The two elements of a column group, as one 32-bit lane.
+inline int32_t LoadGroup(const uint16_t* x) {
+  int32_t group;
+  std::memcpy(&group, x, sizeof(group));
+  return group;
+}
+
+// Kernels compute all the rows for a chunk of kVectors vectors, so that each
+// weight loaded is used kVectors times. Winograd tiles always come by 16
+// vectors, any remainder is computed one vector at a time.
+template <typename T>
+using RowsKernel = void (*)(const uint16_t* weights, size_t rows,
+                            size_t groups, const T* const* x,
+                            float* const* out);
+
+template <int kVectors, typename T>
+void MultiplyChunks(RowsKernel<T> rows_kernel, RowsKernel<T> single_kernel,
+                    const uint16_t* weights, size_t rows, size_t groups,
+                    const T* input, size_t count, float* output,
+                    size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  size_t n = 0;
+  for (; n + kVectors <= count; n += kVectors) {
+    const T* x[kVectors];
+    float* out[kVectors];
+    for (int v = 0; v < kVectors; v++) {
+      x[v] = input + (n + v) * stride;
+      out[v] = output + (n + v) * output_stride;
+    }
+    rows_kernel(weights, rows, groups, x, out);
+  }
+  for (; n < count; n++) {
+    const T* x = input + n * stride;
+    float* out = output + n * output_stride;
+    single_kernel(weights, rows, groups, &x, &out);
+  }
+}
+
+// Stores the first @rows_left of 8 results.
+__attribute__((target("avx2"))) inline void Store8(__m256 result,
+                                                   size_t rows_left,
+                                                   float* out) {
+  if (rows_left >= 8) {
+    _mm256_storeu_ps(out, result);
+  } else {
+    float tmp[8];
+    _mm256_storeu_ps(tmp, result);
+    std::copy(tmp, tmp + rows_left, out);
+  }
+}
+
+// FP16 weights are widened by the loads. The input is widened once per vector
+// beforehand, then each element is broadcast.
+template <int kVectors>
+__attribute__((target("avx2,fma,f16c"))) void RowsFp16Avx2(
+    const uint16_t* weights, size_t rows, size_t groups, const float* const* x,
+    float* const* out) {
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  for (size_t block = 0; block < blocks; block++) {
+    const uint16_t* block_weights = weights + block * groups * kGroupSize;
+    __m256 acc[kVectors][2];
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      acc[v][0] = _mm256_setzero_ps();
+      acc[v][1] = _mm256_setzero_ps();
+    }
+    for (size_t g = 0; g < groups; g++) {
+      __m256 w[kColumnGroup][2];
+#pragma GCC unroll 8
+      for (size_t c = 0; c < kColumnGroup; c++) {
+#pragma GCC unroll 8
+        for (int h = 0; h < 2; h++) {
+          w[c][h] = _mm256_cvtph_ps(_mm_load_si128(
+              reinterpret_cast<const __m128i*>(block_weights + g * kGroupSize +
+                                               c * kRowBlock + h * 8)));
+        }
+      }
+#pragma GCC unroll 8
+      for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+        for (size_t c = 0; c < kColumnGroup; c++) {
+          const __m256 xv = _mm256_set1_ps(x[v][g * kColumnGroup + c]);
+          acc[v][0] = _mm256_fmadd_ps(w[c][0], xv, acc[v][0]);
+          acc[v][1] = _mm256_fmadd_ps(w[c][1], xv, acc[v][1]);
+        }
+      }
+    }
+    const auto row = block * kRowBlock;
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      Store8(acc[v][0], rows - row, out[v] + row);
+      if (row + 8 < rows) Store8(acc[v][1], rows - row - 8, out[v] + row + 8);
+    }
+  }
+}
+
+// Same as RowsFp16Avx2(), with two row blocks at a time.
+template <int kVectors>
+__attribute__((target("avx512f"))) void RowsFp16Avx512(
+    const uint16_t* weights, size_t rows, size_t groups, const float* const* x,
+    float* const* out) {
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  for (size_t block = 0; block < blocks; block += 2) {
+    const uint16_t* block_weights = weights + block * groups * kGroupSize;
+    // Without a second block, the first one is computed twice and the copy is
+    // not stored.
+    const bool pair = block + 1 < blocks;
+    const size_t second = pair ? groups * kGroupSize : 0;
+    __m512 acc[kVectors][2];
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      acc[v][0] = _mm512_setzero_ps();
+      acc[v][1] = _mm512_setzero_ps();
+    }
+    for (size_t g = 0; g < groups; g++) {
+      __m512 w[kColumnGroup][2];
+#pragma GCC unroll 8
+      for (size_t c = 0; c < kColumnGroup; c++) {
+#pragma GCC unroll 8
+        for (int b = 0; b < 2; b++) {
+          w[c][b] = _mm512_cvtph_ps(_mm256_load_si256(
+              reinterpret_cast<const __m256i*>(block_weights + b * second +
+                                               g * kGroupSize +
+                                               c * kRowBlock)));
+        }
+      }
+#pragma GCC unroll 8
+      for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+        for (size_t c = 0; c < kColumnGroup; c++) {
+          const __m512 xv = _mm512_set1_ps(x[v][g * kColumnGroup + c]);
+          acc[v][0] = _mm512_fmadd_ps(w[c][0], xv, acc[v][0]);
+          acc[v][1] = _mm512_fmadd_ps(w[c][1], xv, acc[v][1]);
+        }
+      }
+    }
+#pragma GCC unroll 8
+    for (int b = 0; b < 2; b++) {
+      if (b == 1 && !pair) break;
+      const auto row = (block + b) * kRowBlock;
+      const auto rows_left = rows - row;
+      const __mmask16 mask =
+          rows_left >= kRowBlock ? 0xFFFF : (1u << rows_left) - 1;
+#pragma GCC unroll 8
+      for (int v = 0; v < kVectors; v++) {
+        _mm512_mask_storeu_ps(out[v] + row, mask, acc[v][b]);
+      }
+    }
+  }
+}
+
+// BF16 is the upper half of an FP32, so each 32-bit lane is split into the
+// two columns of a pair with a shift and a mask.
+template <int kVectors>
+__attribute__((target("avx2,fma"))) void RowsBf16Avx2(
+    const uint16_t* weights, size_t rows, size_t groups,
+    const uint16_t* const* x, float* const* out) {
+  const __m256i high_mask = _mm256_set1_epi32(0xFFFF0000);
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  for (size_t block = 0; block < blocks; block++) {
+    const uint16_t* block_weights = weights + block * groups * kGroupSize;
+    __m256 acc[kVectors][2][kColumnGroup];
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+      for (int h = 0; h < 2; h++) {
+        acc[v][h][0] = _mm256_setzero_ps();
+        acc[v][h][1] = _mm256_setzero_ps();
+      }
+    }
+    for (size_t g = 0; g < groups; g++) {
+      __m256 w[2][kColumnGroup];
+#pragma GCC unroll 8
+      for (int h = 0; h < 2; h++) {
+        const __m256i raw = _mm256_load_si256(reinterpret_cast<const __m256i*>(
+            block_weights + g * kGroupSize + h * kGroupSize / 2));
+        w[h][0] = _mm256_castsi256_ps(_mm256_slli_epi32(raw, 16));
+        w[h][1] = _mm256_castsi256_ps(_mm256_and_si256(raw, high_mask));
+      }
+#pragma GCC unroll 8
+      for (int v = 0; v < kVectors; v++) {
+        const __m256i pair =
+            _mm256_set1_epi32(LoadGroup(x[v] + g * kColumnGroup));
+        const __m256 x0 = _mm256_castsi256_ps(_mm256_slli_epi32(pair, 16));
+        const __m256 x1 =
+            _mm256_castsi256_ps(_mm256_and_si256(pair, high_mask));
+#pragma GCC unroll 8
+        for (int h = 0; h < 2; h++) {
+          acc[v][h][0] = _mm256_fmadd_ps(w[h][0], x0, acc[v][h][0]);
+          acc[v][h][1] = _mm256_fmadd_ps(w[h][1], x1, acc[v][h][1]);
+        }
+      }
+    }
+    const auto row = block * kRowBlock;
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+      for (int h = 0; h < 2; h++) {
+        if (row + 8 * h >= rows) break;
+        Store8(_mm256_add_ps(acc[v][h][0], acc[v][h][1]), rows - row - 8 * h,
+               out[v] + row + 8 * h);
+      }
+    }
+  }
+}
+
+// VDPBF16PS multiplies the pairs of BF16 in each 32-bit lane and adds both
+// products to the FP32 accumulator.
+template <int kVectors, int kBlocks>
+__attribute__((target("avx512f,avx512bf16"))) inline void BlocksBf16Avx512(
+    const uint16_t* weights, size_t rows, size_t groups,
+    const uint16_t* const* x, float* const* out, size_t first_block) {
+  const uint16_t* block_weights = weights + first_block * groups * kGroupSize;
+  __m512 acc[kVectors][kBlocks];
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+    for (int b = 0; b < kBlocks; b++) acc[v][b] = _mm512_setzero_ps();
+  }
+  for (size_t g = 0; g < groups; g++) {
+    __m512i w[kBlocks];
+#pragma GCC unroll 8
+    for (int b = 0; b < kBlocks; b++) {
+      w[b] = _mm512_load_si512(block_weights + (b * groups + g) * kGroupSize);
+    }
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      const __m512i xv = _mm512_set1_epi32(LoadGroup(x[v] + g * kColumnGroup));
+#pragma GCC unroll 8
+      for (int b = 0; b < kBlocks; b++) {
+        acc[v][b] = _mm512_dpbf16_ps(acc[v][b], (__m512bh)w[b], (__m512bh)xv);
+      }
+    }
+  }
+
+#pragma GCC unroll 8
+  for (int b = 0; b < kBlocks; b++) {
+    const auto row = (first_block + b) * kRowBlock;
+    const auto rows_left = rows - row;
+    const __mmask16 mask =
+        rows_left >= kRowBlock ? 0xFFFF : (1u << rows_left) - 1;
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      _mm512_mask_storeu_ps(out[v] + row, mask, acc[v][b]);
+    }
+  }
+}
+
+template <int kVectors>
+__attribute__((target("avx512f,avx512bf16"))) void RowsBf16Avx512(
+    const uint16_t* weights, size_t rows, size_t groups,
+    const uint16_t* const* x, float* const* out) {
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  size_t b = 0;
+  for (; b + 4 <= blocks; b += 4) {
+    BlocksBf16Avx512<kVectors, 4>(weights, rows, groups, x, out, b);
+  }
+  for (; b < blocks; b++) {
+    BlocksBf16Avx512<kVectors, 1>(weights, rows, groups, x, out, b);
+  }
+}
+
+__attribute__((target("avx2,f16c"))) void WidenFp16Avx2(const uint16_t* input,
+                                                        size_t size,
+                                                        float* output) {
+  size_t k = 0;
+  for (; k + 8 <= size; k += 8) {
+    _mm256_storeu_ps(output + k,
+                     _mm256_cvtph_ps(_mm_loadu_si128(
+                         reinterpret_cast<const __m128i*>(input + k))));
+  }
+  // Vectors are padded to an even length.
+  for (; k < size; k += 2) {
+    _mm_storel_pi(reinterpret_cast<__m64*>(output + k),
+                  _mm_cvtph_ps(_mm_cvtsi32_si128(LoadGroup(input + k))));
+  }
+}
+
+template <int kVectors>
+void MultiplyFp16(RowsKernel<float> rows_kernel,
+                  RowsKernel<float> single_kernel, const uint16_t* weights,
+                  size_t rows, size_t groups, const uint16_t* input,
+                  size_t count, float* output, size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  std::vector<float> widened(kVectors * stride);
+  for (size_t n = 0; n < count; n += kVectors) {
+    const auto chunk = std::min<size_t>(kVectors, count - n);
+    WidenFp16Avx2(input + n * stride, chunk * stride, widened.data());
+    MultiplyChunks<kVectors>(rows_kernel, single_kernel, weights, rows, groups,
+                             widened.data(), chunk,
+                             output + n * output_stride, output_stride);
+  }
+}
+
+void MultiplyFp16Avx2(const uint16_t* weights, size_t rows, size_t groups,
+                      const uint16_t* input, size_t count, float* output,
+                      size_t output_stride) {
+  MultiplyFp16<4>(RowsFp16Avx2<4>, RowsFp16Avx2<1>, weights, rows, groups,
+                  input, count, output, output_stride);
+}
+
+void MultiplyFp16Avx512(const uint16_t* weights, size_t rows, size_t groups,
+                        const uint16_t* input, size_t count, float* output,
+                        size_t output_stride) {
+  MultiplyFp16<4>(RowsFp16Avx512<4>, RowsFp16Avx512<1>, weights, rows, groups,
+                  input, count, output, output_stride);
+}
+
+void MultiplyBf16Avx2(const uint16_t* weights, size_t rows, size_t groups,
+                      const uint16_t* input, size_t count, float* output,
+                      size_t output_stride) {
+  MultiplyChunks<2>(RowsBf16Avx2<2>, RowsBf16Avx2<1>, weights, rows, groups,
+                    input, count, output, output_stride);
+}
+
+void MultiplyBf16Avx512(const uint16_t* weights, size_t rows, size_t groups,
+                        const uint16_t* input, size_t count, float* output,
+                        size_t output_stride) {
+  MultiplyChunks<4>(RowsBf16Avx512<4>, RowsBf16Avx512<1>, weights, rows,
+                    groups, input, count, output, output_stride);
+}
+
+__attribute__((target("avx2,f16c"))) void ConvertFp16Avx2(const float* input,
+                                                          size_t size,
+                                                          uint16_t* output) {
+  size_t k = 0;
+  for (; k + 8 <= size; k += 8) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(output + k),
+        _mm256_cvtps_ph(_mm256_loadu_ps(input + k), _MM_FROUND_TO_NEAREST_INT));
+  }
+  if (k < size) {
+    float tmp[8] = {};
+    uint16_t converted[8];
+    std::copy(input + k, input + size, tmp);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(converted),
+        _mm256_cvtps_ph(_mm256_loadu_ps(tmp), _MM_FROUND_TO_NEAREST_INT));
+    std::copy(converted, converted + size - k, output + k);
+  }
+}
+
+// Rounds 8 floats to nearest even BF16, in the low half of each lane.
+__attribute__((target("avx2"))) inline __m256i RoundBf16Avx2(const float* x) {
+  const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(x));
+  const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16),
+                                       _mm256_set1_epi32(1));
+  const __m256i rounded = _mm256_add_epi32(
+      bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF)));
+  return _mm256_srli_epi32(rounded, 16);
+}
+
+// Packing interleaves 128-bit lanes, which the permutation undoes.
+__attribute__((target("avx2"))) inline void ConvertBf16x16Avx2(
+    const float* input, uint16_t* output) {
+  const __m256i packed =
+      _mm256_packus_epi32(RoundBf16Avx2(input), RoundBf16Avx2(input + 8));
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i*>(output),
+      _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__((target("avx2"))) void ConvertBf16Avx2(const float* input,
+                                                     size_t size,
+                                                     uint16_t* output) {
+  size_t k = 0;
+  for (; k + 16 <= size; k += 16) ConvertBf16x16Avx2(input + k, output + k);
+  if (k < size) {
+    float tmp[16] = {};
+    uint16_t converted[16];
+    std::copy(input + k, input + size, tmp);
+    ConvertBf16x16Avx2(tmp, converted);
+    std::copy(converted, converted + size - k, output + k);
+  }
+}
+
+#endif  // USE_HALF_X86_KERNELS
+
+struct KernelChoice {
+  HalfKernel multiply;
+  ConvertKernel convert;
+  const char* name;
+};
+
+// Kernels for @format this CPU can run, fastest first.
+std::vector<KernelChoice> SupportedKernels(HalfFormat format) {
+  std::vector<KernelChoice> kernels;
+#ifdef USE_HALF_X86_KERNELS
+  __builtin_cpu_init();
+  const bool avx2 = __builtin_cpu_supports("avx2") &&
+                    __builtin_cpu_supports("fma") &&
+                    __builtin_cpu_supports("f16c");
+  if (format == HalfFormat::kFp16) {
+    if (avx2 && __builtin_cpu_supports("avx512f")) {
+      kernels.push_back({MultiplyFp16Avx512, ConvertFp16Avx2, "AVX512-F16C"});
+    }
+    if (avx2) {
+      kernels.push_back({MultiplyFp16Avx2, ConvertFp16Avx2, "AVX2-F16C"});
+    }
+  } else {
+    if (avx2 && __builtin_cpu_supports("avx512bf16")) {
+      kernels.push_back({MultiplyBf16Avx512, ConvertBf16Avx2, "AVX512-BF16"});
+    }
+    if (avx2) kernels.push_back({MultiplyBf16Avx2, ConvertBf16Avx2, "AVX2"});
+  }
+#endif
+  if (format == HalfFormat::kFp16) {
+    kernels.push_back({MultiplyScalar<HalfFormat::kFp16, FP16toFP32>,
+                       ConvertScalar<FP32toFP16>, "scalar"});
+  } else {
+    kernels.push_back({MultiplyScalar<HalfFormat::kBf16, BF16toFP32>,
+                       ConvertScalar<FP32toBF16>, "scalar"});
+  }
+  return kernels;
+}
+
+KernelChoice& GetKernel(HalfFormat format) {
+  static KernelChoice fp16 = SupportedKernels(HalfFormat::kFp16).front();
+  static KernelChoice bf16 = SupportedKernels(HalfFormat::kBf16).front();
+  return format == HalfFormat::kFp16 ? fp16 : bf16;
+}
+
+}  // namespace
+
+size_t HalfStride(size_t size) {
+  return (size + kColumnGroup - 1) / kColumnGroup * kColumnGroup;
+}
+
+void ConvertVectors(HalfFormat format, const float* input, size_t count,
+                    size_t size, size_t input_stride, uint16_t* output) {
+  const size_t stride = HalfStride(size);
+  const auto convert = GetKernel(format).convert;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t* out = output + i * stride;
+    convert(input + i * input_stride, size, out);
+    std::fill(out + size, out + stride, 0);
+  }
+}
+
+HalfMatrix::HalfMatrix(HalfFormat format, const float* m, size_t rows,
+                       size_t cols, size_t row_stride, size_t col_stride)
+    : format_(format), rows_(rows), cols_(cols), stride_(HalfStride(cols)) {
+  const auto padded_rows = (rows + kRowBlock - 1) / kRowBlock * kRowBlock;
+  const auto groups = stride_ / kColumnGroup;
+  data_.assign(padded_rows * stride_, 0);
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t c = 0; c < cols; c++) {
+      const auto value = m[r * row_stride + c * col_stride];
+      if (format == HalfFormat::kFp16) {
+        data_[PackedIndex<HalfFormat::kFp16>(r, c, groups)] = FP32toFP16(value);
+      } else {
+        data_[PackedIndex<HalfFormat::kBf16>(r, c, groups)] = FP32toBF16(value);
+      }
+    }
+  }
+}
+
+void HalfMatrix::Multiply(const uint16_t* input, size_t count, float* output,
+                          size_t output_stride) const {
+  GetKernel(format_).multiply(data_.data(), rows_, stride_ / kColumnGroup,
+                              input, count, output, output_stride);
+}
+
+const char* HalfKernelName(HalfFormat format) {
+  return GetKernel(format).name;
+}
+
+bool SetHalfKernel(HalfFormat format, const char* name) {
+  for (const auto& kernel : SupportedKernels(format)) {
+    if (std::strcmp(kernel.name, name) != 0) continue;
+    GetKernel(format) = kernel;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace lczero
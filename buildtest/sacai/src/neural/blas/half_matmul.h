@@ -0,0 +1,79 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "utils/aligned_allocator.h"
+
+namespace lczero {
+
+// 16 bit floating point formats. Products are accumulated in FP32.
+enum class HalfFormat { kFp16, kBf16 };
+
+// Length in elements of a converted vector of @size elements. Vectors are
+// zero padded so that kernels never need to handle a tail.
+size_t HalfStride(size_t size);
+
+// Converts @count vectors of @size floats to @format. Vector i is read from
+// @input + i * @input_stride and written to @output + i * HalfStride(@size).
+void ConvertVectors(HalfFormat format, const float* input, size_t count,
+                    size_t size, size_t input_stride, uint16_t* output);
+
+// Matrix stored in a 16 bit format. Rows are stored in blocks of 16, by groups
+// of 2 columns, so that SIMD kernels compute 16 outputs per register. BF16
+// interleaves the two columns for the pairwise dot products of AVX512-BF16,
+// FP16 stores them one after the other.
+class HalfMatrix {
+ public:
+  HalfMatrix() = default;
+  // Converts the @rows x @cols matrix whose element (r, c) is
+  // @m[r * @row_stride + c * @col_stride].
+  HalfMatrix(HalfFormat format, const float* m, size_t rows, size_t cols,
+             size_t row_stride, size_t col_stride);
+
+  // For each of the @count vectors in @input, laid out as by
+  // ConvertVectors(), computes the product with the matrix:
+  // output[n * @output_stride + r] = (row r) . (vector n).
+  void Multiply(const uint16_t* input, size_t count, float* output,
+                size_t output_stride) const;
+
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+
+  static constexpr size_t kRowBlock = 16;
+  static constexpr size_t kColumnGroup = 2;
+
+ private:
+  HalfFormat format_ = HalfFormat::kFp16;
+  size_t rows_ = 0;
+  size_t cols_ = 0;
+  size_t stride_ = 0;
+  AlignedVector<uint16_t> data_;
+};
+
+// Returns the name of the kernel selected for @format on this CPU.
+const char* HalfKernelName(HalfFormat format);
+
+// Makes all later calls for @format use the kernel called @name, for testing.
+// Returns false if this CPU cannot run it. Not thread safe.
+bool SetHalfKernel(HalfFormat format, const char* name);
+
+}  // namespace lczero
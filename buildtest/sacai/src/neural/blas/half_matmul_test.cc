@@ -0,0 +1,216 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/neural/blas/half_matmul.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "src/utils/fp16_utils.h"
+
+namespace lczero {
+namespace {
+
+const size_t kRows[] = {1, 7, 17, 130};
+const size_t kCols[] = {1, 3, 5, 113};
+// Kernels work on chunks of up to 16 vectors and compute the rest one at a
+// time.
+const size_t kCounts[] = {1, 3, 5, 16, 17, 33};
+
+std::vector<float> RandomVector(std::mt19937& gen, size_t size) {
+  std::uniform_real_distribution<float> values(-1.0f, 1.0f);
+  std::vector<float> result(size);
+  for (auto& x : result) x = values(gen);
+  return result;
+}
+
+// @x rounded to @format and back, as the scalar conversion does it.
+float Round(HalfFormat format, float x) {
+  return format == HalfFormat::kFp16 ? FP16toFP32(FP32toFP16(x))
+                                     : BF16toFP32(FP32toBF16(x));
+}
+
+uint16_t Convert(HalfFormat format, float x) {
+  return format == HalfFormat::kFp16 ? FP32toFP16(x) : FP32toBF16(x);
+}
+
+class HalfMatmulTest
+    : public ::testing::TestWithParam<std::tuple<HalfFormat, const char*>> {
+ protected:
+  void SetUp() override {
+    default_kernel_ = HalfKernelName(format());
+    if (!SetHalfKernel(format(), kernel())) {
+      GTEST_SKIP() << kernel() << " not supported on this CPU";
+    }
+    ASSERT_STREQ(HalfKernelName(format()), kernel());
+  }
+  void TearDown() override { SetHalfKernel(format(), default_kernel_); }
+
+  HalfFormat format() const { return std::get<0>(GetParam()); }
+  const char* kernel() const { return std::get<1>(GetParam()); }
+
+ private:
+  const char* default_kernel_ = nullptr;
+};
+
+TEST_P(HalfMatmulTest, ConvertVectors) {
+  std::mt19937 gen(1);
+  for (auto size : {1, 3, 5, 7, 8, 9, 15, 16, 17, 33, 113}) {
+    const size_t count = 3;
+    const size_t input_stride = size + 2;
+    auto input = RandomVector(gen, count * input_stride);
+    // Values that do not round like truncation, one of them an exact BF16
+    // tie, and one that is exact in both formats.
+    input[0] = 1.0f + 1.0f / 1024 + 1.0f / 4096;
+    input[input_stride] = -(1.0f + 3.0f / 256);
+    input[2 * input_stride] = 100.0f;
+    const size_t stride = HalfStride(size);
+    ASSERT_GE(stride, static_cast<size_t>(size));
+    ASSERT_EQ(stride % HalfMatrix::kColumnGroup, 0u);
+
+    // Garbage in the padding must be overwritten.
+    std::vector<uint16_t> output(count * stride, 0x1234);
+    ConvertVectors(format(), input.data(), count, size, input_stride,
+                   output.data());
+    for (size_t n = 0; n < count; n++) {
+      for (size_t k = 0; k < stride; k++) {
+        const uint16_t expected =
+            k < static_cast<size_t>(size)
+                ? Convert(format(), input[n * input_stride + k])
+                : 0;
+        EXPECT_EQ(output[n * stride + k], expected)
+            << "size " << size << " vector " << n << " element " << k;
+      }
+    }
+  }
+}
+
+TEST_P(HalfMatmulTest, Multiply) {
+  std::mt19937 gen(2);
+  for (auto rows : kRows) {
+    for (auto cols : kCols) {
+      for (auto count : kCounts) {
+        const auto m = RandomVector(gen, rows * cols);
+        const auto x = RandomVector(gen, count * cols);
+        std::vector<uint16_t> converted(count * HalfStride(cols));
+        ConvertVectors(format(), x.data(), count, cols, cols,
+                       converted.data());
+        // Transposed, to also cover the column stride.
+        std::vector<float> transposed(cols * rows);
+        for (size_t r = 0; r < rows; r++) {
+          for (size_t c = 0; c < cols; c++) {
+            transposed[c * rows + r] = m[r * cols + c];
+          }
+        }
+        const HalfMatrix matrix(format(), transposed.data(), rows, cols, 1,
+                                rows);
+        ASSERT_EQ(matrix.rows(), rows);
+        ASSERT_EQ(matrix.cols(), cols);
+
+        // Outputs are written with a stride, the gaps and the end of the
+        // buffer must stay untouched.
+        const size_t output_stride = rows + 3;
+        std::vector<float> output(count * output_stride + 16, 42.0f);
+        matrix.Multiply(converted.data(), count, output.data(),
+                        output_stride);
+
+        for (size_t n = 0; n < count; n++) {
+          for (size_t r = 0; r < rows; r++) {
+            // The products of the rounded operands are exact in FP32, only
+            // the accumulation order differs between kernels.
+            double expected = 0.0;
+            double magnitude = 0.0;
+            for (size_t c = 0; c < cols; c++) {
+              const double w = Round(format(), m[r * cols + c]);
+              const double product = w * Round(format(), x[n * cols + c]);
+              expected += product;
+              magnitude += std::abs(product);
+            }
+            EXPECT_NEAR(output[n * output_stride + r], expected,
+                        1e-6 * magnitude + 1e-7)
+                << rows << "x" << cols << " count " << count << " vector " << n
+                << " row " << r;
+          }
+          for (size_t r = rows; r < output_stride; r++) {
+            EXPECT_EQ(output[n * output_stride + r], 42.0f);
+          }
+        }
+        for (size_t i = count * output_stride; i < output.size(); i++) {
+          EXPECT_EQ(output[i], 42.0f);
+        }
+      }
+    }
+  }
+}
+
+// Against the unrounded FP32 product, each operand is off by at most one
+// rounding of the format.
+TEST_P(HalfMatmulTest, MatchesFloatProduct) {
+  const double epsilon = format() == HalfFormat::kFp16 ? std::ldexp(1.0, -11)
+                                                        : std::ldexp(1.0, -8);
+  std::mt19937 gen(3);
+  for (auto rows : kRows) {
+    for (auto cols : kCols) {
+      for (auto count : kCounts) {
+        const auto m = RandomVector(gen, rows * cols);
+        const auto x = RandomVector(gen, count * cols);
+        std::vector<uint16_t> converted(count * HalfStride(cols));
+        ConvertVectors(format(), x.data(), count, cols, cols,
+                       converted.data());
+        const HalfMatrix matrix(format(), m.data(), rows, cols, cols, 1);
+        std::vector<float> output(count * rows);
+        matrix.Multiply(converted.data(), count, output.data(), rows);
+
+        for (size_t n = 0; n < count; n++) {
+          for (size_t r = 0; r < rows; r++) {
+            double expected = 0.0;
+            double magnitude = 0.0;
+            for (size_t c = 0; c < cols; c++) {
+              const double product =
+                  static_cast<double>(m[r * cols + c]) * x[n * cols + c];
+              expected += product;
+              magnitude += std::abs(product);
+            }
+            EXPECT_NEAR(output[n * rows + r], expected,
+                        (2.01 * epsilon + 1e-6) * magnitude + 1e-6)
+                << rows << "x" << cols << " count " << count << " vector " << n
+                << " row " << r;
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Fp16, HalfMatmulTest,
+    ::testing::Combine(::testing::Values(HalfFormat::kFp16),
+                       ::testing::Values("scalar", "AVX2-F16C",
+                                         "AVX512-F16C")));
+
+INSTANTIATE_TEST_SUITE_P(
+    Bf16, HalfMatmulTest,
+    ::testing::Combine(::testing::Values(HalfFormat::kBf16),
+                       ::testing::Values("scalar", "AVX2", "AVX512-BF16")));
+
+}  // namespace
+}  // namespace lczero
@@ -0,0 +1,431 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "neural/blas/int8_matmul.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_INT8_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace lczero {
+namespace {
+
+constexpr size_t kRowBlock = Int8Matrix::kRowBlock;
+constexpr size_t kColumnGroup = Int8Matrix::kColumnGroup;
+// Bytes of one column group of a row block, one AVX-512 register.
+constexpr size_t kGroupBytes = kRowBlock * kColumnGroup;
+
+// Computes output[n * output_stride + r] for all rows r and vectors n. The
+// weights are packed as described in Int8Matrix, with @groups column groups.
+using Int8Kernel = void (*)(const int8_t* weights, const float* scales,
+                            const int32_t* row_sums, size_t rows,
+                            size_t groups, const int8_t* input, size_t count,
+                            float input_scale, float* output,
+                            size_t output_stride);
+
+// Quantizes @size floats multiplied by @inv_scale.
+using QuantizeKernel = void (*)(const float* input, size_t size,
+                                float inv_scale, int8_t* output);
+
+// Rounds to the nearest integer, for |x| < 2^22. Unlike std::nearbyint() this
+// is plain arithmetic, so the compiler can vectorize loops using it.
+inline float RoundToInt(float x) {
+  constexpr float kMagic = 12582912.0f;  // 1.5 * 2^23
+  return (x + kMagic) - kMagic;
+}
+
+inline int8_t QuantizeValue(float x) {
+  return static_cast<int8_t>(
+      RoundToInt(std::min(127.0f, std::max(-127.0f, x))));
+}
+
+void QuantizeScalar(const float* input, size_t size, float inv_scale,
+                    int8_t* output) {
+  for (size_t k = 0; k < size; k++) {
+    output[k] = QuantizeValue(input[k] * inv_scale);
+  }
+}
+
+void MultiplyScalar(const int8_t* weights, const float* scales,
+                    const int32_t* /* row_sums */, size_t rows, size_t groups,
+                    const int8_t* input, size_t count, float input_scale,
+                    float* output, size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  for (size_t n = 0; n < count; n++) {
+    const int8_t* x = input + n * stride;
+    for (size_t r = 0; r < rows; r++) {
+      const int8_t* w = weights + r / kRowBlock * groups * kGroupBytes +
+                        r % kRowBlock * kColumnGroup;
+      int32_t acc = 0;
+      for (size_t g = 0; g < groups; g++) {
+        for (size_t k = 0; k < kColumnGroup; k++) {
+          acc += w[g * kGroupBytes + k] * x[g * kColumnGroup + k];
+        }
+      }
+      output[n * output_stride + r] = input_scale * scales[r] * acc;
+    }
+  }
+}
+
+#ifdef USE_INT8_X86_KERNELS
+
+// Scales, clamps and rounds 8 floats to 32-bit integers.
+__attribute__((target("avx2"))) inline __m256i ConvertAvx2(const float* x,
+                                                           __m256 scale) {
+  const __m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(x), scale);
+  return _mm256_cvtps_epi32(_mm256_min_ps(
+      _mm256_set1_ps(127.0f), _mm256_max_ps(_mm256_set1_ps(-127.0f), scaled)));
+}
+
+// Converts 32 floats at a time; the packing instructions interleave 128-bit
+// lanes, which the final permutation undoes.
+__attribute__((target("avx2"))) void QuantizeAvx2(const float* input,
+                                                  size_t size, float inv_scale,
+                                                  int8_t* output) {
+  const __m256 scale = _mm256_set1_ps(inv_scale);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t k = 0;
+  for (; k + 32 <= size; k += 32) {
+    const __m256i ab = _mm256_packs_epi32(ConvertAvx2(input + k, scale),
+                                          ConvertAvx2(input + k + 8, scale));
+    const __m256i cd = _mm256_packs_epi32(ConvertAvx2(input + k + 16, scale),
+                                          ConvertAvx2(input + k + 24, scale));
+    const __m256i bytes =
+        _mm256_permutevar8x32_epi32(_mm256_packs_epi16(ab, cd), order);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + k), bytes);
+  }
+  // Not a call to QuantizeScalar(), which would skip VZEROUPPER.
+  for (; k < size; k++) output[k] = QuantizeValue(input[k] * inv_scale);
+}
+
+inline int32_t LoadGroup(const int8_t* x) {
+  int32_t group;
+  std::memcpy(&group, x, sizeof(group));
+  return group;
+}
+
+// Each 256-bit half of a block holds 8 rows. VPMADDUBSW multiplies unsigned
+// by signed bytes, so the sign of the input is moved to the weights. Inputs
+// and weights are within [-127, 127], so the pairwise sums cannot saturate.
+template <int kVectors, int kBlocks>
+__attribute__((target("avx2"))) inline void BlocksAvx2(
+    const int8_t* weights, const float* scales, size_t rows, size_t groups,
+    const int8_t* const* x, float input_scale, float* const* out,
+    size_t first_block) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  const int8_t* block_weights = weights + first_block * groups * kGroupBytes;
+  __m256i acc[kVectors][2 * kBlocks];
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+    for (int h = 0; h < 2 * kBlocks; h++) acc[v][h] = _mm256_setzero_si256();
+  }
+  for (size_t g = 0; g < groups; g++) {
+    __m256i w[2 * kBlocks];
+#pragma GCC unroll 8
+    for (int h = 0; h < 2 * kBlocks; h++) {
+      w[h] = _mm256_load_si256(reinterpret_cast<const __m256i*>(
+          block_weights + ((h / 2) * groups + g) * kGroupBytes +
+          (h % 2) * kGroupBytes / 2));
+    }
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      const __m256i xv = _mm256_set1_epi32(LoadGroup(x[v] + g * kColumnGroup));
+      const __m256i abs_x = _mm256_abs_epi8(xv);
+#pragma GCC unroll 8
+      for (int h = 0; h < 2 * kBlocks; h++) {
+        const __m256i products =
+            _mm256_maddubs_epi16(abs_x, _mm256_sign_epi8(w[h], xv));
+        acc[v][h] =
+            _mm256_add_epi32(acc[v][h], _mm256_madd_epi16(products, ones));
+      }
+    }
+  }
+
+  const __m256 input_scales = _mm256_set1_ps(input_scale);
+#pragma GCC unroll 8
+  for (int h = 0; h < 2 * kBlocks; h++) {
+    const auto row = first_block * kRowBlock + h * kRowBlock / 2;
+    if (row >= rows) break;
+    const __m256 row_scales =
+        _mm256_mul_ps(_mm256_load_ps(scales + row), input_scales);
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      const __m256 result =
+          _mm256_mul_ps(_mm256_cvtepi32_ps(acc[v][h]), row_scales);
+      if (rows - row >= kRowBlock / 2) {
+        _mm256_storeu_ps(out[v] + row, result);
+      } else {
+        float tmp[kRowBlock / 2];
+        _mm256_storeu_ps(tmp, result);
+        std::copy(tmp, tmp + rows - row, out[v] + row);
+      }
+    }
+  }
+}
+
+template <int kVectors>
+__attribute__((target("avx2"))) inline void RowsAvx2(
+    const int8_t* weights, const float* scales, size_t rows, size_t groups,
+    const int8_t* const* x, float input_scale, float* const* out) {
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  size_t b = 0;
+  for (; b + 2 <= blocks; b += 2) {
+    BlocksAvx2<kVectors, 2>(weights, scales, rows, groups, x, input_scale, out,
+                            b);
+  }
+  if (b < blocks) {
+    BlocksAvx2<kVectors, 1>(weights, scales, rows, groups, x, input_scale, out,
+                            b);
+  }
+}
+
+__attribute__((target("avx2"))) void MultiplyAvx2(
+    const int8_t* weights, const float* scales, const int32_t* /* row_sums */,
+    size_t rows, size_t groups, const int8_t* input, size_t count,
+    float input_scale, float* output, size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  size_t n = 0;
+  for (; n + 2 <= count; n += 2) {
+    const int8_t* x[2] = {input + n * stride, input + (n + 1) * stride};
+    float* out[2] = {output + n * output_stride,
+                     output + (n + 1) * output_stride};
+    RowsAvx2<2>(weights, scales, rows, groups, x, input_scale, out);
+  }
+  if (n < count) {
+    const int8_t* x[1] = {input + n * stride};
+    float* out[1] = {output + n * output_stride};
+    RowsAvx2<1>(weights, scales, rows, groups, x, input_scale, out);
+  }
+}
+
+// VPDPBUSD multiplies unsigned by signed bytes, so inputs are offset by 128
+// and 128 * (sum of the row) is subtracted from the result.
+template <int kVectors, int kBlocks>
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) inline void
+BlocksAvx512Vnni(const int8_t* weights, const float* scales,
+                 const int32_t* row_sums, size_t rows, size_t groups,
+                 const int8_t* const* x, float input_scale, float* const* out,
+                 size_t first_block) {
+  const __m512i offset = _mm512_set1_epi8(static_cast<char>(0x80));
+  const int8_t* block_weights = weights + first_block * groups * kGroupBytes;
+  __m512i acc[kVectors][kBlocks];
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; v++) {
+#pragma GCC unroll 8
+    for (int b = 0; b < kBlocks; b++) acc[v][b] = _mm512_setzero_si512();
+  }
+  for (size_t g = 0; g < groups; g++) {
+    __m512i w[kBlocks];
+#pragma GCC unroll 8
+    for (int b = 0; b < kBlocks; b++) {
+      w[b] = _mm512_load_si512(block_weights + (b * groups + g) * kGroupBytes);
+    }
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      const __m512i xv = _mm512_xor_si512(
+          _mm512_set1_epi32(LoadGroup(x[v] + g * kColumnGroup)), offset);
+#pragma GCC unroll 8
+      for (int b = 0; b < kBlocks; b++) {
+        acc[v][b] = _mm512_dpbusd_epi32(acc[v][b], xv, w[b]);
+      }
+    }
+  }
+
+  const __m512 input_scales = _mm512_set1_ps(input_scale);
+#pragma GCC unroll 8
+  for (int b = 0; b < kBlocks; b++) {
+    const auto row = (first_block + b) * kRowBlock;
+    const __m512i correction =
+        _mm512_slli_epi32(_mm512_load_si512(row_sums + row), 7);
+    const __m512 row_scales =
+        _mm512_mul_ps(_mm512_load_ps(scales + row), input_scales);
+    const auto rows_left = rows - row;
+    const __mmask16 mask =
+        rows_left >= kRowBlock ? 0xFFFF : (1u << rows_left) - 1;
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; v++) {
+      const __m512i sum = _mm512_sub_epi32(acc[v][b], correction);
+      _mm512_mask_storeu_ps(out[v] + row, mask,
+                            _mm512_mul_ps(_mm512_cvtepi32_ps(sum), row_scales));
+    }
+  }
+}
+
+template <int kVectors>
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) inline void
+RowsAvx512Vnni(const int8_t* weights, const float* scales,
+               const int32_t* row_sums, size_t rows, size_t groups,
+               const int8_t* const* x, float input_scale, float* const* out) {
+  const auto blocks = (rows + kRowBlock - 1) / kRowBlock;
+  size_t b = 0;
+  for (; b + 4 <= blocks; b += 4) {
+    BlocksAvx512Vnni<kVectors, 4>(weights, scales, row_sums, rows, groups, x,
+                                  input_scale, out, b);
+  }
+  for (; b < blocks; b++) {
+    BlocksAvx512Vnni<kVectors, 1>(weights, scales, row_sums, rows, groups, x,
+                                  input_scale, out, b);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void
+MultiplyAvx512Vnni(const int8_t* weights, const float* scales,
+                   const int32_t* row_sums, size_t rows, size_t groups,
+                   const int8_t* input, size_t count, float input_scale,
+                   float* output, size_t output_stride) {
+  const auto stride = groups * kColumnGroup;
+  size_t n = 0;
+  for (; n + 2 <= count; n += 2) {
+    const int8_t* x[2] = {input + n * stride, input + (n + 1) * stride};
+    float* out[2] = {output + n * output_stride,
+                     output + (n + 1) * output_stride};
+    RowsAvx512Vnni<2>(weights, scales, row_sums, rows, groups, x, input_scale,
+                      out);
+  }
+  if (n < count) {
+    const int8_t* x[1] = {input + n * stride};
+    float* out[1] = {output + n * output_stride};
+    RowsAvx512Vnni<1>(weights, scales, row_sums, rows, groups, x, input_scale,
+                      out);
+  }
+}
+
+#endif  // USE_INT8_X86_KERNELS
+
+struct KernelChoice {
+  Int8Kernel kernel;
+  QuantizeKernel quantize;
+  const char* name;
+};
+
+// Kernels this CPU can run, fastest first.
+std::vector<KernelChoice> SupportedKernels() {
+  std::vector<KernelChoice> kernels;
+#ifdef USE_INT8_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512vnni") &&
+      __builtin_cpu_supports("avx512bw")) {
+    kernels.push_back({MultiplyAvx512Vnni, QuantizeAvx2, "AVX512-VNNI"});
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({MultiplyAvx2, QuantizeAvx2, "AVX2"});
+  }
+#endif
+  kernels.push_back({MultiplyScalar, QuantizeScalar, "scalar"});
+  return kernels;
+}
+
+KernelChoice& GetKernel() {
+  static KernelChoice choice = SupportedKernels().front();
+  return choice;
+}
+
+}  // namespace
+
+size_t Int8Stride(size_t size) {
+  return (size + kColumnGroup - 1) / kColumnGroup * kColumnGroup;
+}
+
+void QuantizeVectors(const float* input, size_t count, size_t size,
+                     size_t input_stride, float scale, int8_t* output) {
+  const size_t stride = Int8Stride(size);
+  const float inv_scale = 1.0f / scale;
+  const auto quantize = GetKernel().quantize;
+  for (size_t i = 0; i < count; i++) {
+    int8_t* out = output + i * stride;
+    quantize(input + i * input_stride, size, inv_scale, out);
+    std::fill(out + size, out + stride, 0);
+  }
+}
+
+Int8Matrix::Int8Matrix(const float* m, size_t rows, size_t cols,
+                       size_t row_stride, size_t col_stride)
+    : rows_(rows), cols_(cols), stride_(Int8Stride(cols)) {
+  const auto padded_rows = (rows + kRowBlock - 1) / kRowBlock * kRowBlock;
+  const auto groups = stride_ / kColumnGroup;
+  data_.assign(padded_rows * stride_, 0);
+  scales_.assign(padded_rows, 0.0f);
+  row_sums_.assign(padded_rows, 0);
+  for (size_t r = 0; r < rows; r++) {
+    float absmax = 0.0f;
+    for (size_t c = 0; c < cols; c++) {
+      absmax = std::max(absmax, std::abs(m[r * row_stride + c * col_stride]));
+    }
+    scales_[r] = absmax > 0.0f ? absmax / 127.0f : 1.0f;
+    int8_t* row = &data_[r / kRowBlock * groups * kGroupBytes +
+                         r % kRowBlock * kColumnGroup];
+    int32_t sum = 0;
+    for (size_t c = 0; c < cols; c++) {
+      const auto value =
+          QuantizeValue(m[r * row_stride + c * col_stride] / scales_[r]);
+      row[c / kColumnGroup * kGroupBytes + c % kColumnGroup] = value;
+      sum += value;
+    }
+    row_sums_[r] = sum;
+  }
+}
+
+void Int8Matrix::Multiply(const int8_t* input, size_t count, float input_scale,
+                          float* output, size_t output_stride) const {
+  GetKernel().kernel(data_.data(), scales_.data(), row_sums_.data(), rows_,
+                     stride_ / kColumnGroup, input, count, input_scale, output,
+                     output_stride);
+}
+
+Int8FullyConnected::Int8FullyConnected(const std::vector<float>& weights,
+                                       size_t input_size, size_t output_size,
+                                       float input_absmax)
+    : weights(weights.data(), output_size, input_size, input_size, 1),
+      input_scale(input_absmax > 0.0f ? input_absmax / 127.0f : 1.0f) {}
+
+void Int8FullyConnected::Forward(size_t batch_size, const float* input,
+                                 const float* biases, bool apply_relu,
+                                 float* output, int8_t* scratch) const {
+  const auto input_size = weights.cols();
+  const auto output_size = weights.rows();
+  QuantizeVectors(input, batch_size, input_size, input_size, input_scale,
+                  scratch);
+  weights.Multiply(scratch, batch_size, input_scale, output, output_size);
+  for (size_t i = 0; i < batch_size; i++) {
+    float* batch_output = output + i * output_size;
+    for (size_t o = 0; o < output_size; o++) {
+      const float val = batch_output[o] + biases[o];
+      batch_output[o] = apply_relu && val < 0 ? 0 : val;
+    }
+  }
+}
+
+const char* Int8KernelName() { return GetKernel().name; }
+
+bool SetInt8Kernel(const char* name) {
+  for (const auto& kernel : SupportedKernels()) {
+    if (std::strcmp(kernel.name, name) != 0) continue;
+    GetKernel() = kernel;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace lczero
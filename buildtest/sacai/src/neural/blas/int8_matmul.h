@@ -0,0 +1,97 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/aligned_allocator.h"
+
+namespace lczero {
+
+// Length in bytes of a quantized vector of @size elements. Vectors are zero
+// padded so that kernels never need to handle a tail.
+size_t Int8Stride(size_t size);
+
+// Quantizes @count vectors of @size floats to round(x / @scale), clamped to
+// [-127, 127]. Vector i is read from @input + i * @input_stride and written to
+// @output + i * Int8Stride(@size).
+void QuantizeVectors(const float* input, size_t count, size_t size,
+                     size_t input_stride, float scale, int8_t* output);
+
+// Matrix quantized symmetrically to INT8 with one scale per row. Rows are
+// stored in blocks of 16, interleaved by groups of 4 columns, so that SIMD
+// kernels compute 16 outputs per register without horizontal reductions.
+class Int8Matrix {
+ public:
+  Int8Matrix() = default;
+  // Quantizes the @rows x @cols matrix whose element (r, c) is
+  // @m[r * @row_stride + c * @col_stride].
+  Int8Matrix(const float* m, size_t rows, size_t cols, size_t row_stride,
+             size_t col_stride);
+
+  // For each of the @count vectors in @input, laid out as by
+  // QuantizeVectors() with @input_scale, computes the product with the
+  // matrix: output[n * @output_stride + r] = (row r) . (vector n).
+  void Multiply(const int8_t* input, size_t count, float input_scale,
+                float* output, size_t output_stride) const;
+
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+
+  static constexpr size_t kRowBlock = 16;
+  static constexpr size_t kColumnGroup = 4;
+
+ private:
+  size_t rows_ = 0;
+  size_t cols_ = 0;
+  size_t stride_ = 0;
+  AlignedVector<int8_t> data_;
+  // Padded to whole row blocks.
+  AlignedVector<float> scales_;
+  // Sum of each quantized row, needed by kernels working on unsigned inputs.
+  AlignedVector<int32_t> row_sums_;
+};
+
+// Fully connected layer with INT8 weights and a fixed input scale.
+struct Int8FullyConnected {
+  Int8FullyConnected() = default;
+  // @weights are laid out as for FullyConnectedLayer, @input_absmax is the
+  // largest input magnitude seen during calibration.
+  Int8FullyConnected(const std::vector<float>& weights, size_t input_size,
+                     size_t output_size, float input_absmax);
+
+  // Same as FullyConnectedLayer::Forward1D(). @scratch has to hold
+  // batch_size * Int8Stride(input_size) bytes.
+  void Forward(size_t batch_size, const float* input, const float* biases,
+               bool apply_relu, float* output, int8_t* scratch) const;
+
+  Int8Matrix weights;
+  float input_scale = 1.0f;
+};
+
+// Returns the name of the INT8 kernel selected for this CPU.
+const char* Int8KernelName();
+
+// Makes all later calls use the kernel called @name, for testing. Returns
+// false if this CPU cannot run it. Not thread safe.
+bool SetInt8Kernel(const char* name);
+
+}  // namespace lczero
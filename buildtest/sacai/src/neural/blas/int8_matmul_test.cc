@@ -0,0 +1,246 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/neural/blas/int8_matmul.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace lczero {
+namespace {
+
+const char* const kKernels[] = {"scalar", "AVX2", "AVX512-VNNI"};
+const size_t kRows[] = {1, 7, 17, 130};
+const size_t kCols[] = {1, 3, 5, 113};
+const size_t kCounts[] = {1, 2, 3, 5};
+
+std::vector<float> RandomVector(std::mt19937& gen, size_t size) {
+  std::uniform_real_distribution<float> values(-1.0f, 1.0f);
+  std::vector<float> result(size);
+  for (auto& x : result) x = values(gen);
+  return result;
+}
+
+float AbsMax(const std::vector<float>& v) {
+  float result = 0.0f;
+  for (auto x : v) result = std::max(result, std::abs(x));
+  return result;
+}
+
+// Product of the float @m (rows x cols) with the @count float vectors in @x,
+// and for each output a bound of the quantization error: every operand is
+// off by at most half its scale.
+void Reference(const std::vector<float>& m, const std::vector<float>& x,
+               size_t rows, size_t cols, size_t count, float input_scale,
+               std::vector<float>* output, std::vector<float>* tolerance) {
+  output->assign(count * rows, 0.0f);
+  tolerance->assign(count * rows, 0.0f);
+  for (size_t r = 0; r < rows; r++) {
+    float row_absmax = 0.0f;
+    for (size_t c = 0; c < cols; c++) {
+      row_absmax = std::max(row_absmax, std::abs(m[r * cols + c]));
+    }
+    const float row_scale = row_absmax / 127.0f;
+    for (size_t n = 0; n < count; n++) {
+      double acc = 0.0;
+      double error = 0.0;
+      for (size_t c = 0; c < cols; c++) {
+        const float w = m[r * cols + c];
+        const float v = x[n * cols + c];
+        acc += w * v;
+        error += 0.5 * row_scale * std::abs(v) +
+                 0.5 * input_scale * std::abs(w) +
+                 0.25 * row_scale * input_scale;
+      }
+      (*output)[n * rows + r] = acc;
+      (*tolerance)[n * rows + r] = 1.01 * error + 1e-6;
+    }
+  }
+}
+
+class Int8MatmulTest : public ::testing::TestWithParam<const char*> {
+ protected:
+  void SetUp() override {
+    default_kernel_ = Int8KernelName();
+    if (!SetInt8Kernel(GetParam())) {
+      GTEST_SKIP() << GetParam() << " not supported on this CPU";
+    }
+    ASSERT_STREQ(Int8KernelName(), GetParam());
+  }
+  void TearDown() override { SetInt8Kernel(default_kernel_); }
+
+ private:
+  const char* default_kernel_ = nullptr;
+};
+
+TEST_P(Int8MatmulTest, QuantizeVectors) {
+  std::mt19937 gen(1);
+  for (auto size : {1, 3, 5, 31, 32, 33, 113}) {
+    const size_t count = 3;
+    const size_t input_stride = size + 2;
+    auto input = RandomVector(gen, count * input_stride);
+    // Values beyond the range of the scale are clamped.
+    input[0] = 3.0f;
+    input[input_stride] = -3.0f;
+    const float scale = 1.0f / 127.0f;
+    const size_t stride = Int8Stride(size);
+    ASSERT_GE(stride, static_cast<size_t>(size));
+    ASSERT_EQ(stride % Int8Matrix::kColumnGroup, 0u);
+
+    // Garbage in the padding must be overwritten.
+    std::vector<int8_t> output(count * stride, 99);
+    QuantizeVectors(input.data(), count, size, input_stride, scale,
+                    output.data());
+    for (size_t n = 0; n < count; n++) {
+      for (size_t k = 0; k < stride; k++) {
+        float x = 0.0f;
+        if (k < static_cast<size_t>(size)) {
+          x = input[n * input_stride + k] * (1.0f / scale);
+          x = std::min(127.0f, std::max(-127.0f, x));
+        }
+        EXPECT_EQ(output[n * stride + k], std::nearbyint(x))
+            << "size " << size << " vector " << n << " element " << k;
+      }
+    }
+  }
+}
+
+TEST_P(Int8MatmulTest, Multiply) {
+  std::mt19937 gen(2);
+  for (auto rows : kRows) {
+    for (auto cols : kCols) {
+      for (auto count : kCounts) {
+        const auto m = RandomVector(gen, rows * cols);
+        const auto x = RandomVector(gen, count * cols);
+        const float input_scale = AbsMax(x) / 127.0f;
+        std::vector<int8_t> quantized(count * Int8Stride(cols));
+        QuantizeVectors(x.data(), count, cols, cols, input_scale,
+                        quantized.data());
+        const Int8Matrix matrix(m.data(), rows, cols, cols, 1);
+        ASSERT_EQ(matrix.rows(), rows);
+        ASSERT_EQ(matrix.cols(), cols);
+
+        // Outputs are written with a stride, the gaps and the end of the
+        // buffer must stay untouched.
+        const size_t output_stride = rows + 3;
+        std::vector<float> output(count * output_stride + 16, 42.0f);
+        matrix.Multiply(quantized.data(), count, input_scale, output.data(),
+                        output_stride);
+
+        std::vector<float> expected, tolerance;
+        Reference(m, x, rows, cols, count, input_scale, &expected, &tolerance);
+        for (size_t n = 0; n < count; n++) {
+          for (size_t r = 0; r < rows; r++) {
+            EXPECT_NEAR(output[n * output_stride + r], expected[n * rows + r],
+                        tolerance[n * rows + r])
+                << rows << "x" << cols << " count " << count << " vector " << n
+                << " row " << r;
+          }
+          for (size_t r = rows; r < output_stride; r++) {
+            EXPECT_EQ(output[n * output_stride + r], 42.0f);
+          }
+        }
+        for (size_t i = count * output_stride; i < output.size(); i++) {
+          EXPECT_EQ(output[i], 42.0f);
+        }
+      }
+    }
+  }
+}
+
+// The integer products are exact, so every kernel has to agree with the
+// scalar one up to float rounding of the scales.
+TEST_P(Int8MatmulTest, MatchesScalarKernel) {
+  std::mt19937 gen(3);
+  for (auto rows : kRows) {
+    for (auto cols : kCols) {
+      for (auto count : kCounts) {
+        const auto m = RandomVector(gen, rows * cols);
+        const auto x = RandomVector(gen, count * cols);
+        const float input_scale = AbsMax(x) / 127.0f;
+        const Int8Matrix matrix(m.data(), rows, cols, cols, 1);
+        std::vector<int8_t> quantized(count * Int8Stride(cols));
+        std::vector<float> output(count * rows);
+        std::vector<float> expected(count * rows);
+
+        QuantizeVectors(x.data(), count, cols, cols, input_scale,
+                        quantized.data());
+        matrix.Multiply(quantized.data(), count, input_scale, output.data(),
+                        rows);
+        ASSERT_TRUE(SetInt8Kernel("scalar"));
+        QuantizeVectors(x.data(), count, cols, cols, input_scale,
+                        quantized.data());
+        matrix.Multiply(quantized.data(), count, input_scale,
+                        expected.data(), rows);
+        ASSERT_TRUE(SetInt8Kernel(GetParam()));
+
+        for (size_t i = 0; i < output.size(); i++) {
+          EXPECT_NEAR(output[i], expected[i],
+                      1e-5f * (1 + std::abs(expected[i])))
+              << rows << "x" << cols << " count " << count << " index " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(Int8MatmulTest, FullyConnectedForward) {
+  std::mt19937 gen(4);
+  for (auto rows : kRows) {
+    for (auto cols : kCols) {
+      for (auto count : kCounts) {
+        for (bool relu : {false, true}) {
+          const auto weights = RandomVector(gen, rows * cols);
+          const auto biases = RandomVector(gen, rows);
+          const auto input = RandomVector(gen, count * cols);
+          const float input_absmax = AbsMax(input);
+          const Int8FullyConnected layer(weights, cols, rows, input_absmax);
+
+          std::vector<int8_t> scratch(count * Int8Stride(cols));
+          std::vector<float> output(count * rows);
+          layer.Forward(count, input.data(), biases.data(), relu,
+                        output.data(), scratch.data());
+
+          std::vector<float> expected, tolerance;
+          Reference(weights, input, rows, cols, count, input_absmax / 127.0f,
+                    &expected, &tolerance);
+          for (size_t n = 0; n < count; n++) {
+            for (size_t r = 0; r < rows; r++) {
+              auto value = expected[n * rows + r] + biases[r];
+              if (relu) value = std::max(0.0f, value);
+              // ReLU cannot increase the error.
+              EXPECT_NEAR(output[n * rows + r], value, tolerance[n * rows + r])
+                  << rows << "x" << cols << " count " << count << " relu "
+                  << relu;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Kernels, Int8MatmulTest,
+                         ::testing::ValuesIn(kKernels));
+
+}  // namespace
+}  // namespace lczero
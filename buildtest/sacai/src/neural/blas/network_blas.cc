@@ -17,21 +17,39 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <iostream>
-
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+
+#include "chess/position.h"
 #include "neural/blas/blas.h"
 #include "neural/blas/convolution1.h"
 #include "neural/blas/fully_connected_layer.h"
+#include "neural/blas/half_matmul.h"
+#include "neural/blas/int8_matmul.h"
 #include "neural/blas/se_unit.h"
 #include "neural/blas/winograd_convolution3.h"
+#include "neural/encoder.h"
 #include "neural/factory.h"
 #include "neural/network.h"
 #include "neural/network_legacy.h"
 #include "neural/shared/activation.h"
+#include "neural/shared/expand_planes.h"
 #include "neural/shared/policy_map.h"
 #include "neural/shared/winograd_filter.h"
+#include "utils/aligned_allocator.h"
+#include "utils/numa.h"
 
 #include <Eigen/Core>
 
@@ -42,23 +60,219 @@
 namespace lczero {
 namespace {
 
+// Scratch memory for one ComputeBlocking() call. It is sized for the largest
+// batch the network accepts and recycled between computations, so evaluating
+// a batch neither allocates nor page-faults fresh buffers.
+template <bool use_eigen>
+struct BlasWorkspace {
+  BlasWorkspace(size_t max_batch_size, size_t max_channels,
+                size_t output_channels, size_t max_output_channels,
+                size_t max_fc_channels, size_t max_head_planes,
+                size_t max_se_fc_outputs, size_t int8_input_size)
+      : output_fc(max_batch_size * max_fc_channels),
+        res_buffer1(max_batch_size * max_channels * kSquares),
+        res_buffer2(max_batch_size * output_channels * kSquares),
+        res_buffer3(max_batch_size * output_channels * kSquares),
+        head_buffer(max_batch_size * max_head_planes * kSquares),
+        wdl(max_batch_size * 3),
+        moves_left(max_batch_size),
+        se_means(max_batch_size * output_channels),
+        se_fc_out(max_batch_size * max_se_fc_outputs),
+        se_scale(max_batch_size * 2 * output_channels),
+        int8_input(int8_input_size),
+        convolve3(max_batch_size, max_channels, max_output_channels) {}
+
+  static constexpr auto kSquares = 64;
+
+  AlignedVector<float> output_fc;
+  AlignedVector<float> res_buffer1;
+  AlignedVector<float> res_buffer2;
+  AlignedVector<float> res_buffer3;
+  AlignedVector<float> head_buffer;
+  AlignedVector<float> wdl;
+  AlignedVector<float> moves_left;
+  // Channel averages of the residual blocks with SE units, computed by the
+  // output transform of their second convolution.
+  AlignedVector<float> se_means;
+  // Outputs of the two fully connected layers of an SE unit.
+  AlignedVector<float> se_fc_out;
+  AlignedVector<float> se_scale;
+  // Quantized input of the INT8 fully connected layers.
+  AlignedVector<int8_t> int8_input;
+  WinogradConvolution3<use_eigen> convolve3;
+};
+
+// Largest input magnitude of each quantized layer, collected by running the
+// FP32 network over calibration positions. Convolutions are numbered input
+// first, then the residual tower, then the convolutional policy head.
+struct Int8Calibration {
+  std::vector<std::array<float, 16>> conv_absmax;
+  float policy_fc_absmax = 0.0f;
+  float value_fc_absmax = 0.0f;
+  float moves_fc_absmax = 0.0f;
+};
+
+// Layers computed in INT8. Layers not listed here (SE units, the last layer
+// of the value and moves left heads) are small and stay in FP32.
+struct Int8Weights {
+  std::vector<Int8WinogradFilter> convs;
+  Int8FullyConnected policy_fc;
+  Int8FullyConnected value_fc;
+  Int8FullyConnected moves_fc;
+};
+
+void UpdateAbsMax(const float* data, size_t size, float* absmax) {
+  for (size_t i = 0; i < size; i++) {
+    *absmax = std::max(*absmax, std::abs(data[i]));
+  }
+}
+
+// Position in the convolutional policy output of each policy index.
+const std::vector<int>& ConvPolicyPositions() {
+  static const std::vector<int> positions = [] {
+    std::vector<int> result;
+    const auto size = sizeof(kConvPolicyMap) / sizeof(kConvPolicyMap[0]);
+    for (size_t i = 0; i < size; i++) {
+      const auto j = kConvPolicyMap[i];
+      if (j < 0) continue;
+      if (result.size() <= static_cast<size_t>(j)) result.resize(j + 1, -1);
+      result[j] = static_cast<int>(i);
+    }
+    return result;
+  }();
+  return positions;
+}
+
+// Worker threads splitting the samples of a batch between them. Each worker
+// computes its partition with single-threaded BLAS, which for small matrices
+// scales much better than the multithreading inside the BLAS library.
+class BlasThreadPool {
+ public:
+  // Starts @threads workers. Worker i is pinned to core @first_core + i, or
+  // left unpinned if @first_core is negative.
+  BlasThreadPool(int threads, int first_core);
+  ~BlasThreadPool();
+
+  // Calls task(0) .. task(count - 1) and returns when all calls completed.
+  // The calling thread computes task(0) itself. If any call throws, the first
+  // exception is rethrown once all calls completed.
+  void Run(int count, const std::function<void(int)>& task);
+
+  // Number of tasks that can run at the same time, including the caller.
+  int GetParallelism() const { return static_cast<int>(threads_.size()) + 1; }
+
+ private:
+  void Worker(int core);
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::queue<std::function<void()>> queue_;
+  bool abort_ = false;
+  std::vector<std::thread> threads_;
+};
+
+BlasThreadPool::BlasThreadPool(int threads, int first_core) {
+  for (int i = 0; i < threads; i++) {
+    const int core = first_core < 0 ? -1 : first_core + i;
+    threads_.emplace_back([this, core]() { Worker(core); });
+  }
+}
+
+BlasThreadPool::~BlasThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abort_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void BlasThreadPool::Worker(int core) {
+  if (core >= 0) Numa::BindThreadToCore(core);
+#ifdef USE_DNNL
+  omp_set_num_threads(1);
+#endif
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+      if (abort_) return;
+      task = std::move(queue_.front());
+      queue_.pop();
+    }
+    task();
+  }
+}
+
+void BlasThreadPool::Run(int count, const std::function<void(int)>& task) {
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  int pending = count - 1;
+  std::exception_ptr error;
+  // Keeps the first exception of any task, to rethrow it after all tasks
+  // finished. The queued tasks reference this stack frame, so Run() must not
+  // return before @pending drops to zero.
+  const auto run_task = [&](int i) {
+    try {
+      task(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> done_lock(done_mutex);
+      if (!error) error = std::current_exception();
+    }
+  };
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 1; i < count; i++) {
+      queue_.push([&, i]() {
+        run_task(i);
+        std::lock_guard<std::mutex> done_lock(done_mutex);
+        if (--pending == 0) done_cv.notify_one();
+      });
+    }
+  }
+  cv_.notify_all();
+  run_task(0);
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [&] { return pending == 0; });
+  if (error) std::rethrow_exception(error);
+}
+
+template <bool use_eigen>
+class BlasNetwork;
+
 template <bool use_eigen>
 class BlasComputation : public NetworkComputation {
  public:
-  BlasComputation(const LegacyWeights& weights, const size_t max_batch_size,
+  BlasComputation(BlasNetwork<use_eigen>* network,
+                  const LegacyWeights& weights, const size_t max_batch_size,
                   const bool wdl, const bool moves_left,
                   const bool conv_policy);
 
   virtual ~BlasComputation() {}
 
   // Adds a sample to the batch.
-  void AddInput(InputPlanes&& input) override { planes_.emplace_back(input); }
+  void AddInput(InputPlanes&& input) override {
+    AddPackedInput(input.data(), {});
+  }
+
+  // Adds a sample whose policy is only needed for @legal_moves.
+  void AddInputWithMoves(InputPlanes&& input,
+                         std::vector<uint16_t>&& legal_moves) override {
+    AddPackedInput(input.data(), std::move(legal_moves));
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&& legal_moves) override {
+    inputs_.Add(planes);
+    legal_moves_.emplace_back(std::move(legal_moves));
+  }
 
   // Do the computation.
   void ComputeBlocking() override;
 
   // Returns how many times AddInput() was called.
-  int GetBatchSize() const override { return static_cast<int>(planes_.size()); }
+  int GetBatchSize() const override { return inputs_.size(); }
 
   // Returns Q value of @sample.
   float GetQVal(int sample) const override {
@@ -92,9 +306,15 @@ class BlasComputation : public NetworkComputation {
   float GetPVal(int sample, int move_id) const override {
     return policies_[sample][move_id];
   }
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    const float* policy = policies_[sample].data();
+    for (int i = 0; i < count; i++) output[i] = policy[move_ids[i]];
+  }
 
  private:
-  void EncodePlanes(const InputPlanes& sample, float* buffer);
+  // Computes samples [@first, @first + @count) of the batch.
+  void ComputePartition(size_t first, size_t count);
 
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
@@ -104,9 +324,12 @@ class BlasComputation : public NetworkComputation {
   // The real number of planes is higher because of padding.
   static constexpr auto kPolicyUsedPlanes = 73;
 
+  BlasNetwork<use_eigen>* network_;
   const LegacyWeights& weights_;
   size_t max_batch_size_;
-  std::vector<InputPlanes> planes_;
+  InputBatch inputs_;
+  // Policy indices computed for each sample, all of them if empty.
+  std::vector<std::vector<uint16_t>> legal_moves_;
   std::vector<std::vector<float>> policies_;
   std::vector<float> q_values_;
   std::vector<float> m_values_;
@@ -123,16 +346,45 @@ class BlasNetwork : public Network {
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
     return std::make_unique<BlasComputation<use_eigen>>(
-        weights_, max_batch_size_, wdl_, moves_left_, conv_policy_);
+        this, weights_, max_batch_size_, wdl_, moves_left_, conv_policy_);
   }
 
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
 
+  std::unique_ptr<BlasWorkspace<use_eigen>> GetWorkspace();
+  void ReleaseWorkspace(std::unique_ptr<BlasWorkspace<use_eigen>> workspace);
+
+  // Returns nullptr when batches are computed on the calling thread only.
+  BlasThreadPool* GetThreadPool() { return thread_pool_.get(); }
+  size_t GetMinSplitSize() const { return min_split_size_; }
+
+  // Returns nullptr unless the network runs in INT8.
+  const Int8Weights* GetInt8Weights() const { return int8_weights_.get(); }
+  // Returns nullptr unless the network is being calibrated.
+  Int8Calibration* GetInt8Calibration() { return int8_calibration_.get(); }
+  // Returns nullptr unless the convolutions run in FP16 or BF16.
+  const std::vector<HalfWinogradFilter>* GetHalfConvolutions() const {
+    return half_convs_.empty() ? nullptr : &half_convs_;
+  }
+
  private:
   // A cap on the max batch size since it consumes a lot of memory
   static constexpr auto kHardMaxBatchSize = 2048;
+  static constexpr auto kPolicyOutputs = 1858;
+  static constexpr auto kSquares = 64;
+  // Positions played from the start position when no calibration file is
+  // given.
+  static constexpr auto kCalibrationPositions = 256;
+
+  // Collects input ranges over the positions listed in @filename, or over
+  // random games if it's empty, and quantizes the weights with them.
+  void QuantizeInt8(const std::string& filename);
+  InputBatch GetCalibrationInputs(const std::string& filename);
+  // Converts the Winograd transformed filters to @format and releases the FP32
+  // ones.
+  void ConvertToHalf(HalfFormat format);
 
   const NetworkCapabilities capabilities_;
   LegacyWeights weights_;
@@ -140,13 +392,48 @@ class BlasNetwork : public Network {
   bool wdl_;
   bool moves_left_;
   bool conv_policy_;
+
+  // Workspaces not currently used by a computation. At most one is created
+  // for each thread computing concurrently.
+  std::mutex workspaces_lock_;
+  std::list<std::unique_ptr<BlasWorkspace<use_eigen>>> free_workspaces_;
+
+  // Splitting a batch into partitions computed in parallel. Partitions are
+  // never smaller than min_split_size_ samples, so larger values trade
+  // latency for throughput.
+  std::unique_ptr<BlasThreadPool> thread_pool_;
+  size_t min_split_size_;
+
+  std::unique_ptr<Int8Weights> int8_weights_;
+  std::unique_ptr<Int8Calibration> int8_calibration_;
+  std::vector<HalfWinogradFilter> half_convs_;
+};
+
+// Takes a workspace from the pool of @network and gives it back when going out
+// of scope, also when the computation throws.
+template <bool use_eigen>
+class ScopedWorkspace {
+ public:
+  explicit ScopedWorkspace(BlasNetwork<use_eigen>* network)
+      : network_(network), workspace_(network->GetWorkspace()) {}
+  ~ScopedWorkspace() { network_->ReleaseWorkspace(std::move(workspace_)); }
+  ScopedWorkspace(const ScopedWorkspace&) = delete;
+  ScopedWorkspace& operator=(const ScopedWorkspace&) = delete;
+
+  BlasWorkspace<use_eigen>* operator->() const { return workspace_.get(); }
+
+ private:
+  BlasNetwork<use_eigen>* const network_;
+  std::unique_ptr<BlasWorkspace<use_eigen>> workspace_;
 };
 
 template <bool use_eigen>
 BlasComputation<use_eigen>::BlasComputation(
-    const LegacyWeights& weights, const size_t max_batch_size, const bool wdl,
-    const bool moves_left, const bool conv_policy)
-    : weights_(weights),
+    BlasNetwork<use_eigen>* network, const LegacyWeights& weights,
+    const size_t max_batch_size, const bool wdl, const bool moves_left,
+    const bool conv_policy)
+    : network_(network),
+      weights_(weights),
       max_batch_size_(max_batch_size),
       policies_(0),
       q_values_(0),
@@ -160,6 +447,31 @@ BlasComputation<use_eigen>::BlasComputation(
 
 template <bool use_eigen>
 void BlasComputation<use_eigen>::ComputeBlocking() {
+  const auto plane_count = static_cast<size_t>(inputs_.size());
+  policies_.resize(plane_count);
+  q_values_.resize(wdl_ ? 3 * plane_count : plane_count);
+  if (moves_left_) m_values_.resize(plane_count);
+
+  auto* thread_pool = network_->GetThreadPool();
+  const auto min_split_size = network_->GetMinSplitSize();
+  if (!thread_pool || plane_count < 2 * min_split_size) {
+    ComputePartition(0, plane_count);
+    return;
+  }
+
+  const auto parallelism = static_cast<size_t>(thread_pool->GetParallelism());
+  const auto partition_size = std::max(
+      min_split_size, (plane_count + parallelism - 1) / parallelism);
+  const auto partitions = (plane_count + partition_size - 1) / partition_size;
+  thread_pool->Run(static_cast<int>(partitions), [&](int partition) {
+    const auto first = partition * partition_size;
+    ComputePartition(first, std::min(partition_size, plane_count - first));
+  });
+}
+
+template <bool use_eigen>
+void BlasComputation<use_eigen>::ComputePartition(size_t first,
+                                                  size_t count) {
   // Retrieve network key dimensions from the weights structure.
   const auto num_value_channels = weights_.ip1_val_b.size();
   const auto num_moves_channels = weights_.ip1_mov_b.size();
@@ -169,23 +481,6 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
   const auto num_output_policy = static_cast<size_t>(kPolicyOutputs);
   const auto output_channels = weights_.input.biases.size();
 
-  // max_channels is the maximum number of input channels of any
-  // convolution.
-  // Residual blocks are identical, but the first convolution might be bigger
-  // when the network has very few filters
-  const auto input_channels = static_cast<size_t>(kInputPlanes);
-  const auto max_channels = std::max(output_channels, input_channels);
-
-  // The policy head may increase convolution max output size.
-  const auto max_output_channels =
-      (conv_policy_ && weights_.policy.biases.size() > output_channels)
-          ? weights_.policy.biases.size()
-          : output_channels;
-
-  // Determine the largest batch for allocations.
-  const auto plane_count = planes_.size();
-  const auto largest_batch_size = std::min(max_batch_size_, plane_count);
-
   /* Typically
    input_channels = 112
    output_channels = 192
@@ -196,106 +491,148 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
    num_output_policy = 1858
    */
 
-  // Allocate data for the whole batch.
-  size_t max_fc_channels = std::max(
-      num_value_channels, std::max(num_output_policy, num_moves_channels));
-  std::vector<float> output_fc(largest_batch_size * max_fc_channels);
-
-  std::vector<float> res_buffer1(largest_batch_size * max_channels * kSquares);
-  std::vector<float> res_buffer2(largest_batch_size * output_channels *
-                                 kSquares);
-  std::vector<float> res_buffer3(largest_batch_size * output_channels *
-                                 kSquares);
-
-  WinogradConvolution3<use_eigen> convolve3(largest_batch_size, max_channels,
-                                            max_output_channels);
-
-  size_t max_head_planes =
-      std::max(num_policy_input_planes,
-               std::max(num_value_input_planes, num_moves_input_planes));
-  std::vector<float> head_buffer(largest_batch_size * max_head_planes *
-                                 kSquares);
+  // Determine the largest batch for allocations.
+  const auto largest_batch_size = std::min(max_batch_size_, count);
+
+  // Buffers for the whole batch, sized for max_batch_size_ and reused between
+  // computations.
+  ScopedWorkspace<use_eigen> workspace(network_);
+  auto& output_fc = workspace->output_fc;
+  auto& head_buffer = workspace->head_buffer;
+  auto& convolve3 = workspace->convolve3;
+  auto* int8_input = workspace->int8_input.data();
+
+  const auto* int8 = network_->GetInt8Weights();
+  auto* calibration = network_->GetInt8Calibration();
+  const auto* half_convs = network_->GetHalfConvolutions();
+  const auto convolve = [&](size_t layer, size_t batch_size,
+                            size_t input_channels, size_t output_channels,
+                            const float* input,
+                            const std::vector<float>& filter, float* output,
+                            const ConvolutionEpilogue& epilogue) {
+    if (int8) {
+      convolve3.ForwardInt8(batch_size, input_channels, output_channels, input,
+                            int8->convs[layer], output, epilogue);
+      return;
+    }
+    if (half_convs) {
+      convolve3.ForwardHalf(batch_size, input_channels, output_channels, input,
+                            (*half_convs)[layer], output, epilogue);
+      return;
+    }
+    convolve3.Forward(batch_size, input_channels, output_channels, input,
+                      filter.data(), output, epilogue);
+    if (calibration) {
+      convolve3.UpdateInputRange(batch_size, input_channels,
+                                 calibration->conv_absmax[layer].data());
+    }
+  };
 
   // These ones will rotate during the computation.
-  float* conv_in = res_buffer1.data();
-  float* conv_out = res_buffer2.data();
-  float* res = res_buffer3.data();
+  float* conv_in = workspace->res_buffer1.data();
+  float* conv_out = workspace->res_buffer2.data();
+  float* res = workspace->res_buffer3.data();
 
-  for (size_t i = 0; i < plane_count; i += largest_batch_size) {
-    const auto batch_size = std::min(plane_count - i, largest_batch_size);
-    for (size_t j = 0; j < batch_size; j++) {
-      EncodePlanes(planes_[i + j], &conv_in[j * kSquares * kInputPlanes]);
-    }
+  for (size_t i = first; i < first + count; i += largest_batch_size) {
+    const auto batch_size = std::min(first + count - i, largest_batch_size);
+    ExpandPlanes(inputs_[i], batch_size * kInputPlanes, conv_in);
 
     // Input convolution
 
-    convolve3.Forward(batch_size, kInputPlanes, output_channels, conv_in,
-                      weights_.input.weights.data(), conv_out);
-
-    BiasResidualRelu(batch_size, output_channels, conv_out,
-                     weights_.input.biases.data());
+    ConvolutionEpilogue input_epilogue;
+    input_epilogue.biases = weights_.input.biases.data();
+    input_epilogue.relu = true;
+    convolve(0, batch_size, kInputPlanes, output_channels, conv_in,
+             weights_.input.weights, conv_out, input_epilogue);
 
     // Residual tower
 
-    for (auto& residual : weights_.residual) {
+    const auto residual_blocks = weights_.residual.size();
+    for (size_t block = 0; block < residual_blocks; block++) {
+      const auto& residual = weights_.residual[block];
       const auto& conv1 = residual.conv1;
       const auto& conv2 = residual.conv2;
       const auto& se = residual.se;
 
       std::swap(conv_out, conv_in);
 
-      convolve3.Forward(batch_size, output_channels, output_channels, conv_in,
-                        conv1.weights.data(), conv_out);
-
-      BiasResidualRelu(batch_size, output_channels, &conv_out[0],
-                       conv1.biases.data());
+      ConvolutionEpilogue epilogue1;
+      epilogue1.biases = conv1.biases.data();
+      epilogue1.relu = true;
+      convolve(1 + 2 * block, batch_size, output_channels, output_channels,
+               conv_in, conv1.weights, conv_out, epilogue1);
 
       std::swap(conv_in, res);
       std::swap(conv_out, conv_in);
 
-      convolve3.Forward(batch_size, output_channels, output_channels, conv_in,
-                        conv2.weights.data(), conv_out);
-
+      // The residual is added and relu applied by the output transform, or by
+      // the SE unit when there is one.
+      ConvolutionEpilogue epilogue2;
+      epilogue2.biases = conv2.biases.data();
       if (residual.has_se) {
-        // No relu if followed by SE-unit and residual is added later
-        BiasResidualRelu(batch_size, output_channels, &conv_out[0],
-                         conv2.biases.data(), nullptr, false);
+        epilogue2.channel_means = workspace->se_means.data();
+      } else {
+        epilogue2.residual = res;
+        epilogue2.relu = true;
+      }
+      convolve(2 + 2 * block, batch_size, output_channels, output_channels,
+               conv_in, conv2.weights, conv_out, epilogue2);
 
+      if (residual.has_se) {
         std::swap(conv_out, conv_in);
 
         auto se_fc_outputs = se.b1.size();
         ApplySEUnit<use_eigen>(batch_size, output_channels, se_fc_outputs,
                                conv_in, res, se.w1.data(), se.b1.data(),
-                               se.w2.data(), se.b2.data(), conv_out);
-      } else {
-        BiasResidualRelu(batch_size, output_channels, &conv_out[0],
-                         conv2.biases.data(), res);
+                               se.w2.data(), se.b2.data(), conv_out,
+                               workspace->se_fc_out.data(),
+                               workspace->se_scale.data(),
+                               workspace->se_means.data());
       }
     }
 
+    // When the legal moves of every sample are known, only their policy is
+    // computed, directly into policies_.
+    bool sparse_policy = true;
+    for (size_t j = 0; j < batch_size; j++) {
+      if (legal_moves_[i + j].empty()) sparse_policy = false;
+    }
+
     if (conv_policy_) {
       // Need to preserve conv_out which is used for value head
-      convolve3.Forward(batch_size, output_channels, output_channels, conv_out,
-                        weights_.policy1.weights.data(), res);
-
-      BiasResidualRelu(batch_size, output_channels, &res[0],
-                       weights_.policy1.biases.data());
-
-      convolve3.Forward(batch_size, output_channels, num_policy_input_planes,
-                        res, weights_.policy.weights.data(),
-                        head_buffer.data());
-
-      BiasResidualRelu(batch_size, num_policy_input_planes,
-                       &head_buffer.data()[0], weights_.policy.biases.data(),
-                       nullptr, false);
+      ConvolutionEpilogue policy1_epilogue;
+      policy1_epilogue.biases = weights_.policy1.biases.data();
+      policy1_epilogue.relu = true;
+      convolve(1 + 2 * residual_blocks, batch_size, output_channels,
+               output_channels, conv_out, weights_.policy1.weights, res,
+               policy1_epilogue);
+
+      ConvolutionEpilogue policy_epilogue;
+      policy_epilogue.biases = weights_.policy.biases.data();
+      convolve(2 + 2 * residual_blocks, batch_size, output_channels,
+               num_policy_input_planes, res, weights_.policy.weights,
+               head_buffer.data(), policy_epilogue);
 
       // Mapping from convolutional policy to lc0 policy
-      for (auto batch = size_t{0}; batch < batch_size; batch++) {
-        for (auto i = 0; i < kPolicyUsedPlanes * kSquares; i++) {
-          auto j = kConvPolicyMap[i];
-          if (j >= 0) {
-            output_fc[batch * num_output_policy + j] =
-                head_buffer[batch * num_policy_input_planes * kSquares + i];
+      if (sparse_policy) {
+        const auto& positions = ConvPolicyPositions();
+        for (size_t j = 0; j < batch_size; j++) {
+          const float* sample =
+              &head_buffer[j * num_policy_input_planes * kSquares];
+          auto& policy = policies_[i + j];
+          policy.assign(num_output_policy, 0.0f);
+          for (const auto move : legal_moves_[i + j]) {
+            policy[move] = sample[positions[move]];
+          }
+        }
+      } else {
+        for (auto batch = size_t{0}; batch < batch_size; batch++) {
+          for (auto i = 0; i < kPolicyUsedPlanes * kSquares; i++) {
+            auto j = kConvPolicyMap[i];
+            if (j >= 0) {
+              output_fc[batch * num_output_policy + j] =
+                  head_buffer[batch * num_policy_input_planes * kSquares + i];
+            }
           }
         }
       }
@@ -308,21 +645,43 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       BiasResidualRelu(batch_size, num_policy_input_planes, &head_buffer[0],
                        weights_.policy.biases.data());
 
-      FullyConnectedLayer<use_eigen>::Forward1D(
-          batch_size, num_policy_input_planes * kSquares, num_output_policy,
-          head_buffer.data(), weights_.ip_pol_w.data(),
-          weights_.ip_pol_b.data(),
-          false,  // Relu Off
-          output_fc.data());
+      if (sparse_policy) {
+        // One dot product per legal move, instead of the whole layer.
+        const auto input_size = num_policy_input_planes * kSquares;
+        for (size_t j = 0; j < batch_size; j++) {
+          const float* sample = &head_buffer[j * input_size];
+          auto& policy = policies_[i + j];
+          policy.assign(num_output_policy, 0.0f);
+          for (const auto move : legal_moves_[i + j]) {
+            policy[move] = weights_.ip_pol_b[move] +
+                           FullyConnectedLayer<use_eigen>::Forward0D(
+                               input_size, sample,
+                               &weights_.ip_pol_w[move * input_size]);
+          }
+        }
+      } else if (int8) {
+        int8->policy_fc.Forward(batch_size, head_buffer.data(),
+                                weights_.ip_pol_b.data(), false,
+                                output_fc.data(), int8_input);
+      } else {
+        if (calibration) {
+          UpdateAbsMax(head_buffer.data(),
+                       batch_size * num_policy_input_planes * kSquares,
+                       &calibration->policy_fc_absmax);
+        }
+        FullyConnectedLayer<use_eigen>::Forward1D(
+            batch_size, num_policy_input_planes * kSquares, num_output_policy,
+            head_buffer.data(), weights_.ip_pol_w.data(),
+            weights_.ip_pol_b.data(),
+            false,  // Relu Off
+            output_fc.data());
+      }
     }
 
-    for (size_t j = 0; j < batch_size; j++) {
-      std::vector<float> policy(num_output_policy);
-
+    for (size_t j = 0; j < batch_size && !sparse_policy; j++) {
       // Get the moves
-      policy.assign(output_fc.begin() + j * num_output_policy,
-                    output_fc.begin() + (j + 1) * num_output_policy);
-      policies_.emplace_back(std::move(policy));
+      policies_[i + j].assign(output_fc.begin() + j * num_output_policy,
+                              output_fc.begin() + (j + 1) * num_output_policy);
     }
 
     // Value head
@@ -333,16 +692,27 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
     BiasResidualRelu(batch_size, num_value_input_planes, &head_buffer[0],
                      weights_.value.biases.data());
 
-    FullyConnectedLayer<use_eigen>::Forward1D(
-        batch_size, num_value_input_planes * kSquares, num_value_channels,
-        head_buffer.data(), weights_.ip1_val_w.data(),
-        weights_.ip1_val_b.data(),
-        true,  // Relu On
-        output_fc.data());
+    if (int8) {
+      int8->value_fc.Forward(batch_size, head_buffer.data(),
+                             weights_.ip1_val_b.data(), true, output_fc.data(),
+                             int8_input);
+    } else {
+      if (calibration) {
+        UpdateAbsMax(head_buffer.data(),
+                     batch_size * num_value_input_planes * kSquares,
+                     &calibration->value_fc_absmax);
+      }
+      FullyConnectedLayer<use_eigen>::Forward1D(
+          batch_size, num_value_input_planes * kSquares, num_value_channels,
+          head_buffer.data(), weights_.ip1_val_w.data(),
+          weights_.ip1_val_b.data(),
+          true,  // Relu On
+          output_fc.data());
+    }
 
     // Now get the score
     if (wdl_) {
-      std::vector<float> wdl(3 * batch_size);
+      auto& wdl = workspace->wdl;
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size, num_value_channels, 3, output_fc.data(),
           weights_.ip2_val_w.data(), weights_.ip2_val_b.data(),
@@ -350,12 +720,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
           wdl.data());
 
       for (size_t j = 0; j < batch_size; j++) {
-        std::vector<float> wdl_softmax(3);
-        SoftmaxActivation(3, &wdl[j * 3], wdl_softmax.data());
-
-        q_values_.emplace_back(wdl_softmax[0]);
-        q_values_.emplace_back(wdl_softmax[1]);
-        q_values_.emplace_back(wdl_softmax[2]);
+        SoftmaxActivation(3, &wdl[j * 3], &q_values_[3 * (i + j)]);
       }
     } else {
       for (size_t j = 0; j < batch_size; j++) {
@@ -364,7 +729,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                              &output_fc[j * num_value_channels]) +
                          weights_.ip2_val_b[0];
 
-        q_values_.emplace_back(std::tanh(winrate));
+        q_values_[i + j] = std::tanh(winrate);
       }
     }
     if (moves_left_) {
@@ -375,14 +740,25 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       BiasResidualRelu(batch_size, num_moves_input_planes, &head_buffer[0],
                        weights_.moves_left.biases.data());
 
-      FullyConnectedLayer<use_eigen>::Forward1D(
-          batch_size, num_moves_input_planes * kSquares, num_moves_channels,
-          head_buffer.data(), weights_.ip1_mov_w.data(),
-          weights_.ip1_mov_b.data(),
-          true,  // Relu On
-          output_fc.data());
+      if (int8) {
+        int8->moves_fc.Forward(batch_size, head_buffer.data(),
+                               weights_.ip1_mov_b.data(), true,
+                               output_fc.data(), int8_input);
+      } else {
+        if (calibration) {
+          UpdateAbsMax(head_buffer.data(),
+                       batch_size * num_moves_input_planes * kSquares,
+                       &calibration->moves_fc_absmax);
+        }
+        FullyConnectedLayer<use_eigen>::Forward1D(
+            batch_size, num_moves_input_planes * kSquares, num_moves_channels,
+            head_buffer.data(), weights_.ip1_mov_w.data(),
+            weights_.ip1_mov_b.data(),
+            true,  // Relu On
+            output_fc.data());
+      }
 
-      std::vector<float> output_moves_left(batch_size);
+      auto& output_moves_left = workspace->moves_left;
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size, num_moves_channels, 1, output_fc.data(),
           weights_.ip2_mov_w.data(), weights_.ip2_mov_b.data(),
@@ -390,22 +766,12 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
           output_moves_left.data());
 
       for (size_t j = 0; j < batch_size; j++) {
-        m_values_.emplace_back(output_moves_left[j]);
+        m_values_[i + j] = output_moves_left[j];
       }
     }
   }
 }
 
-template <bool use_eigen>
-void BlasComputation<use_eigen>::EncodePlanes(const InputPlanes& sample,
-                                              float* buffer) {
-  for (const InputPlane& plane : sample) {
-    const float value = plane.value;
-    for (auto i = 0; i < kSquares; i++)
-      *(buffer++) = (plane.mask & (((uint64_t)1) << i)) != 0 ? value : 0;
-  }
-}
-
 template <bool use_eigen>
 BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
                                     const OptionsDict& options)
@@ -454,10 +820,39 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
                                                        pol_channels, channels);
   }
 
+  // Calibration runs single threaded, so before the thread pool is started.
+  min_split_size_ = static_cast<size_t>(
+      std::max(1, options.GetOrDefault<int>("min_split_size", 4)));
+  const bool int8 = options.GetOrDefault<bool>("int8", false);
+  const bool fp16 = options.GetOrDefault<bool>("fp16", false);
+  const bool bf16 = options.GetOrDefault<bool>("bf16", false);
+  if (int8 + fp16 + bf16 > 1) {
+    throw Exception("Only one of int8, fp16 and bf16 can be enabled.");
+  }
+  if (int8) {
+    QuantizeInt8(options.GetOrDefault<std::string>("int8_calibration", ""));
+  }
+  if (fp16) ConvertToHalf(HalfFormat::kFp16);
+  if (bf16) ConvertToHalf(HalfFormat::kBf16);
+
+  // The thread calling ComputeBlocking() computes one of the partitions.
+  const int batch_threads = options.GetOrDefault<int>("batch_threads", 1);
+  if (batch_threads > 1) {
+    // Workers are only pinned when asked to, as several network instances
+    // (e.g. under demux or mux) would otherwise all pin to the same cores.
+    const int first_core = options.GetOrDefault<int>("first_core", -1);
+    thread_pool_ = std::make_unique<BlasThreadPool>(batch_threads - 1,
+                                                    first_core);
+  }
+
   if (use_eigen) {
     CERR << "Using Eigen version " << EIGEN_WORLD_VERSION << "."
          << EIGEN_MAJOR_VERSION << "." << EIGEN_MINOR_VERSION;
     CERR << "Eigen max batch size is " << max_batch_size_ << ".";
+    if (thread_pool_) {
+      CERR << "Eigen splits batches over " << batch_threads
+           << " threads, at least " << min_split_size_ << " samples each.";
+    }
   } else {
 #ifdef USE_OPENBLAS
     int num_procs = openblas_get_num_procs();
@@ -492,7 +887,214 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
     CERR << "BLAS vendor: Apple vecLib.";
 #endif
     CERR << "BLAS max batch size is " << max_batch_size_ << ".";
+    if (thread_pool_) {
+      CERR << "BLAS splits batches over " << batch_threads
+           << " threads, at least " << min_split_size_ << " samples each.";
+    }
+  }
+}
+
+template <bool use_eigen>
+std::unique_ptr<BlasWorkspace<use_eigen>>
+BlasNetwork<use_eigen>::GetWorkspace() {
+  {
+    std::lock_guard<std::mutex> lock(workspaces_lock_);
+    if (!free_workspaces_.empty()) {
+      auto workspace = std::move(free_workspaces_.front());
+      free_workspaces_.pop_front();
+      return workspace;
+    }
   }
+
+  const auto num_value_channels = weights_.ip1_val_b.size();
+  const auto num_moves_channels = weights_.ip1_mov_b.size();
+  const auto num_value_input_planes = weights_.value.biases.size();
+  const auto num_policy_input_planes = weights_.policy.biases.size();
+  const auto num_moves_input_planes = weights_.moves_left.biases.size();
+  const auto num_output_policy = static_cast<size_t>(kPolicyOutputs);
+  const auto output_channels = weights_.input.biases.size();
+
+  // max_channels is the maximum number of input channels of any
+  // convolution.
+  // Residual blocks are identical, but the first convolution might be bigger
+  // when the network has very few filters
+  const auto input_channels = static_cast<size_t>(kInputPlanes);
+  const auto max_channels = std::max(output_channels, input_channels);
+
+  // The policy head may increase convolution max output size.
+  const auto max_output_channels =
+      (conv_policy_ && weights_.policy.biases.size() > output_channels)
+          ? weights_.policy.biases.size()
+          : output_channels;
+
+  const auto max_fc_channels = std::max(
+      num_value_channels, std::max(num_output_policy, num_moves_channels));
+  const auto max_head_planes =
+      std::max(num_policy_input_planes,
+               std::max(num_value_input_planes, num_moves_input_planes));
+
+  size_t max_se_fc_outputs = 0;
+  for (const auto& residual : weights_.residual) {
+    if (residual.has_se) {
+      max_se_fc_outputs = std::max(max_se_fc_outputs, residual.se.b1.size());
+    }
+  }
+
+  const auto int8_input_size =
+      int8_weights_ ? max_batch_size_ * Int8Stride(max_head_planes * kSquares)
+                    : 0;
+
+  return std::make_unique<BlasWorkspace<use_eigen>>(
+      max_batch_size_, max_channels, output_channels, max_output_channels,
+      max_fc_channels, max_head_planes, max_se_fc_outputs, int8_input_size);
+}
+
+template <bool use_eigen>
+InputBatch BlasNetwork<use_eigen>::GetCalibrationInputs(
+    const std::string& filename) {
+  const auto input_format = capabilities_.input_format;
+  InputBatch inputs;
+  if (!filename.empty()) {
+    std::ifstream file(filename);
+    if (!file) throw Exception("Unable to open calibration file " + filename);
+    std::string fen;
+    while (std::getline(file, fen)) {
+      if (fen.empty()) continue;
+      ChessBoard board;
+      int rule50_ply;
+      int game_ply;
+      board.SetFromFen(fen, &rule50_ply, &game_ply);
+      PositionHistory history;
+      history.Reset(board, rule50_ply, game_ply);
+      EncodePositionForNN(input_format, history, 8, FillEmptyHistory::FEN_ONLY,
+                          nullptr, inputs.Add());
+    }
+    if (inputs.empty()) throw Exception("No positions in " + filename);
+    return inputs;
+  }
+
+  // Random games give positions of all game phases, with real history planes.
+  // The seed is fixed so that quantization is reproducible.
+  std::mt19937 gen(42);
+  PositionHistory history;
+  history.Reset(ChessBoard::kStartposBoard, 0, 1);
+  while (inputs.size() < kCalibrationPositions) {
+    EncodePositionForNN(input_format, history, 8, FillEmptyHistory::FEN_ONLY,
+                        nullptr, inputs.Add());
+    const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+    if (history.ComputeGameResult() != GameResult::UNDECIDED) {
+      history.Reset(ChessBoard::kStartposBoard, 0, 1);
+      continue;
+    }
+    std::uniform_int_distribution<size_t> dist(0, moves.size() - 1);
+    history.Append(moves[dist(gen)]);
+  }
+  return inputs;
+}
+
+template <bool use_eigen>
+void BlasNetwork<use_eigen>::QuantizeInt8(const std::string& filename) {
+  const auto inputs = GetCalibrationInputs(filename);
+
+  const auto residual_blocks = weights_.residual.size();
+  const auto conv_layers = 1 + 2 * residual_blocks + (conv_policy_ ? 2 : 0);
+  int8_calibration_ = std::make_unique<Int8Calibration>();
+  int8_calibration_->conv_absmax.resize(conv_layers);
+  for (auto& absmax : int8_calibration_->conv_absmax) absmax.fill(0.0f);
+
+  const size_t size = inputs.size();
+  for (size_t i = 0; i < size; i += max_batch_size_) {
+    auto computation = NewComputation();
+    for (size_t j = i; j < std::min(size, i + max_batch_size_); j++) {
+      computation->AddPackedInput(inputs[j], {});
+    }
+    computation->ComputeBlocking();
+  }
+
+  const auto channels = weights_.input.biases.size();
+  const auto& absmax = int8_calibration_->conv_absmax;
+  auto int8 = std::make_unique<Int8Weights>();
+  int8->convs.emplace_back(weights_.input.weights, kInputPlanes, channels,
+                           absmax[0].data());
+  for (size_t i = 0; i < residual_blocks; i++) {
+    int8->convs.emplace_back(weights_.residual[i].conv1.weights, channels,
+                             channels, absmax[1 + 2 * i].data());
+    int8->convs.emplace_back(weights_.residual[i].conv2.weights, channels,
+                             channels, absmax[2 + 2 * i].data());
+  }
+  if (conv_policy_) {
+    int8->convs.emplace_back(weights_.policy1.weights, channels, channels,
+                             absmax[1 + 2 * residual_blocks].data());
+    int8->convs.emplace_back(weights_.policy.weights, channels,
+                             weights_.policy.biases.size(),
+                             absmax[2 + 2 * residual_blocks].data());
+  } else {
+    int8->policy_fc = Int8FullyConnected(
+        weights_.ip_pol_w, weights_.policy.biases.size() * kSquares,
+        kPolicyOutputs, int8_calibration_->policy_fc_absmax);
+  }
+  int8->value_fc = Int8FullyConnected(
+      weights_.ip1_val_w, weights_.value.biases.size() * kSquares,
+      weights_.ip1_val_b.size(), int8_calibration_->value_fc_absmax);
+  if (moves_left_) {
+    int8->moves_fc = Int8FullyConnected(
+        weights_.ip1_mov_w, weights_.moves_left.biases.size() * kSquares,
+        weights_.ip1_mov_b.size(), int8_calibration_->moves_fc_absmax);
+  }
+  int8_calibration_.reset();
+  int8_weights_ = std::move(int8);
+  // Workspaces of the calibration lack the INT8 buffers.
+  free_workspaces_.clear();
+
+  // The FP32 copies are not read anymore, except ip_pol_w which the sparse
+  // policy still uses for the dot products of single moves.
+  const auto release = [](std::vector<float>* weights) {
+    std::vector<float>().swap(*weights);
+  };
+  release(&weights_.input.weights);
+  for (auto& residual : weights_.residual) {
+    release(&residual.conv1.weights);
+    release(&residual.conv2.weights);
+  }
+  if (conv_policy_) {
+    release(&weights_.policy1.weights);
+    release(&weights_.policy.weights);
+  }
+  release(&weights_.ip1_val_w);
+  if (moves_left_) release(&weights_.ip1_mov_w);
+
+  CERR << "INT8 weights calibrated on " << inputs.size()
+       << " positions, using the " << Int8KernelName() << " kernel.";
+}
+
+template <bool use_eigen>
+void BlasNetwork<use_eigen>::ConvertToHalf(HalfFormat format) {
+  const auto channels = weights_.input.biases.size();
+  const auto convert = [&](std::vector<float>* weights, size_t input_channels,
+                           size_t output_channels) {
+    half_convs_.emplace_back(format, *weights, input_channels,
+                             output_channels);
+    std::vector<float>().swap(*weights);
+  };
+  convert(&weights_.input.weights, kInputPlanes, channels);
+  for (auto& residual : weights_.residual) {
+    convert(&residual.conv1.weights, channels, channels);
+    convert(&residual.conv2.weights, channels, channels);
+  }
+  if (conv_policy_) {
+    convert(&weights_.policy1.weights, channels, channels);
+    convert(&weights_.policy.weights, channels, weights_.policy.biases.size());
+  }
+
+  CERR << "Convolutions in " << (format == HalfFormat::kFp16 ? "FP16" : "BF16")
+       << ", using the " << HalfKernelName(format) << " kernel.";
+}
+
+template <bool use_eigen>
+void BlasNetwork<use_eigen>::ReleaseWorkspace(
+    std::unique_ptr<BlasWorkspace<use_eigen>> workspace) {
+  std::lock_guard<std::mutex> lock(workspaces_lock_);
+  free_workspaces_.push_back(std::move(workspace));
 }
 
 template <bool use_eigen>
@@ -66,25 +66,27 @@ void ApplySEUnit(const size_t batch_size, const size_t channels,
                  const size_t se_fc_outputs, const float* input,
                  const float* residual, const float* weights_w1,
                  const float* weights_b1, const float* weights_w2,
-                 const float* weights_b2, float* output) {
-  std::vector<float> pool(2 * channels * batch_size);
-  std::vector<float> fc_out1(batch_size * se_fc_outputs);
-
-  global_avg_pooling(channels * batch_size, input, pool.data());
+                 const float* weights_b2, float* output, float* fc_out,
+                 float* scale, const float* input_means) {
+  if (!input_means) {
+    // The means are consumed by the first layer before @scale is written.
+    global_avg_pooling(channels * batch_size, input, scale);
+    input_means = scale;
+  }
 
   FullyConnectedLayer<use_eigen>::Forward1D(batch_size, channels, se_fc_outputs,
-                                            pool.data(), weights_w1, weights_b1,
+                                            input_means, weights_w1, weights_b1,
                                             true,  // Relu On
-                                            fc_out1.data());
+                                            fc_out);
 
   FullyConnectedLayer<use_eigen>::Forward1D(batch_size, se_fc_outputs,
-                                            2 * channels, fc_out1.data(),
-                                            weights_w2, weights_b2,
+                                            2 * channels, fc_out, weights_w2,
+                                            weights_b2,
                                             false,  // Relu Off
-                                            pool.data());
+                                            scale);
 
   // Sigmoid, scale and add residual
-  apply_se(channels, batch_size, input, residual, pool.data(), output);
+  apply_se(channels, batch_size, input, residual, scale, output);
 }
 
 template void ApplySEUnit<true>(const size_t batch_size, const size_t channels,
@@ -92,13 +94,17 @@ template void ApplySEUnit<true>(const size_t batch_size, const size_t channels,
                                 const float* residual, const float* weights_w1,
                                 const float* weights_b1,
                                 const float* weights_w2,
-                                const float* weights_b2, float* output);
+                                const float* weights_b2, float* output,
+                                float* fc_out, float* scale,
+                                const float* input_means);
 #ifdef USE_BLAS
 template void ApplySEUnit<false>(const size_t batch_size, const size_t channels,
                                  const size_t se_fc_outputs, const float* input,
                                  const float* residual, const float* weights_w1,
                                  const float* weights_b1,
                                  const float* weights_w2,
-                                 const float* weights_b2, float* output);
+                                 const float* weights_b2, float* output,
+                                 float* fc_out, float* scale,
+                                 const float* input_means);
 #endif
 }  // namespace lczero
@@ -22,11 +22,16 @@
 
 namespace lczero {
 
+// Squeeze-and-excitation, followed by the residual add and relu. The average
+// of each channel of @input is computed unless given in @input_means.
+// @fc_out (batch_size * se_fc_outputs) and @scale (batch_size * 2 * channels)
+// are scratch buffers.
 template <bool use_eigen>
 void ApplySEUnit(const size_t batch_size, const size_t channels,
                  const size_t se_fc_outputs, const float* input,
                  const float* residual, const float* weights_w1,
                  const float* weights_b1, const float* weights_w2,
-                 const float* weights_b2, float* output);
+                 const float* weights_b2, float* output, float* fc_out,
+                 float* scale, const float* input_means = nullptr);
 
 }  // namespace lczero
@@ -39,6 +39,29 @@ template <typename T>
 using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 
+Int8WinogradFilter::Int8WinogradFilter(const std::vector<float>& weights,
+                                       size_t input_channels,
+                                       size_t output_channels,
+                                       const float* input_absmax) {
+  // Element (o, k) of tile b is at b * out * in + k * out + o.
+  for (size_t b = 0; b < kWinogradTile; b++) {
+    tiles.emplace_back(&weights[b * output_channels * input_channels],
+                       output_channels, input_channels, 1, output_channels);
+    input_scales[b] = input_absmax[b] > 0.0f ? input_absmax[b] / 127.0f : 1.0f;
+  }
+}
+
+HalfWinogradFilter::HalfWinogradFilter(HalfFormat format,
+                                       const std::vector<float>& weights,
+                                       size_t input_channels,
+                                       size_t output_channels)
+    : format(format) {
+  for (size_t b = 0; b < kWinogradTile; b++) {
+    tiles.emplace_back(format, &weights[b * output_channels * input_channels],
+                       output_channels, input_channels, 1, output_channels);
+  }
+}
+
 template <bool use_eigen>
 WinogradConvolution3<use_eigen>::WinogradConvolution3(
     const size_t max_batch_size, const size_t max_input_layers,
@@ -47,15 +70,71 @@ WinogradConvolution3<use_eigen>::WinogradConvolution3(
       M_(max_batch_size * kWinogradTile * max_output_layers * kTiles) {}
 
 template <bool use_eigen>
-void WinogradConvolution3<use_eigen>::Forward(const size_t batch_size,
-                                              const size_t input_channels,
-                                              const size_t output_channels,
-                                              const float* input,
-                                              const float* weights,
-                                              float* output) {
+void WinogradConvolution3<use_eigen>::Forward(
+    const size_t batch_size, const size_t input_channels,
+    const size_t output_channels, const float* input, const float* weights,
+    float* output, const ConvolutionEpilogue& epilogue) {
   TransformIn(batch_size, input, input_channels);
   Sgemm(batch_size, weights, input_channels, output_channels);
-  TransformOut(batch_size, output, output_channels);
+  TransformOut(batch_size, output, output_channels, epilogue);
+}
+
+template <bool use_eigen>
+void WinogradConvolution3<use_eigen>::ForwardInt8(
+    const size_t batch_size, const size_t input_channels,
+    const size_t output_channels, const float* input,
+    const Int8WinogradFilter& weights, float* output,
+    const ConvolutionEpilogue& epilogue) {
+  TransformIn(batch_size, input, input_channels);
+
+  const auto vectors = batch_size * kTiles;
+  const auto size = vectors * Int8Stride(input_channels);
+  if (V8_.size() < size) V8_.resize(size);
+  for (size_t b = 0; b < kWinogradTile; b++) {
+    const auto offset_v = b * batch_size * input_channels * kTiles;
+    const auto offset_m = b * batch_size * output_channels * kTiles;
+    QuantizeVectors(&V_[offset_v], vectors, input_channels, input_channels,
+                    weights.input_scales[b], V8_.data());
+    weights.tiles[b].Multiply(V8_.data(), vectors, weights.input_scales[b],
+                              &M_[offset_m], output_channels);
+  }
+
+  TransformOut(batch_size, output, output_channels, epilogue);
+}
+
+template <bool use_eigen>
+void WinogradConvolution3<use_eigen>::ForwardHalf(
+    const size_t batch_size, const size_t input_channels,
+    const size_t output_channels, const float* input,
+    const HalfWinogradFilter& weights, float* output,
+    const ConvolutionEpilogue& epilogue) {
+  TransformIn(batch_size, input, input_channels);
+
+  const auto vectors = batch_size * kTiles;
+  const auto size = vectors * HalfStride(input_channels);
+  if (V16_.size() < size) V16_.resize(size);
+  for (size_t b = 0; b < kWinogradTile; b++) {
+    const auto offset_v = b * batch_size * input_channels * kTiles;
+    const auto offset_m = b * batch_size * output_channels * kTiles;
+    ConvertVectors(weights.format, &V_[offset_v], vectors, input_channels,
+                   input_channels, V16_.data());
+    weights.tiles[b].Multiply(V16_.data(), vectors, &M_[offset_m],
+                              output_channels);
+  }
+
+  TransformOut(batch_size, output, output_channels, epilogue);
+}
+
+template <bool use_eigen>
+void WinogradConvolution3<use_eigen>::UpdateInputRange(
+    const size_t batch_size, const size_t input_channels,
+    float* absmax) const {
+  const auto tile_size = batch_size * input_channels * kTiles;
+  for (size_t b = 0; b < kWinogradTile; b++) {
+    for (size_t i = b * tile_size; i < (b + 1) * tile_size; i++) {
+      absmax[b] = std::max(absmax[b], std::abs(V_[i]));
+    }
+  }
 }
 
 template <bool use_eigen>
@@ -258,20 +337,34 @@ void WinogradConvolution3<true>::Sgemm(const size_t batch_size,
 }
 
 template <bool use_eigen>
-void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
-                                                   float* output,
-                                                   const size_t channels) {
+void WinogradConvolution3<use_eigen>::TransformOut(
+    const size_t batch_size, float* output, const size_t channels,
+    const ConvolutionEpilogue& epilogue) {
 #ifndef USE_ISPC
 
   float m[kWinogradTile];
 
   for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
     const float* M_batch = &M_[channels * kTiles * batch_index];
-    float* output_batch = output + batch_index * kWidth * kHeight * channels;
+    const auto offset_batch = batch_index * kWidth * kHeight * channels;
 
     for (size_t channel = 0; channel < channels; channel++) {
       const float* M_channel = M_batch + channel;
-      float* output_channel = output_batch + channel * (kHeight * kWidth);
+      const auto offset_channel = offset_batch + channel * (kHeight * kWidth);
+      float* output_channel = output + offset_channel;
+      const float* residual_channel =
+          epilogue.residual ? epilogue.residual + offset_channel : nullptr;
+      const float bias = epilogue.biases ? epilogue.biases[channel] : 0.0f;
+      float sum = 0.0f;
+
+      // Adds the bias and the residual, applies relu, and sums for the mean.
+      const auto store = [&](int index, float value) {
+        value += bias;
+        if (residual_channel) value += residual_channel[index];
+        if (epilogue.relu) value = value > 0.0f ? value : 0.0f;
+        sum += value;
+        output_channel[index] = value;
+      };
 
       for (int block_x = 0; block_x < kWtiles; block_x++) {
         for (int block_y = 0; block_y < kWtiles; block_y++) {
@@ -309,12 +402,17 @@ void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
                      m[2 * 4 + 2] + m[2 * 4 + 3] - m[3 * 4 + 1] + m[3 * 4 + 2] +
                      m[3 * 4 + 3];
 
-          output_channel[(y)*kWidth + (x)] = o11;
-          output_channel[(y)*kWidth + (x + 1)] = o12;
-          output_channel[(y + 1) * kWidth + (x)] = o21;
-          output_channel[(y + 1) * kWidth + (x + 1)] = o22;
+          store((y)*kWidth + (x), o11);
+          store((y)*kWidth + (x + 1), o12);
+          store((y + 1) * kWidth + (x), o21);
+          store((y + 1) * kWidth + (x + 1), o22);
         }
       }
+
+      if (epilogue.channel_means) {
+        epilogue.channel_means[batch_index * channels + channel] =
+            sum / kSquares;
+      }
     }
   }
 
@@ -322,6 +420,24 @@ void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
 
   ispc::winograd_TransformOut_ispc(batch_size, &M_[0], channels, output);
 
+  // The ISPC transform has no epilogue, apply it in a second pass.
+  for (size_t i = 0; i < batch_size * channels; i++) {
+    const auto channel = i % channels;
+    float* output_channel = output + i * kSquares;
+    const float* residual_channel =
+        epilogue.residual ? epilogue.residual + i * kSquares : nullptr;
+    const float bias = epilogue.biases ? epilogue.biases[channel] : 0.0f;
+    float sum = 0.0f;
+    for (int j = 0; j < kSquares; j++) {
+      auto value = output_channel[j] + bias;
+      if (residual_channel) value += residual_channel[j];
+      if (epilogue.relu) value = value > 0.0f ? value : 0.0f;
+      sum += value;
+      output_channel[j] = value;
+    }
+    if (epilogue.channel_means) epilogue.channel_means[i] = sum / kSquares;
+  }
+
 #endif  // USE_ISPC
 }
 
@@ -18,11 +18,58 @@
 
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <vector>
 
+#include "neural/blas/half_matmul.h"
+#include "neural/blas/int8_matmul.h"
+#include "utils/aligned_allocator.h"
+
 namespace lczero {
 
+// Operations applied to the output of a convolution while the output transform
+// writes it, saving separate passes over the activations.
+struct ConvolutionEpilogue {
+  // Added to each output channel, if set.
+  const float* biases = nullptr;
+  // Added elementwise, laid out as the output, if set.
+  const float* residual = nullptr;
+  bool relu = false;
+  // If set, receives the mean of each output channel of each sample, as the
+  // global average pooling of an SE unit.
+  float* channel_means = nullptr;
+};
+
+// Winograd transformed 3x3 filter quantized to INT8, one matrix per element of
+// the transformed tile.
+struct Int8WinogradFilter {
+  static constexpr auto kWinogradTile = 16;
+
+  // @weights are transformed by WinogradFilterTransformF(), @input_absmax
+  // holds the largest magnitude of each element of the transformed input
+  // tiles, as collected by WinogradConvolution3::UpdateInputRange().
+  Int8WinogradFilter(const std::vector<float>& weights, size_t input_channels,
+                     size_t output_channels, const float* input_absmax);
+
+  std::vector<Int8Matrix> tiles;
+  std::array<float, kWinogradTile> input_scales;
+};
+
+// Winograd transformed 3x3 filter stored in FP16 or BF16, one matrix per
+// element of the transformed tile.
+struct HalfWinogradFilter {
+  static constexpr auto kWinogradTile = 16;
+
+  // @weights are transformed by WinogradFilterTransformF().
+  HalfWinogradFilter(HalfFormat format, const std::vector<float>& weights,
+                     size_t input_channels, size_t output_channels);
+
+  HalfFormat format;
+  std::vector<HalfMatrix> tiles;
+};
+
 // Convolution 3x3 on a 8x8 board using the Winograd algorithm.
 //
 // Ref:
@@ -47,7 +94,27 @@ class WinogradConvolution3 {
   // Forward inference, batched.
   void Forward(const size_t batch_size, const size_t input_channels,
                const size_t output_channels, const float* input,
-               const float* weights, float* output);
+               const float* weights, float* output,
+               const ConvolutionEpilogue& epilogue = {});
+
+  // Same as Forward(), with the matrix multiplications done in INT8.
+  void ForwardInt8(const size_t batch_size, const size_t input_channels,
+                   const size_t output_channels, const float* input,
+                   const Int8WinogradFilter& weights, float* output,
+                   const ConvolutionEpilogue& epilogue = {});
+
+  // Same as Forward(), with the transformed input converted to the format of
+  // @weights and the products accumulated in FP32.
+  void ForwardHalf(const size_t batch_size, const size_t input_channels,
+                   const size_t output_channels, const float* input,
+                   const HalfWinogradFilter& weights, float* output,
+                   const ConvolutionEpilogue& epilogue = {});
+
+  // Updates @absmax[b] with the largest magnitude of element b of the input
+  // tiles transformed by the last call to Forward(). Used to calibrate INT8
+  // quantization.
+  void UpdateInputRange(const size_t batch_size, const size_t input_channels,
+                        float* absmax) const;
 
  private:
   void TransformIn(const size_t batch_size, const float* input,
@@ -57,7 +124,8 @@ class WinogradConvolution3 {
              const size_t input_channels, const size_t output_channels);
 
   void TransformOut(const size_t batch_size, float* output,
-                    const size_t channels);
+                    const size_t channels,
+                    const ConvolutionEpilogue& epilogue);
 
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
@@ -69,7 +137,11 @@ class WinogradConvolution3 {
   static constexpr auto kWinogradAlpha = 4;
   static constexpr auto kWinogradTile = kWinogradAlpha * kWinogradAlpha;
 
-  std::vector<float> V_;
-  std::vector<float> M_;
+  AlignedVector<float> V_;
+  AlignedVector<float> M_;
+  // Quantized tile of V_, only allocated by ForwardInt8().
+  AlignedVector<int8_t> V8_;
+  // Tile of V_ in 16 bits, only allocated by ForwardHalf().
+  AlignedVector<uint16_t> V16_;
 };
 }  // namespace lczero
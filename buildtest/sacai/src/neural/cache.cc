@@ -27,6 +27,7 @@
 #include "neural/cache.h"
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 namespace lczero {
 CachingComputation::CachingComputation(
@@ -61,14 +62,14 @@ void CachingComputation::PopCacheHit() {
 }
 
 void CachingComputation::AddInput(
-    uint64_t hash, InputPlanes&& input,
+    uint64_t hash, const InputPlane* input,
     std::vector<uint16_t>&& probabilities_to_cache) {
   if (AddInputByHash(hash)) return;
   batch_.emplace_back();
   batch_.back().hash = hash;
   batch_.back().idx_in_parent = parent_->GetBatchSize();
   batch_.back().probabilities_to_cache = probabilities_to_cache;
-  parent_->AddInput(std::move(input));
+  parent_->AddPackedInput(input, std::move(probabilities_to_cache));
 }
 
 void CachingComputation::PopLastInputHit() {
@@ -82,6 +83,7 @@ void CachingComputation::ComputeBlocking() {
   parent_->ComputeBlocking();
 
   // Fill cache with data from NN.
+  std::vector<float> values;
   for (const auto& item : batch_) {
     if (item.idx_in_parent == -1) continue;
     auto req =
@@ -89,10 +91,12 @@ void CachingComputation::ComputeBlocking() {
     req->q = parent_->GetQVal(item.idx_in_parent);
     req->d = parent_->GetDVal(item.idx_in_parent);
     req->m = parent_->GetMVal(item.idx_in_parent);
-    int idx = 0;
-    for (auto x : item.probabilities_to_cache) {
-      req->p[idx++] =
-          std::make_pair(x, parent_->GetPVal(item.idx_in_parent, x));
+    const auto& moves = item.probabilities_to_cache;
+    values.resize(moves.size());
+    parent_->GetPVals(item.idx_in_parent, moves.data(),
+                      static_cast<int>(moves.size()), values.data());
+    for (size_t i = 0; i < moves.size(); i++) {
+      req->p[i] = std::make_pair(moves[i], values[i]);
     }
     cache_->Insert(item.hash, std::move(req));
   }
@@ -134,4 +138,14 @@ float CachingComputation::GetPVal(int sample, int move_id) const {
   return 0;
 }
 
+void CachingComputation::GetPVals(int sample, const uint16_t* move_ids,
+                                  int count, float* output) const {
+  const auto& item = batch_[sample];
+  if (item.idx_in_parent >= 0) {
+    parent_->GetPVals(item.idx_in_parent, move_ids, count, output);
+    return;
+  }
+  for (int i = 0; i < count; i++) output[i] = GetPVal(sample, move_ids[i]);
+}
+
 }  // namespace lczero
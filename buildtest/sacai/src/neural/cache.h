@@ -66,8 +66,9 @@ class CachingComputation {
   void AddInputByHash(uint64_t hash, NNCacheLock&& lock);
   // Adds a sample to the batch.
   // @hash is a hash to store/lookup it in the cache.
+  // @input is the kInputPlanes planes of the sample, only read during the call.
   // @probabilities_to_cache is which indices of policy head to store.
-  void AddInput(uint64_t hash, InputPlanes&& input,
+  void AddInput(uint64_t hash, const InputPlane* input,
                 std::vector<uint16_t>&& probabilities_to_cache);
   // Undos last AddInput. If it was a cache miss, the it's actually not removed
   // from parent's batch.
@@ -82,6 +83,9 @@ class CachingComputation {
   float GetMVal(int sample) const;
   // Returns P value @move_id of @sample.
   float GetPVal(int sample, int move_id) const;
+  // Writes P values of the @count moves @move_ids of @sample to @output.
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const;
   // Pops last input from the computation. Only allowed for inputs which were
   // cached.
   void PopCacheHit();
@@ -100,42 +100,45 @@ int ChooseTransform(const ChessBoard& board) {
   }
   return transform;
 }
-}  // namespace
 
-bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format) {
-  return input_format >=
-         pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION;
-}
-bool IsCanonicalArmageddonFormat(
-    pblczero::NetworkFormat::InputFormat input_format) {
-  return input_format ==
-             pblczero::NetworkFormat::
-                 INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON ||
-         input_format == pblczero::NetworkFormat::
-                             INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON;
-}
-bool IsHectopliesFormat(pblczero::NetworkFormat::InputFormat input_format) {
-  return input_format >=
-         pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES;
-}
-bool Is960CastlingFormat(pblczero::NetworkFormat::InputFormat input_format) {
-  return input_format >= pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE;
+uint64_t TransformMask(uint64_t v, int transform) {
+  if (v == 0 || v == ~0ULL) return v;
+  if ((transform & FlipTransform) != 0) {
+    v = ReverseBitsInBytes(v);
+  }
+  if ((transform & MirrorTransform) != 0) {
+    v = ReverseBytesInBytes(v);
+  }
+  if ((transform & TransposeTransform) != 0) {
+    v = TransposeBitsInBytes(v);
+  }
+  return v;
 }
 
-int TransformForPosition(pblczero::NetworkFormat::InputFormat input_format,
-                         const PositionHistory& history) {
-  if (!IsCanonicalFormat(input_format)) {
-    return 0;
+// Each of the transforms is its own inverse, so they are undone in reverse
+// order.
+uint64_t UntransformMask(uint64_t v, int transform) {
+  if (v == 0 || v == ~0ULL) return v;
+  if ((transform & TransposeTransform) != 0) {
+    v = TransposeBitsInBytes(v);
   }
-  const ChessBoard& board = history.Last().GetBoard();
-  return ChooseTransform(board);
+  if ((transform & MirrorTransform) != 0) {
+    v = ReverseBytesInBytes(v);
+  }
+  if ((transform & FlipTransform) != 0) {
+    v = ReverseBitsInBytes(v);
+  }
+  return v;
 }
 
-InputPlanes EncodePositionForNN(
-    pblczero::NetworkFormat::InputFormat input_format,
-    const PositionHistory& history, int history_planes,
-    FillEmptyHistory fill_empty_history, int* transform_out) {
-  InputPlanes result(kAuxPlaneBase + 8);
+// Encodes position @length - 1 of @history, as if it was the last one.
+void EncodePrefix(pblczero::NetworkFormat::InputFormat input_format,
+                  const PositionHistory& history, int length,
+                  int history_planes, FillEmptyHistory fill_empty_history,
+                  int* transform_out, InputPlane* result) {
+  static_assert(kAuxPlaneBase + 8 == kInputPlanes);
+  std::fill(result, result + kInputPlanes, InputPlane());
+  const Position& last = history.GetPositionAt(length - 1);
 
   int transform = 0;
   // Canonicalization format needs to stop early to avoid applying transform in
@@ -146,7 +149,7 @@ InputPlanes EncodePositionForNN(
   // it for the first board.
   ChessBoard::Castlings castlings;
   {
-    const ChessBoard& board = history.Last().GetBoard();
+    const ChessBoard& board = last.GetBoard();
     const bool we_are_black = board.flipped();
     if (IsCanonicalFormat(input_format)) {
       transform = ChooseTransform(board);
@@ -201,9 +204,9 @@ InputPlanes EncodePositionForNN(
       if (we_are_black) result[kAuxPlaneBase + 4].SetAll();
     }
     if (IsHectopliesFormat(input_format)) {
-      result[kAuxPlaneBase + 5].Fill(history.Last().GetRule50Ply() / 100.0f);
+      result[kAuxPlaneBase + 5].Fill(last.GetRule50Ply() / 100.0f);
     } else {
-      result[kAuxPlaneBase + 5].Fill(history.Last().GetRule50Ply());
+      result[kAuxPlaneBase + 5].Fill(last.GetRule50Ply());
     }
     // Plane kAuxPlaneBase + 6 used to be movecount plane, now it's all zeros
     // unless we need it for canonical armageddon side to move.
@@ -222,7 +225,7 @@ InputPlanes EncodePositionForNN(
       input_format == pblczero::NetworkFormat::
                           INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON;
   bool flip = false;
-  int history_idx = history.GetLength() - 1;
+  int history_idx = length - 1;
   for (int i = 0; i < std::min(history_planes, kMoveHistory);
        ++i, --history_idx) {
     const Position& position =
@@ -233,7 +236,7 @@ InputPlanes EncodePositionForNN(
     if (stop_early && board.castlings().as_int() != castlings.as_int()) break;
     // Enpassants can't be repeated, but we do need to always send the current
     // position.
-    if (stop_early && history_idx != history.GetLength() - 1 &&
+    if (stop_early && history_idx != length - 1 &&
         !board.en_passant().empty()) {
       break;
     }
@@ -250,8 +253,8 @@ InputPlanes EncodePositionForNN(
       if (history_idx > 0) flip = !flip;
       // If no capture no pawn is 0, the previous was start of game, capture or
       // pawn push, so there can't be any more repeats that are worth
-      // considering.
-      if (position.GetRule50Ply() == 0) break;
+      // considering. Filled history before the first position never repeats.
+      if (position.GetRule50Ply() == 0 || history_idx < 0) break;
       // Decrement i so it remains the same as the history_idx decrements.
       --i;
       continue;
@@ -294,22 +297,173 @@ InputPlanes EncodePositionForNN(
   if (transform != NoTransform) {
     // Transform all masks.
     for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
-      auto v = result[i].mask;
-      if (v == 0 || v == ~0ULL) continue;
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
-      }
-      result[i].mask = v;
+      result[i].mask = TransformMask(result[i].mask, transform);
     }
   }
   if (transform_out) *transform_out = transform;
+}
+
+// Encodes position @length - 1 of @history from @parent_planes, the encoding
+// of position @length - 2 with the same parameters.
+void EncodeChildPrefix(pblczero::NetworkFormat::InputFormat input_format,
+                       const PositionHistory& history, int length,
+                       int history_planes, FillEmptyHistory fill_empty_history,
+                       const InputPlane* parent_planes, int* transform_out,
+                       InputPlane* result) {
+  const int boards = std::min(history_planes, kMoveHistory);
+  // Canonical v2 skips history positions depending on repetitions, so the
+  // boards do not simply shift by one.
+  if (length < 2 || boards < 2 ||
+      input_format ==
+          pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2 ||
+      input_format == pblczero::NetworkFormat::
+                          INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON) {
+    EncodePrefix(input_format, history, length, history_planes,
+                 fill_empty_history, transform_out, result);
+    return;
+  }
+
+  // The board of the child and the auxiliary planes.
+  int transform;
+  EncodePrefix(input_format, history, length, 1, fill_empty_history,
+               &transform, result);
+  if (transform_out) *transform_out = transform;
+
+  const Position& child = history.GetPositionAt(length - 1);
+  const Position& parent = history.GetPositionAt(length - 2);
+  int parent_transform = NoTransform;
+  if (IsCanonicalFormat(input_format)) {
+    // Stops where EncodePrefix() stops early, after a zeroing move, before a
+    // castling change or before an en passant opportunity.
+    const ChessBoard& previous = parent.GetThemBoard();
+    if (child.GetRule50Ply() == 0 ||
+        previous.castlings().as_int() !=
+            child.GetBoard().castlings().as_int() ||
+        !previous.en_passant().empty()) {
+      return;
+    }
+    parent_transform = ChooseTransform(parent.GetBoard());
+  }
+
+  // The boards of the parent are seen from the other side now: ours and
+  // theirs swap and the ranks are mirrored. The oldest one drops out.
+  for (int i = 0; i + 1 < boards; i++) {
+    const InputPlane* from = parent_planes + i * kPlanesPerBoard;
+    InputPlane* to = result + (i + 1) * kPlanesPerBoard;
+    for (int j = 0; j < 12; j++) {
+      const auto mask = UntransformMask(from[j].mask, parent_transform);
+      to[j < 6 ? j + 6 : j - 6].mask =
+          TransformMask(ReverseBytesInBytes(mask), transform);
+    }
+    // Repetition plane.
+    to[12] = from[12];
+  }
+}
+
+}  // namespace
+
+bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format) {
+  return input_format >=
+         pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION;
+}
+bool IsCanonicalArmageddonFormat(
+    pblczero::NetworkFormat::InputFormat input_format) {
+  return input_format ==
+             pblczero::NetworkFormat::
+                 INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON ||
+         input_format == pblczero::NetworkFormat::
+                             INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON;
+}
+bool IsHectopliesFormat(pblczero::NetworkFormat::InputFormat input_format) {
+  return input_format >=
+         pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES;
+}
+bool Is960CastlingFormat(pblczero::NetworkFormat::InputFormat input_format) {
+  return input_format >= pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE;
+}
+
+int TransformForPosition(pblczero::NetworkFormat::InputFormat input_format,
+                         const PositionHistory& history) {
+  if (!IsCanonicalFormat(input_format)) {
+    return 0;
+  }
+  const ChessBoard& board = history.Last().GetBoard();
+  return ChooseTransform(board);
+}
+
+InputPlanes EncodePositionForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out) {
+  InputPlanes result(kInputPlanes);
+  EncodePositionForNN(input_format, history, history_planes,
+                      fill_empty_history, transform_out, result.data());
   return result;
 }
 
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         const PositionHistory& history, int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, InputPlane* result) {
+  EncodePrefix(input_format, history, history.GetLength(), history_planes,
+               fill_empty_history, transform_out, result);
+}
+
+void EncodeChildPositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                              const PositionHistory& history,
+                              int history_planes,
+                              FillEmptyHistory fill_empty_history,
+                              const InputPlane* parent_planes,
+                              int* transform_out, InputPlane* result) {
+  EncodeChildPrefix(input_format, history, history.GetLength(), history_planes,
+                    fill_empty_history, parent_planes, transform_out, result);
+}
+
+void IncrementalEncoder::Reset(int base_length) {
+  base_ = std::max(base_length - 1, 0);
+  begin_ = end_ = 0;
+}
+
+void IncrementalEncoder::Trim(int length) {
+  end_ = std::max(begin_, std::min(end_, length));
+}
+
+void IncrementalEncoder::Encode(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out,
+    InputPlane* result) {
+  const int length = history.GetLength();
+  if (input_format != input_format_ || history_planes != history_planes_ ||
+      fill_empty_history != fill_empty_history_) {
+    input_format_ = input_format;
+    history_planes_ = history_planes;
+    fill_empty_history_ = fill_empty_history;
+    begin_ = end_ = 0;
+  }
+  Trim(length);
+  if (end_ == begin_) {
+    // Nothing to start from, the base position is encoded from scratch.
+    begin_ = std::min(base_, length - 1);
+    end_ = begin_ + 1;
+    planes_.resize(kInputPlanes);
+    transforms_.resize(1);
+    EncodePrefix(input_format, history, end_, history_planes,
+                 fill_empty_history, &transforms_[0], planes_.data());
+  }
+  if (end_ < length) {
+    planes_.resize((length - begin_) * kInputPlanes);
+    transforms_.resize(length - begin_);
+    for (; end_ < length; end_++) {
+      const int idx = end_ - begin_;
+      EncodeChildPrefix(input_format, history, end_ + 1, history_planes,
+                        fill_empty_history, &planes_[(idx - 1) * kInputPlanes],
+                        &transforms_[idx], &planes_[idx * kInputPlanes]);
+    }
+  }
+  const int idx = length - 1 - begin_;
+  std::copy_n(&planes_[idx * kInputPlanes], kInputPlanes, result);
+  if (transform_out) *transform_out = transforms_[idx];
+}
+
 }  // namespace lczero
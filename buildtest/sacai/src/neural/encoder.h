@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "chess/position.h"
 #include "neural/network.h"
 #include "proto/net.pb.h"
@@ -49,6 +51,58 @@ InputPlanes EncodePositionForNN(
     const PositionHistory& history, int history_planes,
     FillEmptyHistory fill_empty_history, int* transform_out);
 
+// Same, writing the kInputPlanes planes in place, e.g. into an InputBatch.
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         const PositionHistory& history, int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, InputPlane* result);
+
+// Same, deriving the planes from @parent_planes, the encoding of the position
+// before the last one with the same parameters. The history planes of the
+// parent are reused shifted by one board, which is cheaper than encoding all
+// boards again.
+void EncodeChildPositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                              const PositionHistory& history,
+                              int history_planes,
+                              FillEmptyHistory fill_empty_history,
+                              const InputPlane* parent_planes,
+                              int* transform_out, InputPlane* result);
+
+// Encodes positions of a history that only changes at its end, e.g. along
+// search paths. The encodings of the positions are kept, so that positions
+// appended later are encoded from the one before them.
+class IncrementalEncoder {
+ public:
+  // Forgets all encodings. Encoding then starts from position @base_length - 1
+  // (or the last position, if earlier), so that the encodings of positions
+  // after it are kept for the histories sharing them.
+  void Reset(int base_length);
+
+  // Forgets the encodings of the positions from index @length on. Has to be
+  // called when the history is trimmed to @length positions, before it is
+  // extended again.
+  void Trim(int length);
+
+  // Same as EncodePositionForNN(). Positions between the last kept encoding
+  // and the last position of @history are encoded and kept on the way.
+  void Encode(pblczero::NetworkFormat::InputFormat input_format,
+              const PositionHistory& history, int history_planes,
+              FillEmptyHistory fill_empty_history, int* transform_out,
+              InputPlane* result);
+
+ private:
+  pblczero::NetworkFormat::InputFormat input_format_ =
+      pblczero::NetworkFormat::INPUT_UNKNOWN;
+  int history_planes_ = 0;
+  FillEmptyHistory fill_empty_history_ = FillEmptyHistory::NO;
+  int base_ = 0;
+  // Encodings and transforms of positions [begin_, end_) of the history.
+  int begin_ = 0;
+  int end_ = 0;
+  std::vector<InputPlane> planes_;
+  std::vector<int> transforms_;
+};
+
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format);
 bool IsCanonicalArmageddonFormat(
     pblczero::NetworkFormat::InputFormat input_format);
@@ -20,6 +20,8 @@
 
 #include <gtest/gtest.h>
 
+#include <random>
+
 namespace lczero {
 
 auto kAllSquaresMask = std::numeric_limits<std::uint64_t>::max();
@@ -531,10 +533,137 @@ TEST(EncodePositionForNN, EncodeEarlyGameFlipFormat3) {
   EXPECT_EQ(their_king_plane.value, 1.0f);
 }
 
+
+namespace {
+
+const pblczero::NetworkFormat::InputFormat kAllInputFormats[] = {
+    pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+    pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE,
+    pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION,
+    pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES,
+    pblczero::NetworkFormat::
+        INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON,
+    pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2,
+    pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON,
+};
+
+const FillEmptyHistory kAllFillModes[] = {
+    FillEmptyHistory::NO, FillEmptyHistory::FEN_ONLY, FillEmptyHistory::ALWAYS};
+
+// Start positions covering castling changes, en passant before the first
+// position and pawnless endgames, where all transforms are used.
+const char* kIncrementalFens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/ppp1pppp/8/8/3pP3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 3",
+    "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",
+    "8/8/3k4/8/8/2QK4/8/8 w - - 0 1",
+    "8/2r5/3k4/8/8/2RK4/5N2/8 b - - 11 40",
+};
+
+void ExpectSamePlanes(const InputPlane* expected, const InputPlane* actual) {
+  for (int i = 0; i < kInputPlanes; i++) {
+    EXPECT_EQ(expected[i].mask, actual[i].mask) << "plane " << i;
+    EXPECT_EQ(expected[i].value, actual[i].value) << "plane " << i;
+  }
+}
+
+// Appends a random legal move, or restarts from @fen when the history is empty
+// or the game is over.
+void AppendRandomMove(const char* fen, std::mt19937* gen,
+                      PositionHistory* history) {
+  MoveList moves;
+  if (history->GetLength() > 0) {
+    moves = history->Last().GetBoard().GenerateLegalMoves();
+  }
+  if (moves.empty() || history->Last().GetRule50Ply() >= 100 ||
+      history->GetLength() > 200) {
+    ChessBoard board;
+    int rule50_ply;
+    int game_ply;
+    board.SetFromFen(fen, &rule50_ply, &game_ply);
+    history->Reset(board, rule50_ply, game_ply);
+    return;
+  }
+  std::uniform_int_distribution<size_t> dist(0, moves.size() - 1);
+  history->Append(moves[dist(*gen)]);
+}
+
+}  // namespace
+
+TEST(EncodePositionForNN, EncodeChildMatchesFullEncoding) {
+  std::mt19937 gen(7);
+  for (const auto format : kAllInputFormats) {
+    for (const auto fill : kAllFillModes) {
+      for (const char* fen : kIncrementalFens) {
+        PositionHistory history;
+        AppendRandomMove(fen, &gen, &history);
+        for (int ply = 0; ply < 150; ply++) {
+          const auto parent = EncodePositionForNN(format, history, 8, fill,
+                                                  nullptr);
+          AppendRandomMove(fen, &gen, &history);
+          if (history.GetLength() < 2) continue;
+          int expected_transform;
+          const auto expected = EncodePositionForNN(format, history, 8, fill,
+                                                    &expected_transform);
+          int transform;
+          InputPlanes planes(kInputPlanes);
+          EncodeChildPositionForNN(format, history, 8, fill, parent.data(),
+                                   &transform, planes.data());
+          EXPECT_EQ(expected_transform, transform);
+          ExpectSamePlanes(expected.data(), planes.data());
+          if (HasFailure()) {
+            FAIL() << "format " << format << " fill "
+                   << static_cast<int>(fill) << " fen " << fen << " ply "
+                   << ply;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(EncodePositionForNN, IncrementalEncoderFollowsPaths) {
+  std::mt19937 gen(11);
+  for (const auto format : kAllInputFormats) {
+    for (const char* fen : kIncrementalFens) {
+      IncrementalEncoder encoder;
+      PositionHistory history;
+      AppendRandomMove(fen, &gen, &history);
+      for (int step = 0; step < 200; step++) {
+        // Walks a tree: goes back a few plies now and then, as search does
+        // between leaves.
+        if (history.GetLength() > 3 && gen() % 3 == 0) {
+          history.Trim(history.GetLength() - 1 - gen() % 3);
+          encoder.Trim(history.GetLength());
+        }
+        AppendRandomMove(fen, &gen, &history);
+        if (history.GetLength() == 1) encoder.Reset(1);
+        // Encoding starts from the current position from time to time, as
+        // for a new search.
+        if (step % 50 == 25) encoder.Reset(history.GetLength());
+        // Some positions are skipped, so that several are encoded at once.
+        if (gen() % 4 == 0) continue;
+        int expected_transform;
+        const auto expected = EncodePositionForNN(
+            format, history, 8, FillEmptyHistory::FEN_ONLY,
+            &expected_transform);
+        int transform;
+        InputPlanes planes(kInputPlanes);
+        encoder.Encode(format, history, 8, FillEmptyHistory::FEN_ONLY,
+                       &transform, planes.data());
+        EXPECT_EQ(expected_transform, transform);
+        ExpectSamePlanes(expected.data(), planes.data());
+        if (HasFailure()) {
+          FAIL() << "format " << format << " fen " << fen << " step " << step;
+        }
+      }
+    }
+  }
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
@@ -109,18 +109,21 @@ bool NetworkFactory::BackendConfiguration::operator==(
           backend_options == other.backend_options);
 }
 
+std::string NetworkFactory::GetWeightsPath(const OptionsDict& options) {
+  const std::string net_path = options.Get<std::string>(kWeightsId);
+  if (net_path == kAutoDiscover) return DiscoverWeightsFile();
+  if (net_path == kEmbed) return CommandLine::BinaryName();
+  return net_path;
+}
+
 std::unique_ptr<Network> NetworkFactory::LoadNetwork(
     const OptionsDict& options) {
-  std::string net_path = options.Get<std::string>(kWeightsId);
+  const std::string net_path = GetWeightsPath(options);
   const std::string backend = options.Get<std::string>(kBackendId);
   const std::string backend_options =
       options.Get<std::string>(kBackendOptionsId);
 
-  if (net_path == kAutoDiscover) {
-    net_path = DiscoverWeightsFile();
-  } else if (net_path == kEmbed) {
-    net_path = CommandLine::BinaryName();
-  } else {
+  if (options.Get<std::string>(kWeightsId) == net_path) {
     CERR << "Loading weights file from: " << net_path;
   }
   std::optional<WeightsFile> weights;
@@ -70,6 +70,10 @@ class NetworkFactory {
   // if no network options changed since the previous call.
   static std::unique_ptr<Network> LoadNetwork(const OptionsDict& options);
 
+  // Returns the weights file name the options refer to, with autodiscovery
+  // and embedded weights resolved. Empty if there are no weights.
+  static std::string GetWeightsPath(const OptionsDict& options);
+
   // Parameter IDs.
   static const OptionId kWeightsId;
   static const OptionId kBackendId;
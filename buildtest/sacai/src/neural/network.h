@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -52,11 +53,63 @@ struct InputPlane {
 };
 using InputPlanes = std::vector<InputPlane>;
 
+// Input planes of a batch of samples, kInputPlanes planes per sample back to
+// back in a single buffer. The buffer is kept when cleared, so that a batch
+// reused for every computation does not allocate once it has grown.
+class InputBatch {
+ public:
+  // Appends a sample with all planes cleared and returns its planes, to be
+  // filled in place.
+  InputPlane* Add() {
+    planes_.resize(planes_.size() + kInputPlanes);
+    return &planes_[planes_.size() - kInputPlanes];
+  }
+  // Appends a copy of the kInputPlanes planes at @planes.
+  void Add(const InputPlane* planes) {
+    planes_.insert(planes_.end(), planes, planes + kInputPlanes);
+  }
+  // Sets the number of samples, keeping the planes of the first ones. Added
+  // samples have all planes cleared.
+  void Resize(int samples) { planes_.resize(samples * kInputPlanes); }
+  void Reserve(int samples) { planes_.reserve(samples * kInputPlanes); }
+  void Clear() { planes_.clear(); }
+
+  int size() const { return static_cast<int>(planes_.size() / kInputPlanes); }
+  bool empty() const { return planes_.empty(); }
+  // Planes of @sample. Pointers are invalidated when samples are added.
+  InputPlane* operator[](int sample) {
+    return &planes_[sample * kInputPlanes];
+  }
+  const InputPlane* operator[](int sample) const {
+    return &planes_[sample * kInputPlanes];
+  }
+
+ private:
+  std::vector<InputPlane> planes_;
+};
+
 // An interface to implement by computing backends.
 class NetworkComputation {
  public:
   // Adds a sample to the batch.
   virtual void AddInput(InputPlanes&& input) = 0;
+  // Same as AddInput(), also passing the policy indices of the legal moves of
+  // the sample. Backends may then compute the policy of these moves only, and
+  // GetPVal() of other moves becomes unspecified. An empty list means that
+  // the whole policy is needed.
+  virtual void AddInputWithMoves(InputPlanes&& input,
+                                 std::vector<uint16_t>&& /* legal_moves */) {
+    AddInput(std::move(input));
+  }
+  // Same as AddInputWithMoves(), for a sample given as the kInputPlanes planes
+  // at @planes, e.g. a sample of an InputBatch. The planes are only read
+  // during the call. Backends with a packed input buffer of their own
+  // override this to copy into it without allocating.
+  virtual void AddPackedInput(const InputPlane* planes,
+                              std::vector<uint16_t>&& legal_moves) {
+    AddInputWithMoves(InputPlanes(planes, planes + kInputPlanes),
+                      std::move(legal_moves));
+  }
   // Do the computation.
   virtual void ComputeBlocking() = 0;
   // Returns how many times AddInput() was called.
@@ -66,6 +119,13 @@ class NetworkComputation {
   virtual float GetDVal(int sample) const = 0;
   // Returns P value @move_id of @sample.
   virtual float GetPVal(int sample, int move_id) const = 0;
+  // Writes the P values of the @count moves @move_ids of @sample to @output,
+  // same as GetPVal() for each of them. Wrappers forward the whole list in one
+  // call and backends override it with a plain gather.
+  virtual void GetPVals(int sample, const uint16_t* move_ids, int count,
+                        float* output) const {
+    for (int i = 0; i < count; i++) output[i] = GetPVal(sample, move_ids[i]);
+  }
   virtual float GetMVal(int sample) const = 0;
   virtual ~NetworkComputation() = default;
 };
@@ -63,10 +63,13 @@ class CheckComputation : public NetworkComputation {
         check_comp_(std::move(check_comp)) {}
 
   void AddInput(InputPlanes&& input) override {
-    InputPlanes x = input;
-    InputPlanes y = input;
-    work_comp_->AddInput(std::move(x));
-    check_comp_->AddInput(std::move(y));
+    AddPackedInput(input.data(), {});
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&&) override {
+    work_comp_->AddPackedInput(planes, {});
+    check_comp_->AddPackedInput(planes, {});
   }
 
   void ComputeBlocking() override {
@@ -105,6 +108,11 @@ class CheckComputation : public NetworkComputation {
     return work_comp_->GetPVal(sample, move_id);
   }
 
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    work_comp_->GetPVals(sample, move_ids, count, output);
+  }
+
  private:
   static constexpr int kNumOutputPolicies = 1858;
   const CheckParams& params_;
@@ -172,13 +180,17 @@ class CheckComputation : public NetworkComputation {
     histogram.Dump();
   }
 
-  // Compute maximum absolute/relative errors.
+  // Compute maximum absolute/relative errors, and the mean absolute error.
   struct MaximumError {
     double max_absolute_error = 0;
     double max_relative_error = 0;
+    double sum_absolute_error = 0;
+    int count = 0;
 
     void Add(double a, double b) {
       const double absolute_error = GetAbsoluteError(a, b);
+      sum_absolute_error += absolute_error;
+      count++;
       if (absolute_error > max_absolute_error) {
         max_absolute_error = absolute_error;
       }
@@ -191,7 +203,9 @@ class CheckComputation : public NetworkComputation {
     void Dump(const char* name) {
       CERR << std::scientific << std::setprecision(1) << name
            << ": absolute: " << max_absolute_error
-           << ", relative: " << max_relative_error << ".";
+           << ", relative: " << max_relative_error
+           << ", mean absolute: " << (count ? sum_absolute_error / count : 0)
+           << ".";
     }
 
     static double GetRelativeError(double a, double b) {
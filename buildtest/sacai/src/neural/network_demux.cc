@@ -25,7 +25,11 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <limits>
+#include <numeric>
 #include <queue>
 #include <thread>
 
@@ -41,34 +45,50 @@ class DemuxingComputation : public NetworkComputation {
  public:
   DemuxingComputation(DemuxingNetwork* network) : network_(network) {}
 
-  void AddInput(InputPlanes&& input) override { planes_.emplace_back(input); }
+  void AddInput(InputPlanes&& input) override {
+    AddPackedInput(input.data(), {});
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         std::vector<uint16_t>&& legal_moves) override {
+    AddPackedInput(input.data(), std::move(legal_moves));
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&& legal_moves) override {
+    inputs_.Add(planes);
+    legal_moves_.emplace_back(std::move(legal_moves));
+  }
 
   void ComputeBlocking() override;
 
-  int GetBatchSize() const override { return planes_.size(); }
+  int GetBatchSize() const override { return inputs_.size(); }
 
   float GetQVal(int sample) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetQVal(offset);
+    const int idx = SplitOf(sample);
+    return parents_[idx]->GetQVal(sample - split_starts_[idx]);
   }
 
   float GetDVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetDVal(offset);
+    const int idx = SplitOf(sample);
+    return parents_[idx]->GetDVal(sample - split_starts_[idx]);
   }
 
   float GetMVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetMVal(offset);
+    const int idx = SplitOf(sample);
+    return parents_[idx]->GetMVal(sample - split_starts_[idx]);
   }
 
   float GetPVal(int sample, int move_id) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetPVal(offset, move_id);
+    const int idx = SplitOf(sample);
+    return parents_[idx]->GetPVal(sample - split_starts_[idx], move_id);
+  }
+
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    const int idx = SplitOf(sample);
+    parents_[idx]->GetPVals(sample - split_starts_[idx], move_ids, count,
+                            output);
   }
 
   void NotifyComplete() {
@@ -79,33 +99,47 @@ class DemuxingComputation : public NetworkComputation {
     }
   }
 
-  NetworkComputation* AddParentFromNetwork(Network* network) {
+  // Creates the computation of split @idx in @network.
+  NetworkComputation* AddParentFromNetwork(Network* network, int idx) {
     std::unique_lock<std::mutex> lock(mutex_);
-    parents_.emplace_back(network->NewComputation());
-    const int cur_idx = (parents_.size() - 1) * partial_size_;
-    for (int i = cur_idx; i < std::min(GetBatchSize(), cur_idx + partial_size_);
-         i++) {
-      parents_.back()->AddInput(std::move(planes_[i]));
+    parents_[idx] = network->NewComputation();
+    for (int i = split_starts_[idx]; i < split_starts_[idx + 1]; i++) {
+      parents_[idx]->AddPackedInput(inputs_[i], std::move(legal_moves_[i]));
     }
-    return parents_.back().get();
+    return parents_[idx].get();
   }
 
  private:
-  std::vector<InputPlanes> planes_;
+  int SplitOf(int sample) const {
+    return std::upper_bound(split_starts_.begin(), split_starts_.end(),
+                            sample) -
+           split_starts_.begin() - 1;
+  }
+
+  InputBatch inputs_;
+  std::vector<std::vector<uint16_t>> legal_moves_;
   DemuxingNetwork* network_;
   std::vector<std::unique_ptr<NetworkComputation>> parents_;
+  // Split i covers samples [split_starts_[i], split_starts_[i + 1]).
+  std::vector<int> split_starts_;
 
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
   int dataready_ = 0;
-  int partial_size_ = 0;
 };
 
 class DemuxingNetwork : public Network {
  public:
+  // A part of a batch to compute in a given child.
+  struct Split {
+    int child;
+    int size;
+  };
+
   DemuxingNetwork(const std::optional<WeightsFile>& weights,
                   const OptionsDict& options) {
     minimum_split_size_ = options.GetOrDefault<int>("minimum-split-size", 0);
+    probe_interval_ = options.GetOrDefault<int>("probe-interval", 64);
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -125,17 +159,20 @@ class DemuxingNetwork : public Network {
     const int nn_threads = opts.GetOrDefault<int>("threads", 1);
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+    children_.emplace_back(std::make_unique<Child>());
+    Child* child = children_.back().get();
+    child->network = NetworkFactory::Get()->Create(backend, weights, opts);
 
-    if (networks_.size() == 1) {
-      capabilities_ = networks_.back()->GetCapabilities();
+    if (children_.size() == 1) {
+      capabilities_ = child->network->GetCapabilities();
     } else {
-      capabilities_.Merge(networks_.back()->GetCapabilities());
+      capabilities_.Merge(child->network->GetCapabilities());
     }
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back([this, i]() { Worker(i); });
+      worker_children_.push_back(children_.size() - 1);
+      const int id = threads_.size();
+      threads_.emplace_back([this, child, id]() { Worker(child, id); });
     }
   }
 
@@ -147,51 +184,190 @@ class DemuxingNetwork : public Network {
     return capabilities_;
   }
 
-  void Enqueue(DemuxingComputation* computation) {
+  // Splits a batch of @batch_size samples over the workers, in proportion to
+  // the measured throughput of their children. Children not measured yet are
+  // assumed to be as fast as the fastest one, and are used first. A child left
+  // out of probe-interval batches in a row gets a probe part, so that its rate
+  // is measured again.
+  std::vector<Split> SplitBatch(int batch_size) {
+    std::vector<double> rates(worker_children_.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < rates.size(); i++) {
+        rates[i] = children_[worker_children_[i]]->throughput;
+      }
+    }
+    const double fastest = *std::max_element(rates.begin(), rates.end());
+    std::vector<int> order(rates.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return (rates[a] == 0.0 ? kUnmeasured : rates[a]) >
+             (rates[b] == 0.0 ? kUnmeasured : rates[b]);
+    });
+    for (auto& rate : rates) {
+      if (rate == 0.0) rate = fastest > 0.0 ? fastest : 1.0;
+    }
+
+    int parts = order.size();
+    if (minimum_split_size_ > 0) {
+      parts = std::max(1, std::min(parts, batch_size / minimum_split_size_));
+    }
+    parts = std::min(parts, batch_size);
+    std::vector<Split> splits;
+    while (true) {
+      splits = SplitProportionally(batch_size, order, parts, rates);
+      // Give up on the slowest worker if its share got too small.
+      if (parts == 1 ||
+          splits.back().size >= std::max(1, minimum_split_size_)) {
+        break;
+      }
+      --parts;
+    }
+
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    AddProbe(batch_size, &splits);
+    for (auto& child : children_) child->idle_batches++;
+    for (const auto& split : splits) children_[split.child]->idle_batches = 0;
+    return splits;
+  }
+
+  void Enqueue(DemuxingComputation* computation, int child, int idx) {
+    Child* c = children_[child].get();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      c->queue.push({computation, idx});
+    }
+    c->cv.notify_one();
   }
 
   ~DemuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyComplete();
-      queue_.pop();
+    for (auto& child : children_) {
+      while (!child->queue.empty()) {
+        child->queue.front().computation->NotifyComplete();
+        child->queue.pop();
+      }
     }
   }
 
-  void Worker(int id) {
+ private:
+  struct Task {
+    DemuxingComputation* computation;
+    int idx;
+  };
+
+  struct Child {
+    std::unique_ptr<Network> network;
+    std::queue<Task> queue;
+    std::condition_variable cv;
+    // Moving average of samples per second of one worker, 0 until measured.
+    double throughput = 0.0;
+    // Calls computed so far. The first one includes the warm-up of the
+    // backend, and is not measured.
+    int calls = 0;
+    // Batches split in a row without a part for this child.
+    int idle_batches = 0;
+    // The child got a probe part, whose rate replaces the stale average.
+    bool probing = false;
+  };
+
+  // Takes a probe part from the largest split for the child idle the longest,
+  // if it has been idle for probe_interval_ batches. The part is an even share
+  // of the batch, as the rate of a call depends on its size. Called with the
+  // mutex held.
+  void AddProbe(int batch_size, std::vector<Split>* splits) {
+    if (probe_interval_ <= 0) return;
+    int idlest = -1;
+    for (size_t i = 0; i < children_.size(); i++) {
+      if (children_[i]->idle_batches + 1 < probe_interval_) continue;
+      // Children without worker threads never compute anything.
+      if (std::find(worker_children_.begin(), worker_children_.end(),
+                    static_cast<int>(i)) == worker_children_.end()) {
+        continue;
+      }
+      if (idlest < 0 ||
+          children_[i]->idle_batches > children_[idlest]->idle_batches) {
+        idlest = i;
+      }
+    }
+    if (idlest < 0) return;
+    const int min_size = std::max(1, minimum_split_size_);
+    auto& largest = splits->front();
+    const int size = std::min<int>(
+        std::max<int>(min_size, batch_size / worker_children_.size()),
+        largest.size - min_size);
+    // The batch is too small to spare a part, try again with the next one.
+    if (size < min_size) return;
+    largest.size -= size;
+    splits->push_back({idlest, size});
+    children_[idlest]->probing = true;
+  }
+
+  // Shares @batch_size among the first @parts workers of @order, largest
+  // remainders first, sorted by decreasing size.
+  std::vector<Split> SplitProportionally(int batch_size,
+                                         const std::vector<int>& order,
+                                         int parts,
+                                         const std::vector<double>& rates) {
+    double total_rate = 0.0;
+    for (int i = 0; i < parts; i++) total_rate += rates[order[i]];
+    std::vector<Split> splits;
+    std::vector<std::pair<double, int>> remainders;
+    int assigned = 0;
+    for (int i = 0; i < parts; i++) {
+      const double share = batch_size * rates[order[i]] / total_rate;
+      splits.push_back({worker_children_[order[i]], static_cast<int>(share)});
+      remainders.emplace_back(share - splits.back().size, i);
+      assigned += splits.back().size;
+    }
+    std::stable_sort(remainders.begin(), remainders.end(),
+                     [](const auto& a, const auto& b) { return a > b; });
+    for (int i = 0; assigned < batch_size; i++, assigned++) {
+      splits[remainders[i].second].size++;
+    }
+    std::stable_sort(
+        splits.begin(), splits.end(),
+        [](const Split& a, const Split& b) { return a.size > b.size; });
+    return splits;
+  }
+
+  void Worker(Child* child, int id) {
     // Add one to the id in order to leave space for an active search thread.
     Numa::BindThread(id + 1);
     // While Abort() is not called (and it can only be called from destructor).
-    while (!abort_) {
+    while (true) {
+      Task task;
       {
-        {
-          std::unique_lock<std::mutex> lock(mutex_);
-          // Wait until there's come work to compute.
-          cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-          if (abort_) break;
-        }
-
-        // While there is a work in queue, process it.
-        while (true) {
-          DemuxingComputation* to_notify;
-          {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (queue_.empty()) break;
-            to_notify = queue_.front();
-            queue_.pop();
-          }
-          long long net_idx = ++(counter_) % networks_.size();
-          NetworkComputation* to_compute =
-              to_notify->AddParentFromNetwork(networks_[net_idx].get());
-          to_compute->ComputeBlocking();
-          to_notify->NotifyComplete();
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Wait until there's some work to compute.
+        child->cv.wait(lock, [&] { return abort_ || !child->queue.empty(); });
+        if (abort_) break;
+        task = child->queue.front();
+        child->queue.pop();
+      }
+      NetworkComputation* to_compute =
+          task.computation->AddParentFromNetwork(child->network.get(),
+                                                 task.idx);
+      const auto start = std::chrono::steady_clock::now();
+      to_compute->ComputeBlocking();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      const double rate = to_compute->GetBatchSize() / std::max(seconds, 1e-9);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (child->calls++ == 0) {
+          // Warm-up, not representative.
+        } else if (child->throughput == 0.0 || child->probing) {
+          child->throughput = rate;
+          child->probing = false;
+        } else {
+          child->throughput += kThroughputDecay * (rate - child->throughput);
         }
       }
+      task.computation->NotifyComplete();
     }
   }
 
@@ -200,7 +376,7 @@ class DemuxingNetwork : public Network {
       std::lock_guard<std::mutex> lock(mutex_);
       abort_ = true;
     }
-    cv_.notify_all();
+    for (auto& child : children_) child->cv.notify_all();
   }
 
   void Wait() {
@@ -210,32 +386,36 @@ class DemuxingNetwork : public Network {
     }
   }
 
-  std::vector<std::unique_ptr<Network>> networks_;
+  static constexpr double kThroughputDecay = 0.1;
+  static constexpr double kUnmeasured = std::numeric_limits<double>::max();
+
+  std::vector<std::unique_ptr<Child>> children_;
+  // Index of the child each worker thread computes with.
+  std::vector<int> worker_children_;
   NetworkCapabilities capabilities_;
-  std::queue<DemuxingComputation*> queue_;
   int minimum_split_size_ = 0;
-  std::atomic<long long> counter_;
+  int probe_interval_ = 0;
   bool abort_ = false;
 
   std::mutex mutex_;
-  std::condition_variable cv_;
 
   std::vector<std::thread> threads_;
 };
 
 void DemuxingComputation::ComputeBlocking() {
   if (GetBatchSize() == 0) return;
-  partial_size_ = (GetBatchSize() + network_->threads_.size() - 1) /
-                  network_->threads_.size();
-  if (partial_size_ < network_->minimum_split_size_) {
-    partial_size_ = std::min(GetBatchSize(), network_->minimum_split_size_);
-  }
-  const int splits = (GetBatchSize() + partial_size_ - 1) / partial_size_;
+  const auto splits = network_->SplitBatch(GetBatchSize());
 
   std::unique_lock<std::mutex> lock(mutex_);
-  dataready_ = splits;
-  for (int j = 0; j < splits; j++) {
-    network_->Enqueue(this);
+  parents_.clear();
+  parents_.resize(splits.size());
+  split_starts_.assign(1, 0);
+  for (const auto& split : splits) {
+    split_starts_.push_back(split_starts_.back() + split.size);
+  }
+  dataready_ = splits.size();
+  for (size_t j = 0; j < splits.size(); j++) {
+    network_->Enqueue(this, splits[j].child, j);
   }
   dataready_cv_.wait(lock, [this]() { return dataready_ == 0; });
 }
@@ -0,0 +1,165 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "src/neural/factory.h"
+
+namespace lczero {
+namespace {
+
+// Samples computed by each timed backend, by name.
+std::mutex counts_mutex;
+std::map<std::string, int> sample_counts;
+
+int SampleCount(const std::string& name) {
+  std::lock_guard<std::mutex> lock(counts_mutex);
+  return sample_counts[name];
+}
+
+// Backend taking @sample_us per sample. Its first @slow_calls calls take
+// @slow_ms longer, like a backend warming up.
+class TimedNetwork : public Network {
+ public:
+  TimedNetwork(const OptionsDict& options)
+      : name_(options.Get<std::string>("name")),
+        sample_us_(options.GetOrDefault<int>("sample_us", 20)),
+        slow_ms_(options.GetOrDefault<int>("slow_ms", 0)),
+        slow_calls_(options.GetOrDefault<int>("slow_calls", 0)) {
+    capabilities_.input_format =
+        pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE;
+    capabilities_.moves_left = pblczero::NetworkFormat::MOVES_LEFT_NONE;
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<Computation>(this);
+  }
+
+ private:
+  class Computation : public NetworkComputation {
+   public:
+    Computation(TimedNetwork* network) : network_(network) {}
+    void AddInput(InputPlanes&&) override { batch_size_++; }
+    void ComputeBlocking() override { network_->Compute(batch_size_); }
+    int GetBatchSize() const override { return batch_size_; }
+    float GetQVal(int) const override { return 0.0f; }
+    float GetDVal(int) const override { return 0.0f; }
+    float GetPVal(int, int) const override { return 0.0f; }
+    float GetMVal(int) const override { return 0.0f; }
+
+   private:
+    TimedNetwork* network_;
+    int batch_size_ = 0;
+  };
+
+  void Compute(int batch_size) {
+    auto duration = std::chrono::microseconds(sample_us_ * batch_size);
+    if (calls_++ < slow_calls_) duration += std::chrono::milliseconds(slow_ms_);
+    std::this_thread::sleep_for(duration);
+    std::lock_guard<std::mutex> lock(counts_mutex);
+    sample_counts[name_] += batch_size;
+  }
+
+  const std::string name_;
+  const int sample_us_;
+  const int slow_ms_;
+  const int slow_calls_;
+  std::atomic<int> calls_{0};
+  NetworkCapabilities capabilities_;
+};
+
+std::unique_ptr<Network> MakeTimedNetwork(const std::optional<WeightsFile>&,
+                                          const OptionsDict& options) {
+  return std::make_unique<TimedNetwork>(options);
+}
+
+REGISTER_NETWORK("demuxtest", MakeTimedNetwork, -1000000)
+
+// Computes a batch of @batch_size and returns the samples each child got.
+std::pair<int, int> ComputeBatch(Network* network, int batch_size,
+                                 const std::string& a, const std::string& b) {
+  const int a_before = SampleCount(a);
+  const int b_before = SampleCount(b);
+  auto computation = network->NewComputation();
+  for (int i = 0; i < batch_size; i++) {
+    computation->AddInput(InputPlanes(kInputPlanes));
+  }
+  computation->ComputeBlocking();
+  return {SampleCount(a) - a_before, SampleCount(b) - b_before};
+}
+
+OptionsDict DemuxOptions(int slow_calls) {
+  OptionsDict options;
+  options.Set<int>("minimum-split-size", 8);
+  options.Set<int>("probe-interval", 4);
+  for (const std::string& name : {"steady", "warming"}) {
+    auto* child = options.AddSubdict(name);
+    child->Set<std::string>("backend", "demuxtest");
+    child->Set<std::string>("name", name + std::to_string(slow_calls));
+    if (name == "warming") {
+      child->Set<int>("slow_ms", 100);
+      child->Set<int>("slow_calls", slow_calls);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+// The first call of a child is not measured, so its warm-up does not count.
+TEST(DemuxNetwork, IgnoresWarmUp) {
+  auto network = NetworkFactory::Get()->Create("demux", {}, DemuxOptions(1));
+  ComputeBatch(network.get(), 64, "steady1", "warming1");
+  for (int i = 0; i < 10; i++) {
+    const auto counts = ComputeBatch(network.get(), 64, "steady1", "warming1");
+    EXPECT_GT(counts.first, 0);
+    EXPECT_GT(counts.second, 0);
+  }
+}
+
+// A child measured while slow is left out, but the probes measure it again
+// and it comes back once it got fast.
+TEST(DemuxNetwork, SlowChildComesBack) {
+  auto network = NetworkFactory::Get()->Create("demux", {}, DemuxOptions(3));
+  int left_out = 0;
+  for (int i = 0; i < 10; i++) {
+    const auto counts = ComputeBatch(network.get(), 64, "steady3", "warming3");
+    if (counts.second == 0) left_out++;
+  }
+  EXPECT_GT(left_out, 0);
+  for (int i = 0; i < 20; i++) {
+    ComputeBatch(network.get(), 64, "steady3", "warming3");
+  }
+  for (int i = 0; i < 5; i++) {
+    const auto counts = ComputeBatch(network.get(), 64, "steady3", "warming3");
+    EXPECT_GT(counts.first, 0);
+    EXPECT_GT(counts.second, 0);
+  }
+}
+
+}  // namespace lczero
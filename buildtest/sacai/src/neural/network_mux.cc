@@ -25,27 +25,60 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <optional>
 #include <queue>
 #include <thread>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/histogram.h"
+#include "utils/logging.h"
 #include "utils/numa.h"
 
 namespace lczero {
 namespace {
 
+using Clock = std::chrono::steady_clock;
+
+// How a worker waits for more work before launching a batch.
+struct CoalescingParams {
+  int max_batch;
+  // Number of samples to wait for before launching.
+  int min_batch;
+  // Maximum time the oldest queued computation waits for the batch to fill.
+  std::chrono::microseconds max_wait;
+  // When non-zero, replaces max_wait: work waits up to this long, and only as
+  // long as the recent arrival rate predicts that min_batch will be reached
+  // in time.
+  std::chrono::microseconds latency_target;
+};
+
 class MuxingNetwork;
 class MuxingComputation : public NetworkComputation {
  public:
   MuxingComputation(MuxingNetwork* network) : network_(network) {}
 
-  void AddInput(InputPlanes&& input) override { planes_.emplace_back(input); }
+  void AddInput(InputPlanes&& input) override {
+    AddPackedInput(input.data(), {});
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         std::vector<uint16_t>&& legal_moves) override {
+    AddPackedInput(input.data(), std::move(legal_moves));
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&& legal_moves) override {
+    inputs_.Add(planes);
+    legal_moves_.emplace_back(std::move(legal_moves));
+  }
 
   void ComputeBlocking() override;
 
-  int GetBatchSize() const override { return planes_.size(); }
+  int GetBatchSize() const override { return inputs_.size(); }
 
   float GetQVal(int sample) const override {
     return parent_->GetQVal(sample + idx_in_parent_);
@@ -63,13 +96,23 @@ class MuxingComputation : public NetworkComputation {
     return parent_->GetPVal(sample + idx_in_parent_, move_id);
   }
 
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    parent_->GetPVals(sample + idx_in_parent_, move_ids, count, output);
+  }
+
   void PopulateToParent(std::shared_ptr<NetworkComputation> parent) {
     // Populate our batch into batch of batches.
     parent_ = parent;
     idx_in_parent_ = parent->GetBatchSize();
-    for (auto& x : planes_) parent_->AddInput(std::move(x));
+    for (int i = 0; i < inputs_.size(); i++) {
+      parent_->AddPackedInput(inputs_[i], std::move(legal_moves_[i]));
+    }
   }
 
+  Clock::time_point enqueue_time() const { return enqueue_time_; }
+  void set_enqueue_time(Clock::time_point time) { enqueue_time_ = time; }
+
   void NotifyReady() {
     std::unique_lock<std::mutex> lock(mutex_);
     dataready_ = true;
@@ -77,10 +120,12 @@ class MuxingComputation : public NetworkComputation {
   }
 
  private:
-  std::vector<InputPlanes> planes_;
+  InputBatch inputs_;
+  std::vector<std::vector<uint16_t>> legal_moves_;
   MuxingNetwork* network_;
   std::shared_ptr<NetworkComputation> parent_;
   int idx_in_parent_ = 0;
+  Clock::time_point enqueue_time_;
 
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
@@ -94,6 +139,8 @@ class MuxingNetwork : public Network {
     // int threads, int max_batch)
     //: network_(std::move(network)), max_batch_(max_batch) {
 
+    stats_interval_ = options.GetOrDefault<int>("stats_interval", 0);
+
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -111,7 +158,22 @@ class MuxingNetwork : public Network {
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
     const int nn_threads = opts.GetOrDefault<int>("threads", 1);
-    const int max_batch = opts.GetOrDefault<int>("max_batch", 256);
+    CoalescingParams params;
+    params.max_batch = opts.GetOrDefault<int>("max_batch", 256);
+    params.max_wait =
+        std::chrono::microseconds(opts.GetOrDefault<int>("max_wait_us", 0));
+    params.latency_target = std::chrono::microseconds(
+        opts.GetOrDefault<int>("latency_target_us", 0));
+    // Without a minimum, the latency target mode tries to fill whole batches.
+    params.min_batch = std::min(
+        params.max_batch,
+        opts.GetOrDefault<int>(
+            "min_batch",
+            params.latency_target.count() > 0 ? params.max_batch : 1));
+    if (params.min_batch < 1 || params.max_wait.count() < 0 ||
+        params.latency_target.count() < 0) {
+      throw Exception("Invalid batch coalescing options for backend " + name);
+    }
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
     networks_.emplace_back(
@@ -126,7 +188,7 @@ class MuxingNetwork : public Network {
 
     for (int i = 0; i < nn_threads; ++i) {
       threads_.emplace_back(
-          [this, net, max_batch, i]() { Worker(net, max_batch, i); });
+          [this, net, params, i]() { Worker(net, params, i); });
     }
   }
 
@@ -139,14 +201,29 @@ class MuxingNetwork : public Network {
   }
 
   void Enqueue(MuxingComputation* computation) {
+    const auto now = Clock::now();
+    computation->set_enqueue_time(now);
     std::lock_guard<std::mutex> lock(mutex_);
+    // Exponential moving averages of the time between arrivals and of their
+    // size. Idle periods are clamped so that they don't dominate.
+    if (last_arrival_) {
+      const double interval = std::min(
+          kMaxArrivalInterval,
+          std::chrono::duration<double>(now - *last_arrival_).count());
+      arrival_interval_ += kArrivalDecay * (interval - arrival_interval_);
+      arrival_size_ +=
+          kArrivalDecay * (computation->GetBatchSize() - arrival_size_);
+    }
+    last_arrival_ = now;
     queue_.push(computation);
+    queued_samples_ += computation->GetBatchSize();
     cv_.notify_one();
   }
 
   ~MuxingNetwork() {
     Abort();
     Wait();
+    if (stats_interval_ > 0 && batches_ > 0) DumpStats();
     // Unstuck waiting computations.
     while (!queue_.empty()) {
       queue_.front()->NotifyReady();
@@ -154,7 +231,52 @@ class MuxingNetwork : public Network {
     }
   }
 
-  void Worker(Network* network, const int max_batch, int id) {
+  // Returns when the queued work should be launched by a worker with @params.
+  // Must be called with the mutex held and a non-empty queue.
+  Clock::time_point LaunchTime(const CoalescingParams& params,
+                               Clock::time_point now) const {
+    if (queued_samples_ >= params.min_batch) return now;
+    const auto oldest = queue_.front()->enqueue_time();
+    if (params.latency_target.count() == 0) return oldest + params.max_wait;
+
+    const auto deadline = oldest + params.latency_target;
+    if (arrival_interval_ <= 0.0) return deadline;
+    // Recheck when the batch is expected to be full, unless that's too late
+    // anyway, in which case there is no point in waiting.
+    const double rate = arrival_size_ / arrival_interval_;
+    const auto fill_time =
+        now + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(
+                      (params.min_batch - queued_samples_) / rate));
+    return fill_time > deadline ? now : fill_time;
+  }
+
+  // Records statistics of a batch launched at @now. Called with the mutex held.
+  void AddStats(const std::vector<MuxingComputation*>& children, int size,
+                Clock::time_point now) {
+    batch_size_histogram_.Add(size);
+    total_batch_size_ += size;
+    for (auto child : children) {
+      const double wait =
+          std::chrono::duration<double>(now - child->enqueue_time()).count();
+      queue_wait_histogram_.Add(wait);
+      total_queue_wait_ += wait;
+      ++waits_;
+    }
+    if (++batches_ % stats_interval_ == 0) DumpStats();
+  }
+
+  void DumpStats() {
+    CERR << "Multiplexing: " << batches_ << " batches, average size "
+         << total_batch_size_ / batches_ << ", average queue wait "
+         << 1e6 * total_queue_wait_ / waits_ << "us.";
+    CERR << "Batch size histogram (log10):";
+    batch_size_histogram_.Dump();
+    CERR << "Queue wait histogram (log10 seconds):";
+    queue_wait_histogram_.Dump();
+  }
+
+  void Worker(Network* network, const CoalescingParams& params, int id) {
     // Add one to the id in order to leave space for an active search thread.
     Numa::BindThread(id + 1);
     // While Abort() is not called (and it can only be called from destructor).
@@ -165,8 +287,18 @@ class MuxingNetwork : public Network {
       std::shared_ptr<NetworkComputation> parent(network->NewComputation());
       {
         std::unique_lock<std::mutex> lock(mutex_);
-        // Wait until there's come work to compute.
-        cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+        // Wait until there's some work to compute, and then until it fills
+        // enough of a batch or has waited long enough.
+        while (!abort_) {
+          if (queue_.empty()) {
+            cv_.wait(lock);
+            continue;
+          }
+          const auto now = Clock::now();
+          const auto launch_time = LaunchTime(params, now);
+          if (launch_time <= now) break;
+          cv_.wait_until(lock, launch_time);
+        }
         if (abort_) break;
 
         // While there is a work in queue, add it.
@@ -176,15 +308,21 @@ class MuxingNetwork : public Network {
           // we still have to add it.
           if (parent->GetBatchSize() != 0 &&
               parent->GetBatchSize() + queue_.front()->GetBatchSize() >
-                  max_batch) {
+                  params.max_batch) {
             break;
           }
           // Remember which of "input" computations we serve.
           children.push_back(queue_.front());
           queue_.pop();
+          queued_samples_ -= children.back()->GetBatchSize();
           // Make "input" computation populate data into output batch.
           children.back()->PopulateToParent(parent);
         }
+        // Leftovers may already be ready for another worker.
+        if (!queue_.empty()) cv_.notify_one();
+        if (stats_interval_ > 0) {
+          AddStats(children, parent->GetBatchSize(), Clock::now());
+        }
       }
 
       // Compute.
@@ -212,9 +350,25 @@ class MuxingNetwork : public Network {
  private:
   std::vector<std::unique_ptr<Network>> networks_;
   std::queue<MuxingComputation*> queue_;
+  int queued_samples_ = 0;
   bool abort_ = false;
   NetworkCapabilities capabilities_;
 
+  static constexpr double kArrivalDecay = 0.1;
+  static constexpr double kMaxArrivalInterval = 0.1;
+  std::optional<Clock::time_point> last_arrival_;
+  double arrival_interval_ = 0.0;
+  double arrival_size_ = 0.0;
+
+  // Batch statistics, reported every stats_interval_ batches if non-zero.
+  int stats_interval_ = 0;
+  int64_t batches_ = 0;
+  double total_batch_size_ = 0.0;
+  double total_queue_wait_ = 0.0;
+  int64_t waits_ = 0;
+  Histogram batch_size_histogram_{0, 3, 5};
+  Histogram queue_wait_histogram_{-6, 0, 5};
+
   std::mutex mutex_;
   std::condition_variable cv_;
 
@@ -27,28 +27,99 @@
 
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "neural/factory.h"
+#include "utils/exception.h"
 #include "utils/hashcat.h"
+#include "utils/random.h"
 
 namespace lczero {
 namespace {
 
+// Simulated latency of a backend: a fixed cost per batch plus a cost per
+// sample, randomly scaled by up to +/- jitter, with at most concurrency
+// batches computed at the same time (0 for no limit). Batches above the
+// limit wait for a slot, as on a busy accelerator.
+class LatencyModel {
+ public:
+  LatencyModel(const OptionsDict& options)
+      : batch_latency_(
+            std::chrono::microseconds(
+                options.GetOrDefault<int>("batch_latency_us", 0)) +
+            std::chrono::milliseconds(options.GetOrDefault<int>("delay", 0))),
+        sample_latency_(std::chrono::microseconds(
+            options.GetOrDefault<int>("sample_latency_us", 0))),
+        jitter_(options.GetOrDefault<float>("jitter", 0.0f)),
+        free_slots_(options.GetOrDefault<int>("concurrency", 0)) {
+    if (batch_latency_.count() < 0 || sample_latency_.count() < 0 ||
+        jitter_ < 0.0f || jitter_ > 1.0f || free_slots_ < 0) {
+      throw Exception("Invalid latency options for the random backend.");
+    }
+    limited_ = free_slots_ > 0;
+  }
+
+  bool enabled() const {
+    return batch_latency_.count() > 0 || sample_latency_.count() > 0;
+  }
+
+  // Blocks for as long as a batch of @batch_size takes.
+  void Compute(int batch_size) {
+    auto latency = batch_latency_ + sample_latency_ * batch_size;
+    if (jitter_ > 0.0f) {
+      const double scale = 1.0 - jitter_ + Random::Get().GetDouble(2 * jitter_);
+      latency = std::chrono::duration_cast<std::chrono::microseconds>(
+          latency * scale);
+    }
+    if (!limited_) {
+      std::this_thread::sleep_for(latency);
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      slot_cv_.wait(lock, [this]() { return free_slots_ > 0; });
+      --free_slots_;
+    }
+    std::this_thread::sleep_for(latency);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++free_slots_;
+    }
+    slot_cv_.notify_one();
+  }
+
+ private:
+  const std::chrono::microseconds batch_latency_;
+  const std::chrono::microseconds sample_latency_;
+  const float jitter_;
+  bool limited_;
+
+  std::mutex mutex_;
+  std::condition_variable slot_cv_;
+  int free_slots_;
+};
+
 class RandomNetworkComputation : public NetworkComputation {
  public:
-  RandomNetworkComputation(int delay, int seed, bool uniform_mode)
-      : delay_ms_(delay), seed_(seed), uniform_mode_(uniform_mode) {}
+  RandomNetworkComputation(LatencyModel* latency, int seed, bool uniform_mode)
+      : latency_(latency), seed_(seed), uniform_mode_(uniform_mode) {}
 
   void AddInput(InputPlanes&& input) override {
+    AddPackedInput(input.data(), {});
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&&) override {
     std::uint64_t hash = seed_;
-    for (const auto& plane : input) {
-      hash = HashCat({hash, plane.mask});
+    for (int i = 0; i < kInputPlanes; i++) {
+      hash = HashCat({hash, planes[i].mask});
       std::uint32_t tmp;
-      std::memcpy(&tmp, &plane.value, sizeof(float));
+      std::memcpy(&tmp, &planes[i].value, sizeof(float));
       const std::uint64_t value_hash = tmp;
       hash = HashCat({hash, value_hash});
     }
@@ -56,9 +127,7 @@ class RandomNetworkComputation : public NetworkComputation {
   }
 
   void ComputeBlocking() override {
-    if (delay_ms_) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
-    }
+    if (latency_->enabled()) latency_->Compute(inputs_.size());
   }
 
   int GetBatchSize() const override { return inputs_.size(); }
@@ -96,7 +165,7 @@ class RandomNetworkComputation : public NetworkComputation {
 
  private:
   std::vector<std::uint64_t> inputs_;
-  int delay_ms_ = 0;
+  LatencyModel* latency_;
   int seed_ = 0;
   bool uniform_mode_ = false;
 };
@@ -104,7 +173,7 @@ class RandomNetworkComputation : public NetworkComputation {
 class RandomNetwork : public Network {
  public:
   RandomNetwork(const OptionsDict& options)
-      : delay_ms_(options.GetOrDefault<int>("delay", 0)),
+      : latency_(options),
         seed_(options.GetOrDefault<int>("seed", 0)),
         uniform_mode_(options.GetOrDefault<bool>("uniform", false)),
         capabilities_{
@@ -114,7 +183,7 @@ class RandomNetwork : public Network {
                     pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE)),
             pblczero::NetworkFormat::MOVES_LEFT_NONE} {}
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    return std::make_unique<RandomNetworkComputation>(delay_ms_, seed_,
+    return std::make_unique<RandomNetworkComputation>(&latency_, seed_,
                                                       uniform_mode_);
   }
   const NetworkCapabilities& GetCapabilities() const override {
@@ -122,7 +191,7 @@ class RandomNetwork : public Network {
   }
 
  private:
-  int delay_ms_ = 0;
+  LatencyModel latency_;
   int seed_ = 0;
   bool uniform_mode_ = false;
   NetworkCapabilities capabilities_{
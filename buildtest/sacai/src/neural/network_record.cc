@@ -25,9 +25,12 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <fstream>
 #include <iostream>
+#include <unordered_map>
 
 #include "neural/factory.h"
+#include "neural/trace.h"
 #include "utils/hashcat.h"
 
 namespace lczero {
@@ -36,14 +39,14 @@ namespace {
 class RecordComputation : public NetworkComputation {
  public:
   RecordComputation(std::unique_ptr<NetworkComputation>&& inner,
-                    const std::string& record_file)
-      : inner_(std::move(inner)), record_file_(record_file) {}
-  static uint64_t make_hash(const InputPlanes& input) {
+                    TraceWriter* writer)
+      : inner_(std::move(inner)), writer_(writer) {}
+  static uint64_t make_hash(const InputPlane* planes) {
     std::uint64_t hash = 0x2134435D4534LL;
-    for (const auto& plane : input) {
-      hash = HashCat({hash, plane.mask});
+    for (int i = 0; i < kInputPlanes; i++) {
+      hash = HashCat({hash, planes[i].mask});
       std::uint32_t tmp;
-      std::memcpy(&tmp, &plane.value, sizeof(float));
+      std::memcpy(&tmp, &planes[i].value, sizeof(float));
       const std::uint64_t value_hash = tmp;
       hash = HashCat({hash, value_hash});
     }
@@ -51,11 +54,19 @@ class RecordComputation : public NetworkComputation {
   }
   // Adds a sample to the batch.
   void AddInput(InputPlanes&& input) override {
-    hashes_.push_back(make_hash(input));
-    requests_.emplace_back();
-    q_count_.push_back(0);
+    AddSample(input.data());
     inner_->AddInput(std::move(input));
   }
+  void AddInputWithMoves(InputPlanes&& input,
+                         std::vector<uint16_t>&& legal_moves) override {
+    AddSample(input.data());
+    inner_->AddInputWithMoves(std::move(input), std::move(legal_moves));
+  }
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&& legal_moves) override {
+    AddSample(planes);
+    inner_->AddPackedInput(planes, std::move(legal_moves));
+  }
   // Do the computation.
   void ComputeBlocking() override { inner_->ComputeBlocking(); }
   // Returns how many times AddInput() was called.
@@ -64,7 +75,7 @@ class RecordComputation : public NetworkComputation {
     // Only capture until we see Q again - the rest can be infered from that
     // set.
     if (q_count_[index] > 1) return value;
-    requests_[index].push_back(value);
+    samples_[index].values.push_back(value);
     return value;
   }
   // Returns Q value of @sample.
@@ -79,53 +90,60 @@ class RecordComputation : public NetworkComputation {
   float GetPVal(int sample, int move_id) const override {
     return Capture(inner_->GetPVal(sample, move_id), sample);
   }
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    inner_->GetPVals(sample, move_ids, count, output);
+    for (int i = 0; i < count; i++) Capture(output[i], sample);
+  }
   float GetMVal(int sample) const override {
     return Capture(inner_->GetMVal(sample), sample);
   }
   virtual ~RecordComputation() {
-    Mutex::Lock lock(mutex_);
-    std::fstream output(record_file_, std::ios::app | std::ios_base::binary);
-    for (size_t i = 0; i < hashes_.size(); i++) {
-      uint64_t value = hashes_[i];
-      output.write(reinterpret_cast<const char*>(&value), sizeof(value));
-      int32_t length = static_cast<int32_t>(requests_[i].size());
-      output.write(reinterpret_cast<const char*>(&length), sizeof(length));
-      for (int j = 0; j < length; j++) {
-        float recorded = requests_[i][j];
-        output.write(reinterpret_cast<const char*>(&recorded),
-                     sizeof(recorded));
-      }
-    }
+    if (writer_) writer_->AddBatch(samples_);
   }
+
+ private:
+  void AddSample(const InputPlane* planes) {
+    samples_.emplace_back();
+    samples_.back().hash = make_hash(planes);
+    if (writer_) samples_.back().planes.assign(planes, planes + kInputPlanes);
+    q_count_.push_back(0);
+  }
+
   std::unique_ptr<NetworkComputation> inner_;
-  std::string record_file_;
-  std::vector<uint64_t> hashes_;
+  TraceWriter* writer_;
   mutable std::vector<int> q_count_;
-  mutable std::vector<std::vector<float>> requests_;
-  static Mutex mutex_;
+  mutable TraceBatch samples_;
 };
 
-Mutex RecordComputation::mutex_;
+// Recorded outputs for a position hash. Returns false if there are none.
+using ReplayLookup =
+    std::function<bool(uint64_t hash, std::vector<float>* values)>;
 
 class ReplayComputation : public NetworkComputation {
  public:
-  ReplayComputation(std::unordered_map<uint64_t, std::vector<float>>* lookup)
-      : lookup_(lookup) {}
+  ReplayComputation(const ReplayLookup* lookup) : lookup_(lookup) {}
   // Adds a sample to the batch.
   void AddInput(InputPlanes&& input) override {
-    hashes_.push_back(RecordComputation::make_hash(input));
+    AddPackedInput(input.data(), {});
+  }
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&&) override {
+    hashes_.push_back(RecordComputation::make_hash(planes));
     replay_counter_.push_back(0);
   }
-  // Do the computation.
-  void ComputeBlocking() override {}
+  // Fetches the recordings of the batch.
+  void ComputeBlocking() override {
+    entries_.resize(hashes_.size());
+    for (size_t i = 0; i < hashes_.size(); i++) {
+      if (!(*lookup_)(hashes_[i], &entries_[i])) entries_[i].clear();
+    }
+  }
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return static_cast<int>(hashes_.size()); }
   float Replay(int index) const {
-    const auto& entry_ptr = lookup_->find(hashes_[index]);
-    if (entry_ptr == lookup_->end()) {
-      return 0.0f;
-    }
-    const auto& entry = entry_ptr->second;
+    const auto& entry = entries_[index];
+    if (entry.empty()) return 0.0f;
     size_t counter = replay_counter_[index];
     if (counter >= entry.size()) {
       // Second pass reads the same things in the same order as first.
@@ -149,10 +167,10 @@ class ReplayComputation : public NetworkComputation {
   float GetMVal(int sample) const override { return Replay(sample); }
   virtual ~ReplayComputation() {}
 
-  std::unique_ptr<NetworkComputation> inner_;
   std::vector<uint64_t> hashes_;
+  std::vector<std::vector<float>> entries_;
   mutable std::vector<size_t> replay_counter_;
-  std::unordered_map<uint64_t, std::vector<float>>* lookup_;
+  const ReplayLookup* lookup_;
 };
 
 class RecordReplayNetwork : public Network {
@@ -173,28 +191,25 @@ class RecordReplayNetwork : public Network {
     replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
     record_file_ = options.GetOrDefault<std::string>("record_file", "");
     if (replay_file_.size() > 0) {
-      lookup_ =
-          std::make_unique<std::unordered_map<uint64_t, std::vector<float>>>();
-      std::ifstream input(replay_file_, std::ios_base::binary);
-      input.seekg(0, input.end);
-      auto file_length = input.tellg();
-      input.seekg(0, input.beg);
-      while (input.tellg() < file_length) {
-        uint64_t value = 0;
-        input.read(reinterpret_cast<char*>(&value), sizeof(value));
-        int32_t length = 0;
-        input.read(reinterpret_cast<char*>(&length), sizeof(length));
-        auto& entry = (*lookup_)[value];
-        // Only use the first recorded value for any hash collisions.
-        bool fill = entry.size() == 0;
-        for (int j = 0; j < length; j++) {
-          float recorded = 0.0f;
-          input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
-          if (fill) {
-            entry.push_back(recorded);
-          }
-        }
+      if (TraceReader::IsTrace(replay_file_)) {
+        // Streams from the mapped file, with a bounded number of
+        // decompressed chunks in memory.
+        reader_ = std::make_unique<TraceReader>(
+            replay_file_, options.GetOrDefault<int>("replay_cache_chunks", 16));
+        lookup_ = [this](uint64_t hash, std::vector<float>* values) {
+          return reader_->Find(hash, values);
+        };
+      } else {
+        LoadLegacyRecording();
+        lookup_ = [this](uint64_t hash, std::vector<float>* values) {
+          const auto iter = legacy_.find(hash);
+          if (iter == legacy_.end()) return false;
+          *values = iter->second;
+          return true;
+        };
       }
+    } else if (record_file_.size() > 0) {
+      writer_ = std::make_unique<TraceWriter>(record_file_);
     }
   }
 
@@ -217,9 +232,9 @@ class RecordReplayNetwork : public Network {
     if (!lookup_) {
       const long long val = ++counter_;
       return std::make_unique<RecordComputation>(
-          networks_[val % networks_.size()]->NewComputation(), record_file_);
+          networks_[val % networks_.size()]->NewComputation(), writer_.get());
     }
-    return std::make_unique<ReplayComputation>(lookup_.get());
+    return std::make_unique<ReplayComputation>(&lookup_);
   }
 
   const NetworkCapabilities& GetCapabilities() const override {
@@ -229,12 +244,39 @@ class RecordReplayNetwork : public Network {
   ~RecordReplayNetwork() {}
 
  private:
+  // Recordings made before traces: hash, int32 count and floats per sample.
+  void LoadLegacyRecording() {
+    std::ifstream input(replay_file_, std::ios_base::binary);
+    input.seekg(0, input.end);
+    auto file_length = input.tellg();
+    input.seekg(0, input.beg);
+    while (input.tellg() < file_length) {
+      uint64_t value = 0;
+      input.read(reinterpret_cast<char*>(&value), sizeof(value));
+      int32_t length = 0;
+      input.read(reinterpret_cast<char*>(&length), sizeof(length));
+      auto& entry = legacy_[value];
+      // Only use the first recorded value for any hash collisions.
+      bool fill = entry.size() == 0;
+      for (int j = 0; j < length; j++) {
+        float recorded = 0.0f;
+        input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
+        if (fill) {
+          entry.push_back(recorded);
+        }
+      }
+    }
+  }
+
   std::vector<std::unique_ptr<Network>> networks_;
   std::atomic<long long> counter_;
   NetworkCapabilities capabilities_;
   std::string replay_file_;
   std::string record_file_;
-  std::unique_ptr<std::unordered_map<uint64_t, std::vector<float>>> lookup_;
+  std::unique_ptr<TraceWriter> writer_;
+  std::unique_ptr<TraceReader> reader_;
+  std::unordered_map<uint64_t, std::vector<float>> legacy_;
+  ReplayLookup lookup_;
 };
 
 std::unique_ptr<Network> MakeRecordReplayNetwork(
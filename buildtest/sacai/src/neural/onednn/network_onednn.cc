@@ -35,6 +35,7 @@
 #include "layers.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
+#include "neural/shared/expand_planes.h"
 #include "neural/shared/policy_map.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
@@ -64,6 +65,8 @@ struct InputsOutputs {
       op_moves_left_mem_ = (float*)malloc(maxBatchSize * sizeof(float));
     } else
       op_moves_left_mem_ = nullptr;
+
+    legal_moves_.resize(maxBatchSize);
   }
   ~InputsOutputs() {
     free(input_masks_mem_);
@@ -79,6 +82,8 @@ struct InputsOutputs {
   float* op_policy_mem_;
   float* op_value_mem_;
   float* op_moves_left_mem_;
+  // Policy indices needed for each sample, all of them if empty.
+  std::vector<std::vector<uint16_t>> legal_moves_;
 };
 
 class OnednnNetwork;
@@ -89,16 +94,25 @@ class OnednnNetworkComputation : public NetworkComputation {
   ~OnednnNetworkComputation();
 
   void AddInput(InputPlanes&& input) override {
+    AddPackedInput(input.data(), {});
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         std::vector<uint16_t>&& legal_moves) override {
+    AddPackedInput(input.data(), std::move(legal_moves));
+  }
+
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&& legal_moves) override {
+    inputs_outputs_->legal_moves_[batch_size_] = std::move(legal_moves);
     const auto iter_mask =
         &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes];
     const auto iter_val =
         &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes];
 
-    int i = 0;
-    for (const auto& plane : input) {
-      iter_mask[i] = plane.mask;
-      iter_val[i] = plane.value;
-      i++;
+    for (int i = 0; i < kInputPlanes; i++) {
+      iter_mask[i] = planes[i].mask;
+      iter_val[i] = planes[i].value;
     }
 
     batch_size_++;
@@ -131,6 +145,13 @@ class OnednnNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override {
+    const float* policy =
+        &inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy];
+    for (int i = 0; i < count; i++) output[i] = policy[move_ids[i]];
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -157,6 +178,13 @@ class OnednnNetwork : public Network {
 
     conv_policy_ = file.format().network_format().policy() ==
                    pblczero::NetworkFormat::POLICY_CONVOLUTION;
+    if (conv_policy_) {
+      conv_policy_positions_.resize(kNumOutputPolicy, -1);
+      for (int i = 0; i < 73 * 8 * 8; i++) {
+        const auto j = kConvPolicyMap[i];
+        if (j >= 0) conv_policy_positions_[j] = i;
+      }
+    }
 
 #if DNNL_VERSION_MAJOR * 100 + DNNL_VERSION_MINOR >= 105
     dnnl::set_primitive_cache_capacity(
@@ -500,12 +528,10 @@ class OnednnNetwork : public Network {
       dnnl::memory input_mem = dnnl::memory(input_desc, cpu_eng_);
 
       float* buffer = (float*)input_mem.get_data_handle();
-      for (int j = 0; j < currentBatchSize * kInputPlanes; j++) {
-        const float value = ipDataValues[j + start * kInputPlanes];
-        const uint64_t mask = ipDataMasks[j + start * kInputPlanes];
-        for (auto i = 0; i < 64; i++)
-          *(buffer++) = (mask & (((uint64_t)1) << i)) != 0 ? value : 0;
-      }
+      ExpandPlanes(ipDataMasks + start * kInputPlanes,
+                   ipDataValues + start * kInputPlanes,
+                   currentBatchSize * kInputPlanes, buffer);
+      buffer += currentBatchSize * kInputPlanes * 64;
       // Clear remaining buffer (if any).
       memset(buffer, 0, (batchSize - currentBatchSize) * kInputPlanes * 64 *
                             sizeof(float));
@@ -667,6 +693,14 @@ class OnednnNetwork : public Network {
       if (conv_policy_) {
         float* opPol = (float*)opPol_mem.get_data_handle();
         for (int batch = 0; batch < currentBatchSize; batch++) {
+          // Only map the legal moves when they are known.
+          const auto& legal_moves = io->legal_moves_[batch + start];
+          for (const auto move : legal_moves) {
+            const auto position = conv_policy_positions_[move];
+            io->op_policy_mem_[(batch + start) * kNumOutputPolicy + move] =
+                opPol[batch * pol_channels_ * 64 + position];
+          }
+          if (!legal_moves.empty()) continue;
           for (int i = 0; i < 73 * 8 * 8; i++) {
             auto j = kConvPolicyMap[i];
             if (j >= 0) {
@@ -737,6 +771,8 @@ class OnednnNetwork : public Network {
 
   bool has_se_;
   bool conv_policy_;
+  // Position in the convolutional policy output of each policy index.
+  std::vector<int> conv_policy_positions_;
   std::vector<std::vector<std::unique_ptr<BaseLayer>>> layers_;
   BaseLayer* getLastLayer(int idx) { return layers_[idx].back().get(); }
 
@@ -38,8 +38,8 @@
 #include "neural/loader.h"
 #include "neural/network.h"
 #include "neural/onnx/converter.h"
+#include "neural/shared/expand_planes.h"
 #include "onnxruntime_cxx_api.h"
-#include "utils/bititer.h"
 #include "utils/exception.h"
 #include "utils/logging.h"
 
@@ -54,20 +54,26 @@ class OnnxComputation : public NetworkComputation {
  public:
   OnnxComputation(OnnxNetwork* network) : network_(network) {}
   void AddInput(InputPlanes&& input) override {
-    raw_input_.emplace_back(input);
+    raw_input_.Add(input.data());
+  }
+  void AddPackedInput(const InputPlane* planes,
+                      std::vector<uint16_t>&&) override {
+    raw_input_.Add(planes);
   }
   int GetBatchSize() const override { return raw_input_.size(); }
   void ComputeBlocking() override;
   float GetQVal(int sample) const override;
   float GetDVal(int sample) const override;
   float GetPVal(int sample, int move_id) const override;
+  void GetPVals(int sample, const uint16_t* move_ids, int count,
+                float* output) const override;
   float GetMVal(int sample) const override;
 
  private:
   Ort::Value PrepareInput();
 
   OnnxNetwork* network_;
-  std::vector<InputPlanes> raw_input_;
+  InputBatch raw_input_;
   std::vector<float> input_tensor_data_;
   std::vector<Ort::Value> output_tensors_;
 };
@@ -122,6 +128,13 @@ float OnnxComputation::GetPVal(int sample, int move_id) const {
       output_tensors_[network_->policy_head_].GetTensorData<float>();
   return data[sample * 1858 + move_id];
 }
+void OnnxComputation::GetPVals(int sample, const uint16_t* move_ids, int count,
+                               float* output) const {
+  const float* policy =
+      output_tensors_[network_->policy_head_].GetTensorData<float>() +
+      sample * 1858;
+  for (int i = 0; i < count; i++) output[i] = policy[move_ids[i]];
+}
 float OnnxComputation::GetMVal(int sample) const {
   if (network_->mlh_head_ == -1) return 0.0f;
   const auto& data =
@@ -130,17 +143,10 @@ float OnnxComputation::GetMVal(int sample) const {
 }
 
 Ort::Value OnnxComputation::PrepareInput() {
-  input_tensor_data_.clear();
   input_tensor_data_.resize(raw_input_.size() * kInputPlanes * 8 * 8);
-  auto iter = input_tensor_data_.data();
-  for (const auto& sample : raw_input_) {
-    assert(sample.size() == kInputPlanes);
-    for (const auto& plane : sample) {
-      for (auto bit : IterateBits(plane.mask)) {
-        *(iter + bit) = plane.value;
-      }
-      iter += 64;
-    }
+  if (!raw_input_.empty()) {
+    ExpandPlanes(raw_input_[0], raw_input_.size() * kInputPlanes,
+                 input_tensor_data_.data());
   }
   int64_t dims[] = {static_cast<int64_t>(raw_input_.size()), kInputPlanes, 8,
                     8};
@@ -0,0 +1,171 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "neural/shared/expand_planes.h"
+
+#include <cassert>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_EXPAND_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace lczero {
+namespace {
+
+constexpr int kSquares = 64;
+
+// Masks and values are read @mask_stride and @value_stride bytes apart, so
+// that both arrays of InputPlane and separate arrays can be expanded.
+using ExpandKernel = void (*)(const char* masks, size_t mask_stride,
+                              const char* values, size_t value_stride,
+                              size_t count, float* output);
+
+inline uint64_t MaskAt(const char* masks, size_t stride, size_t i) {
+  return *reinterpret_cast<const uint64_t*>(masks + i * stride);
+}
+
+inline float ValueAt(const char* values, size_t stride, size_t i) {
+  return *reinterpret_cast<const float*>(values + i * stride);
+}
+
+#ifdef USE_EXPAND_X86_KERNELS
+
+// SSE2 is part of x86-64, so this one needs no runtime check. Each nibble of
+// the mask is broadcast and compared against the bit of each lane.
+void ExpandSse2(const char* masks, size_t mask_stride, const char* values,
+                size_t value_stride, size_t count, float* output) {
+  const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+  for (size_t p = 0; p < count; p++) {
+    const auto mask = MaskAt(masks, mask_stride, p);
+    const __m128 value = _mm_set1_ps(ValueAt(values, value_stride, p));
+    for (int i = 0; i < kSquares; i += 4) {
+      const __m128i nibble = _mm_set1_epi32(static_cast<int>(mask >> i) & 15);
+      const __m128i set = _mm_cmpeq_epi32(_mm_and_si128(nibble, bits), bits);
+      _mm_storeu_ps(output + i, _mm_and_ps(_mm_castsi128_ps(set), value));
+    }
+    output += kSquares;
+  }
+}
+
+// Each byte of the mask is shifted so that the bit of each lane lands in its
+// sign bit, which selects between zero and the value.
+__attribute__((target("avx2"))) void ExpandAvx2(const char* masks,
+                                                size_t mask_stride,
+                                                const char* values,
+                                                size_t value_stride,
+                                                size_t count, float* output) {
+  const __m256i shifts = _mm256_setr_epi32(31, 30, 29, 28, 27, 26, 25, 24);
+  const __m256 zero = _mm256_setzero_ps();
+  for (size_t p = 0; p < count; p++) {
+    const auto mask = MaskAt(masks, mask_stride, p);
+    const __m256 value = _mm256_set1_ps(ValueAt(values, value_stride, p));
+#pragma GCC unroll 8
+    for (int i = 0; i < kSquares; i += 8) {
+      const __m256i byte = _mm256_set1_epi32(static_cast<int>(mask >> i));
+      const __m256 select =
+          _mm256_castsi256_ps(_mm256_sllv_epi32(byte, shifts));
+      _mm256_storeu_ps(output + i, _mm256_blendv_ps(zero, value, select));
+    }
+    output += kSquares;
+  }
+}
+
+// The mask is directly usable as four 16-lane write masks.
+__attribute__((target("avx512f"))) void ExpandAvx512(const char* masks,
+                                                     size_t mask_stride,
+                                                     const char* values,
+                                                     size_t value_stride,
+                                                     size_t count,
+                                                     float* output) {
+  for (size_t p = 0; p < count; p++) {
+    const auto mask = MaskAt(masks, mask_stride, p);
+    const __m512 value = _mm512_set1_ps(ValueAt(values, value_stride, p));
+#pragma GCC unroll 4
+    for (int i = 0; i < kSquares; i += 16) {
+      _mm512_storeu_ps(output + i, _mm512_maskz_mov_ps(
+                                       static_cast<__mmask16>(mask >> i),
+                                       value));
+    }
+    output += kSquares;
+  }
+}
+
+#else
+
+void ExpandScalar(const char* masks, size_t mask_stride, const char* values,
+                  size_t value_stride, size_t count, float* output) {
+  for (size_t p = 0; p < count; p++) {
+    const auto mask = MaskAt(masks, mask_stride, p);
+    const auto value = ValueAt(values, value_stride, p);
+    for (int i = 0; i < kSquares; i++) {
+      *(output++) = (mask & (1ull << i)) != 0 ? value : 0.0f;
+    }
+  }
+}
+
+#endif  // USE_EXPAND_X86_KERNELS
+
+struct KernelChoice {
+  ExpandKernel expand;
+  const char* name;
+};
+
+KernelChoice ChooseKernel() {
+#ifdef USE_EXPAND_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {ExpandAvx512, "AVX512"};
+  if (__builtin_cpu_supports("avx2")) return {ExpandAvx2, "AVX2"};
+  return {ExpandSse2, "SSE2"};
+#else
+  return {ExpandScalar, "scalar"};
+#endif
+}
+
+const KernelChoice& GetKernel() {
+  static const KernelChoice kernel = ChooseKernel();
+  return kernel;
+}
+
+}  // namespace
+
+void ExpandPlanes(const InputPlane* planes, size_t count, float* output) {
+  GetKernel().expand(reinterpret_cast<const char*>(&planes->mask),
+                     sizeof(InputPlane),
+                     reinterpret_cast<const char*>(&planes->value),
+                     sizeof(InputPlane), count, output);
+}
+
+void ExpandPlanes(const uint64_t* masks, const float* values, size_t count,
+                  float* output) {
+  GetKernel().expand(reinterpret_cast<const char*>(masks), sizeof(*masks),
+                     reinterpret_cast<const char*>(values), sizeof(*values),
+                     count, output);
+}
+
+void ExpandSamples(const InputPlanes* samples, size_t count, float* output) {
+  for (size_t i = 0; i < count; i++) {
+    assert(samples[i].size() == kInputPlanes);
+    ExpandPlanes(samples[i].data(), kInputPlanes,
+                 output + i * kInputPlanes * kSquares);
+  }
+}
+
+const char* ExpandPlanesKernelName() { return GetKernel().name; }
+
+}  // namespace lczero
@@ -0,0 +1,46 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2021 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "neural/network.h"
+
+namespace lczero {
+
+// Expansion of the bit planes of the network input to the 64 floats per plane
+// that CPU backends feed to their first convolution (NCHW layout). Square i of
+// plane p is written to output[64 * p + i]: the plane value where the mask
+// bit is set, zero elsewhere.
+
+// Expands @count planes.
+void ExpandPlanes(const InputPlane* planes, size_t count, float* output);
+
+// Same, with masks and values in separate arrays.
+void ExpandPlanes(const uint64_t* masks, const float* values, size_t count,
+                  float* output);
+
+// Expands @count samples of kInputPlanes planes each, back to back.
+void ExpandSamples(const InputPlanes* samples, size_t count, float* output);
+
+// Returns the name of the expansion kernel selected for this CPU.
+const char* ExpandPlanesKernelName();
+
+}  // namespace lczero
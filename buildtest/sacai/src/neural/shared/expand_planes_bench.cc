@@ -0,0 +1,79 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmark of the input plane expansion: the selected SIMD kernel
+// against the per-bit loop the CPU backends used before.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "neural/shared/expand_planes.h"
+
+namespace lczero {
+namespace {
+
+void ExpandBitLoop(const std::vector<InputPlanes>& samples, float* buffer) {
+  for (const auto& sample : samples) {
+    for (const InputPlane& plane : sample) {
+      const float value = plane.value;
+      for (auto i = 0; i < 64; i++)
+        *(buffer++) = (plane.mask & (((uint64_t)1) << i)) != 0 ? value : 0;
+    }
+  }
+}
+
+template <typename Function>
+double NanosecondsPerSample(size_t batch_size, Function function) {
+  using Clock = std::chrono::steady_clock;
+  const int iterations = 200000 / batch_size + 1;
+  function();  // Warm up.
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) function();
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations / batch_size;
+}
+
+void Run() {
+  std::mt19937_64 gen(1);
+  std::printf("Kernel: %s\n", ExpandPlanesKernelName());
+  std::printf("%6s %12s %12s %8s\n", "batch", "loop ns", "simd ns", "speedup");
+  for (size_t batch_size : {1, 8, 32, 64, 256}) {
+    std::vector<InputPlanes> samples(batch_size, InputPlanes(kInputPlanes));
+    for (auto& sample : samples) {
+      // Sparse masks like real positions, with some all-ones planes.
+      for (auto& plane : sample) plane.mask = gen() & gen() & gen();
+      sample[kInputPlanes - 4].mask = ~0ull;
+      sample[kInputPlanes - 1].mask = ~0ull;
+    }
+    std::vector<float> output(batch_size * kInputPlanes * 64);
+    const double loop = NanosecondsPerSample(
+        batch_size, [&]() { ExpandBitLoop(samples, output.data()); });
+    const double simd = NanosecondsPerSample(batch_size, [&]() {
+      ExpandSamples(samples.data(), batch_size, output.data());
+    });
+    std::printf("%6zu %12.1f %12.1f %7.1fx\n", batch_size, loop, simd,
+                loop / simd);
+  }
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main() { lczero::Run(); }
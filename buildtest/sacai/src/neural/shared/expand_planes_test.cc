@@ -0,0 +1,98 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/neural/shared/expand_planes.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace lczero {
+namespace {
+
+InputPlanes RandomSample(std::mt19937_64& gen) {
+  InputPlanes sample(kInputPlanes);
+  std::uniform_real_distribution<float> values(-2.0f, 2.0f);
+  for (auto& plane : sample) {
+    plane.mask = gen();
+    plane.value = values(gen);
+  }
+  // Edge cases for the masks.
+  sample[0].mask = 0;
+  sample[1].mask = ~0ull;
+  sample[2].mask = 1ull << 63;
+  sample[3].mask = 1;
+  return sample;
+}
+
+std::vector<float> Reference(const std::vector<InputPlanes>& samples) {
+  std::vector<float> output;
+  for (const auto& sample : samples) {
+    for (const auto& plane : sample) {
+      for (int i = 0; i < 64; i++) {
+        output.push_back((plane.mask >> i) & 1 ? plane.value : 0.0f);
+      }
+    }
+  }
+  return output;
+}
+
+}  // namespace
+
+TEST(ExpandPlanes, MatchesReference) {
+  std::mt19937_64 gen(42);
+  std::vector<InputPlanes> samples;
+  for (int i = 0; i < 5; i++) samples.push_back(RandomSample(gen));
+  const auto expected = Reference(samples);
+
+  // Garbage in the output must be overwritten, zeros included.
+  std::vector<float> output(expected.size(), 7.0f);
+  ExpandSamples(samples.data(), samples.size(), output.data());
+  EXPECT_EQ(output, expected);
+}
+
+TEST(ExpandPlanes, SeparateArrays) {
+  std::mt19937_64 gen(7);
+  const auto sample = RandomSample(gen);
+  std::vector<uint64_t> masks;
+  std::vector<float> values;
+  for (const auto& plane : sample) {
+    masks.push_back(plane.mask);
+    values.push_back(plane.value);
+  }
+
+  std::vector<float> output(kInputPlanes * 64, 7.0f);
+  ExpandPlanes(masks.data(), values.data(), masks.size(), output.data());
+  EXPECT_EQ(output, Reference({sample}));
+
+  // A partial range only touches its own planes.
+  std::vector<float> partial(3 * 64, 7.0f);
+  ExpandPlanes(sample.data() + 5, 3, partial.data());
+  const auto full = Reference({sample});
+  EXPECT_TRUE(std::equal(partial.begin(), partial.end(),
+                         full.begin() + 5 * 64));
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
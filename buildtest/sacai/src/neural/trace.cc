@@ -0,0 +1,370 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "neural/trace.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/endian.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+constexpr char kFileMagic[8] = {'L', 'C', '0', 'T', 'R', 'A', 'C', 'E'};
+constexpr char kFooterMagic[8] = {'L', 'C', '0', 'T', 'I', 'D', 'X', '1'};
+constexpr uint32_t kChunkMagic = 0x4b4e4843;  // "CHNK"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kFileHeaderSize = 16;
+constexpr size_t kChunkHeaderSize = 16;
+constexpr size_t kIndexEntrySize = 24;
+constexpr size_t kFooterSize = 40;
+// Uncompressed size after which a chunk is written.
+constexpr size_t kChunkSize = 1 << 20;
+// Deflate never compresses more than 1032:1, a larger raw size in a chunk
+// header is corrupt and is not allocated.
+constexpr uint64_t kMaxCompressionRatio = 1032;
+
+template <typename T>
+void Append(std::vector<char>* buffer, T value) {
+  char bytes[sizeof(T)];
+  StoreLittleEndian(value, bytes);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+void Write(std::ofstream* output, T value) {
+  char bytes[sizeof(T)];
+  StoreLittleEndian(value, bytes);
+  output->write(bytes, sizeof(T));
+}
+
+template <typename T>
+T Read(const char* data) {
+  return LoadLittleEndian<T>(data);
+}
+
+// Whether a complete chunk starts at @offset of @data, within its first @end
+// bytes.
+bool IsChunk(const char* data, uint64_t offset, uint64_t end) {
+  if (offset > end || end - offset < kChunkHeaderSize) return false;
+  const char* header = data + offset;
+  return Read<uint32_t>(header) == kChunkMagic &&
+         Read<uint32_t>(header + 8) <= end - offset - kChunkHeaderSize;
+}
+
+// Sequential reader over a buffer, checking bounds.
+class BufferReader {
+ public:
+  BufferReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  T Get() {
+    if (pos_ + sizeof(T) > size_) throw Exception("Truncated trace chunk.");
+    const T value = Read<T>(data_ + pos_);
+    pos_ += sizeof(T);
+    return value;
+  }
+
+  size_t pos() const { return pos_; }
+  bool done() const { return pos_ >= size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+TraceSample ReadSample(BufferReader* reader) {
+  TraceSample sample;
+  sample.hash = reader->Get<uint64_t>();
+  sample.planes.resize(reader->Get<uint16_t>());
+  for (auto& plane : sample.planes) {
+    plane.mask = reader->Get<uint64_t>();
+    plane.value = reader->Get<float>();
+  }
+  sample.values.resize(reader->Get<uint32_t>());
+  for (auto& value : sample.values) value = reader->Get<float>();
+  return sample;
+}
+
+}  // namespace
+
+TraceWriter::TraceWriter(const std::string& filename)
+    : output_(filename, std::ios::binary | std::ios::trunc),
+      filename_(filename) {
+  if (!output_) throw Exception("Cannot create trace file " + filename);
+  output_.write(kFileMagic, sizeof(kFileMagic));
+  Write<uint32_t>(&output_, kVersion);
+  Write<uint32_t>(&output_, 0);
+  offset_ = kFileHeaderSize;
+}
+
+TraceWriter::~TraceWriter() {
+  try {
+    Finish();
+  } catch (const Exception& e) {
+    CERR << e.what();
+  }
+}
+
+void TraceWriter::AddBatch(const TraceBatch& batch) {
+  Mutex::Lock lock(mutex_);
+  if (finished_) return;
+  Append<uint32_t>(&chunk_, batch.size());
+  for (const auto& sample : batch) {
+    chunk_entries_.push_back(
+        {sample.hash, 0, static_cast<uint32_t>(chunk_.size())});
+    Append<uint64_t>(&chunk_, sample.hash);
+    Append<uint16_t>(&chunk_, sample.planes.size());
+    for (const auto& plane : sample.planes) {
+      Append<uint64_t>(&chunk_, plane.mask);
+      Append<float>(&chunk_, plane.value);
+    }
+    Append<uint32_t>(&chunk_, sample.values.size());
+    for (const auto value : sample.values) Append<float>(&chunk_, value);
+  }
+  ++chunk_batches_;
+  ++batches_;
+  if (chunk_.size() >= kChunkSize) FlushChunk();
+}
+
+void TraceWriter::FlushChunk() {
+  if (chunk_.empty()) return;
+  uLongf compressed_size = compressBound(chunk_.size());
+  std::vector<Bytef> compressed(compressed_size);
+  if (compress2(compressed.data(), &compressed_size,
+                reinterpret_cast<const Bytef*>(chunk_.data()), chunk_.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw Exception("Cannot compress trace chunk.");
+  }
+  Write<uint32_t>(&output_, kChunkMagic);
+  Write<uint32_t>(&output_, chunk_.size());
+  Write<uint32_t>(&output_, compressed_size);
+  Write<uint32_t>(&output_, chunk_batches_);
+  output_.write(reinterpret_cast<const char*>(compressed.data()),
+                compressed_size);
+  for (auto& entry : chunk_entries_) {
+    entry.chunk_offset = offset_;
+    index_.push_back(entry);
+  }
+  offset_ += kChunkHeaderSize + compressed_size;
+  ++chunks_;
+  chunk_.clear();
+  chunk_entries_.clear();
+  chunk_batches_ = 0;
+}
+
+void TraceWriter::Finish() {
+  Mutex::Lock lock(mutex_);
+  if (finished_) return;
+  finished_ = true;
+  FlushChunk();
+  // Entries are in file order, so a stable sort keeps the first recording of
+  // each hash first.
+  std::stable_sort(index_.begin(), index_.end(),
+                   [](const PendingEntry& a, const PendingEntry& b) {
+                     return a.hash < b.hash;
+                   });
+  const uint64_t index_offset = offset_;
+  for (const auto& entry : index_) {
+    Write<uint64_t>(&output_, entry.hash);
+    Write<uint64_t>(&output_, entry.chunk_offset);
+    Write<uint32_t>(&output_, entry.record_offset);
+    Write<uint32_t>(&output_, 0);
+  }
+  Write<uint64_t>(&output_, index_offset);
+  Write<uint64_t>(&output_, index_.size());
+  Write<uint64_t>(&output_, batches_);
+  Write<uint64_t>(&output_, chunks_);
+  output_.write(kFooterMagic, sizeof(kFooterMagic));
+  output_.close();
+  if (!output_) throw Exception("Error writing trace file " + filename_);
+  index_.clear();
+  index_.shrink_to_fit();
+}
+
+TraceReader::TraceReader(const std::string& filename, size_t cache_chunks)
+    : file_(filename), cache_chunks_(std::max<size_t>(1, cache_chunks)) {
+  if (file_.size() < kFileHeaderSize ||
+      std::memcmp(file_.data(), kFileMagic, sizeof(kFileMagic)) != 0) {
+    throw Exception(filename + " is not a trace file.");
+  }
+  if (Read<uint32_t>(file_.data() + sizeof(kFileMagic)) != kVersion) {
+    throw Exception("Unsupported version of trace file " + filename);
+  }
+  if (file_.size() < kFileHeaderSize + kFooterSize ||
+      std::memcmp(file_.data() + file_.size() - sizeof(kFooterMagic),
+                  kFooterMagic, sizeof(kFooterMagic)) != 0) {
+    RebuildIndex();
+    return;
+  }
+  const char* footer = file_.data() + file_.size() - kFooterSize;
+  const auto index_offset = Read<uint64_t>(footer);
+  index_size_ = Read<uint64_t>(footer + 8);
+  batches_ = Read<uint64_t>(footer + 16);
+  // The values come from the file, compared so that they cannot overflow.
+  const uint64_t index_end = file_.size() - kFooterSize;
+  if (index_offset < kFileHeaderSize || index_offset > index_end ||
+      (index_end - index_offset) % kIndexEntrySize != 0 ||
+      (index_end - index_offset) / kIndexEntrySize != index_size_) {
+    throw Exception("Corrupt index in trace file " + filename);
+  }
+  index_ = file_.data() + index_offset;
+  for (uint64_t offset = kFileHeaderSize; offset < index_offset;) {
+    if (!IsChunk(file_.data(), offset, index_offset)) {
+      throw Exception("Corrupt chunk in trace file " + filename);
+    }
+    chunk_offsets_.push_back(offset);
+    offset += kChunkHeaderSize + Read<uint32_t>(file_.data() + offset + 8);
+  }
+}
+
+bool TraceReader::IsTrace(const std::string& filename) {
+  std::ifstream input(filename, std::ios::binary);
+  char magic[sizeof(kFileMagic)];
+  return input.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kFileMagic, sizeof(magic)) == 0;
+}
+
+void TraceReader::RebuildIndex() {
+  // Scans the complete chunks, a partially written one is ignored.
+  uint64_t offset = kFileHeaderSize;
+  while (IsChunk(file_.data(), offset, file_.size())) {
+    const auto compressed_size = Read<uint32_t>(file_.data() + offset + 8);
+    const auto chunk = Decompress(offset);
+    BufferReader reader(chunk.data(), chunk.size());
+    while (!reader.done()) {
+      const auto count = reader.Get<uint32_t>();
+      for (uint32_t i = 0; i < count; i++) {
+        const auto record_offset = static_cast<uint32_t>(reader.pos());
+        const auto sample = ReadSample(&reader);
+        rebuilt_index_.push_back({sample.hash, offset, record_offset, 0});
+      }
+      ++batches_;
+    }
+    chunk_offsets_.push_back(offset);
+    offset += kChunkHeaderSize + compressed_size;
+  }
+  std::stable_sort(rebuilt_index_.begin(), rebuilt_index_.end(),
+                   [](const IndexEntry& a, const IndexEntry& b) {
+                     return a.hash < b.hash;
+                   });
+  index_size_ = rebuilt_index_.size();
+}
+
+TraceReader::IndexEntry TraceReader::GetEntry(size_t i) const {
+  if (!rebuilt_index_.empty()) return rebuilt_index_[i];
+  const char* data = index_ + i * kIndexEntrySize;
+  return {Read<uint64_t>(data), Read<uint64_t>(data + 8),
+          Read<uint32_t>(data + 16), 0};
+}
+
+std::vector<char> TraceReader::Decompress(uint64_t chunk_offset) const {
+  if (!IsChunk(file_.data(), chunk_offset, file_.size())) {
+    throw Exception("Corrupt chunk in trace file.");
+  }
+  const char* header = file_.data() + chunk_offset;
+  uLongf raw_size = Read<uint32_t>(header + 4);
+  const auto compressed_size = Read<uint32_t>(header + 8);
+  if (raw_size > kMaxCompressionRatio * compressed_size) {
+    throw Exception("Corrupt chunk in trace file.");
+  }
+  std::vector<char> chunk(raw_size);
+  if (uncompress(reinterpret_cast<Bytef*>(chunk.data()), &raw_size,
+                 reinterpret_cast<const Bytef*>(header + kChunkHeaderSize),
+                 compressed_size) != Z_OK ||
+      raw_size != chunk.size()) {
+    throw Exception("Cannot decompress trace chunk.");
+  }
+  return chunk;
+}
+
+std::shared_ptr<const std::vector<char>> TraceReader::GetChunk(
+    uint64_t chunk_offset) {
+  {
+    Mutex::Lock lock(mutex_);
+    for (auto iter = cache_.begin(); iter != cache_.end(); ++iter) {
+      if (iter->first != chunk_offset) continue;
+      cache_.splice(cache_.begin(), cache_, iter);
+      return cache_.front().second;
+    }
+  }
+  // Decompress outside of the lock, other threads may read other chunks.
+  auto chunk =
+      std::make_shared<const std::vector<char>>(Decompress(chunk_offset));
+  Mutex::Lock lock(mutex_);
+  cache_.emplace_front(chunk_offset, chunk);
+  if (cache_.size() > cache_chunks_) cache_.pop_back();
+  return chunk;
+}
+
+bool TraceReader::Find(uint64_t hash, std::vector<float>* values) {
+  size_t lo = 0;
+  size_t hi = index_size_;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (GetEntry(mid).hash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == index_size_) return false;
+  const auto entry = GetEntry(lo);
+  if (entry.hash != hash) return false;
+  if (!std::binary_search(chunk_offsets_.begin(), chunk_offsets_.end(),
+                          entry.chunk_offset)) {
+    throw Exception("Corrupt index in trace file.");
+  }
+  const auto chunk = GetChunk(entry.chunk_offset);
+  if (entry.record_offset >= chunk->size()) {
+    throw Exception("Corrupt index in trace file.");
+  }
+  BufferReader reader(chunk->data() + entry.record_offset,
+                      chunk->size() - entry.record_offset);
+  *values = ReadSample(&reader).values;
+  return true;
+}
+
+void TraceReader::ForEachBatch(
+    const std::function<void(const TraceBatch&)>& callback) const {
+  for (const auto offset : chunk_offsets_) {
+    const auto chunk = Decompress(offset);
+    BufferReader reader(chunk.data(), chunk.size());
+    while (!reader.done()) {
+      TraceBatch batch(reader.Get<uint32_t>());
+      for (auto& sample : batch) sample = ReadSample(&reader);
+      callback(batch);
+    }
+  }
+}
+
+uint64_t TraceReader::CountUniqueHashes() const {
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < index_size_; i++) {
+    if (i == 0 || GetEntry(i).hash != GetEntry(i - 1).hash) ++count;
+  }
+  return count;
+}
+
+}  // namespace lczero
@@ -0,0 +1,150 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "neural/network.h"
+#include "utils/filesystem.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Traces of backend evaluations, as recorded by the recordreplay backend.
+//
+// File layout (little endian):
+//   header:  "LC0TRACE", uint32 version, uint32 reserved
+//   chunks:  uint32 "CHNK", uint32 raw size, uint32 compressed size,
+//            uint32 batch count, then the zlib compressed batches.
+//   index:   one entry per sample, sorted by hash and then file order:
+//            uint64 hash, uint64 chunk offset, uint32 offset in the
+//            uncompressed chunk, uint32 reserved.
+//   footer:  uint64 index offset, uint64 index entries, uint64 batches,
+//            uint64 chunks, "LC0TIDX1"
+// A batch is a uint32 sample count followed by its samples, each being
+// uint64 hash, uint16 plane count, (uint64 mask, float value) per plane,
+// uint32 value count and the recorded output values.
+//
+// Chunks are independent, so a trace can be read one chunk at a time. A trace
+// without footer (e.g. interrupted recording) is still readable, its index is
+// then rebuilt by scanning the chunks.
+
+struct TraceSample {
+  uint64_t hash = 0;
+  InputPlanes planes;
+  // Outputs in the order they were requested from the backend.
+  std::vector<float> values;
+};
+using TraceBatch = std::vector<TraceSample>;
+
+class TraceWriter {
+ public:
+  // Creates (or truncates) @filename.
+  explicit TraceWriter(const std::string& filename);
+  // Calls Finish().
+  ~TraceWriter();
+
+  // Appends a batch. Thread safe.
+  void AddBatch(const TraceBatch& batch);
+  // Writes the pending chunk, the index and the footer.
+  void Finish();
+
+ private:
+  struct PendingEntry {
+    uint64_t hash;
+    uint64_t chunk_offset;
+    uint32_t record_offset;
+  };
+
+  void FlushChunk() REQUIRES(mutex_);
+
+  Mutex mutex_;
+  std::ofstream output_ GUARDED_BY(mutex_);
+  std::string filename_;
+  std::vector<char> chunk_ GUARDED_BY(mutex_);
+  uint32_t chunk_batches_ GUARDED_BY(mutex_) = 0;
+  // Index entries of the pending chunk, with a chunk offset of 0.
+  std::vector<PendingEntry> chunk_entries_ GUARDED_BY(mutex_);
+  std::vector<PendingEntry> index_ GUARDED_BY(mutex_);
+  uint64_t offset_ GUARDED_BY(mutex_) = 0;
+  uint64_t batches_ GUARDED_BY(mutex_) = 0;
+  uint64_t chunks_ GUARDED_BY(mutex_) = 0;
+  bool finished_ GUARDED_BY(mutex_) = false;
+};
+
+class TraceReader {
+ public:
+  // Maps @filename. At most @cache_chunks decompressed chunks are kept in
+  // memory for lookups.
+  explicit TraceReader(const std::string& filename, size_t cache_chunks = 16);
+
+  // Returns whether the file starts like a trace.
+  static bool IsTrace(const std::string& filename);
+
+  // Looks up the first sample recorded for @hash. Thread safe.
+  bool Find(uint64_t hash, std::vector<float>* values);
+
+  // Calls @callback for every batch in file order, one chunk in memory at a
+  // time.
+  void ForEachBatch(
+      const std::function<void(const TraceBatch&)>& callback) const;
+
+  uint64_t samples() const { return index_size_; }
+  uint64_t batches() const { return batches_; }
+  uint64_t chunks() const { return chunk_offsets_.size(); }
+  uint64_t file_size() const { return file_.size(); }
+  // Number of distinct hashes.
+  uint64_t CountUniqueHashes() const;
+  // Whether the index came from the footer rather than a rescan.
+  bool has_index() const { return rebuilt_index_.empty(); }
+
+ private:
+  struct IndexEntry {
+    uint64_t hash;
+    uint64_t chunk_offset;
+    uint32_t record_offset;
+    uint32_t reserved;
+  };
+
+  IndexEntry GetEntry(size_t i) const;
+  std::vector<char> Decompress(uint64_t chunk_offset) const;
+  std::shared_ptr<const std::vector<char>> GetChunk(uint64_t chunk_offset);
+  void RebuildIndex();
+
+  MappedFile file_;
+  const char* index_ = nullptr;
+  uint64_t index_size_ = 0;
+  std::vector<IndexEntry> rebuilt_index_;
+  uint64_t batches_ = 0;
+  std::vector<uint64_t> chunk_offsets_;
+
+  const size_t cache_chunks_;
+  Mutex mutex_;
+  // Most recently used chunks first.
+  std::list<std::pair<uint64_t, std::shared_ptr<const std::vector<char>>>>
+      cache_ GUARDED_BY(mutex_);
+};
+
+}  // namespace lczero
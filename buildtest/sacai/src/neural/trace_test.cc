@@ -0,0 +1,178 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/neural/trace.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "src/utils/endian.h"
+
+namespace lczero {
+namespace {
+
+const std::string kTraceFile = "trace_test.bin";
+
+// Batch @b with @b + 1 samples. Hash 1000 is recorded in every batch.
+TraceBatch MakeBatch(int b) {
+  TraceBatch batch(b + 1);
+  for (int i = 0; i <= b; i++) {
+    auto& sample = batch[i];
+    sample.hash = i == 0 ? 1000 : b * 1000 + i;
+    sample.planes.resize(3);
+    sample.planes[1].mask = sample.hash;
+    sample.planes[1].value = 0.5f;
+    sample.values = {static_cast<float>(b), static_cast<float>(i), -1.0f};
+  }
+  return batch;
+}
+
+void WriteTrace(int batches) {
+  TraceWriter writer(kTraceFile);
+  for (int b = 0; b < batches; b++) writer.AddBatch(MakeBatch(b));
+}
+
+std::string ReadTrace() {
+  std::ifstream input(kTraceFile, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(input), {});
+}
+
+// Writes @contents with @value stored at @offset.
+template <typename T>
+void WriteCorrupted(std::string contents, size_t offset, T value) {
+  StoreLittleEndian(value, &contents[offset]);
+  std::ofstream output(kTraceFile, std::ios::binary | std::ios::trunc);
+  output.write(contents.data(), contents.size());
+}
+
+}  // namespace
+
+TEST(Trace, RoundTrip) {
+  // Enough data to span several chunks.
+  constexpr int kBatches = 400;
+  WriteTrace(kBatches);
+  TraceReader reader(kTraceFile, 2);
+  EXPECT_TRUE(reader.has_index());
+  EXPECT_GT(reader.chunks(), 1u);
+  EXPECT_EQ(reader.batches(), static_cast<uint64_t>(kBatches));
+  EXPECT_EQ(reader.samples(), static_cast<uint64_t>(kBatches) *
+                                  (kBatches + 1) / 2);
+  EXPECT_EQ(reader.CountUniqueHashes(), reader.samples() - kBatches + 1);
+
+  int b = 0;
+  reader.ForEachBatch([&](const TraceBatch& batch) {
+    const auto expected = MakeBatch(b++);
+    ASSERT_EQ(batch.size(), expected.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      EXPECT_EQ(batch[i].hash, expected[i].hash);
+      EXPECT_EQ(batch[i].values, expected[i].values);
+      ASSERT_EQ(batch[i].planes.size(), 3u);
+      EXPECT_EQ(batch[i].planes[1].mask, expected[i].planes[1].mask);
+      EXPECT_EQ(batch[i].planes[1].value, 0.5f);
+    }
+  });
+  EXPECT_EQ(b, kBatches);
+
+  std::vector<float> values;
+  ASSERT_TRUE(reader.Find(399 * 1000 + 7, &values));
+  EXPECT_EQ(values, std::vector<float>({399.0f, 7.0f, -1.0f}));
+  // The first recording wins.
+  ASSERT_TRUE(reader.Find(1000, &values));
+  EXPECT_EQ(values, std::vector<float>({0.0f, 0.0f, -1.0f}));
+  EXPECT_FALSE(reader.Find(12345678, &values));
+  std::remove(kTraceFile.c_str());
+}
+
+TEST(Trace, MissingFooter) {
+  WriteTrace(300);
+  std::string contents;
+  {
+    std::ifstream input(kTraceFile, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(input), {});
+  }
+  const auto complete = TraceReader(kTraceFile).samples();
+  {
+    // Cut in the index: the chunks are still readable.
+    std::ofstream output(kTraceFile, std::ios::binary | std::ios::trunc);
+    output.write(contents.data(), contents.size() - 100);
+  }
+  TraceReader reader(kTraceFile);
+  EXPECT_FALSE(reader.has_index());
+  EXPECT_EQ(reader.samples(), complete);
+  EXPECT_EQ(reader.batches(), 300u);
+  std::vector<float> values;
+  ASSERT_TRUE(reader.Find(299 * 1000 + 299, &values));
+  EXPECT_EQ(values, std::vector<float>({299.0f, 299.0f, -1.0f}));
+  std::remove(kTraceFile.c_str());
+}
+
+TEST(Trace, CorruptOffsets) {
+  WriteTrace(10);
+  const auto contents = ReadTrace();
+  // The first chunk follows the 16 byte file header, its raw size and
+  // compressed size are at 4 and 8 in its header.
+  constexpr size_t kChunk = 16;
+  const auto index_offset =
+      LoadLittleEndian<uint64_t>(&contents[contents.size() - 40]);
+  const auto hash = LoadLittleEndian<uint64_t>(&contents[index_offset]);
+  std::vector<float> values;
+
+  WriteCorrupted<uint32_t>(contents, kChunk + 8, 0xffffffff);
+  EXPECT_THROW(TraceReader reader(kTraceFile), Exception);
+  WriteCorrupted<uint64_t>(contents, contents.size() - 40, 0xffffffff);
+  EXPECT_THROW(TraceReader reader(kTraceFile), Exception);
+
+  WriteCorrupted<uint32_t>(contents, kChunk + 4, 0xffffffff);
+  {
+    TraceReader reader(kTraceFile);
+    EXPECT_THROW(reader.ForEachBatch([](const TraceBatch&) {}), Exception);
+  }
+
+  // Chunk offset and record offset of the first index entry.
+  WriteCorrupted<uint64_t>(contents, index_offset + 8, contents.size());
+  {
+    TraceReader reader(kTraceFile);
+    EXPECT_THROW(reader.Find(hash, &values), Exception);
+  }
+  WriteCorrupted<uint32_t>(contents, index_offset + 16, 0xffffffff);
+  {
+    TraceReader reader(kTraceFile);
+    EXPECT_THROW(reader.Find(hash, &values), Exception);
+  }
+  std::remove(kTraceFile.c_str());
+}
+
+TEST(Trace, NotATrace) {
+  {
+    std::ofstream output(kTraceFile, std::ios::binary | std::ios::trunc);
+    output << "something else";
+  }
+  EXPECT_FALSE(TraceReader::IsTrace(kTraceFile));
+  EXPECT_THROW(TraceReader reader(kTraceFile), Exception);
+  std::remove(kTraceFile.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -31,23 +31,12 @@
 #include <sstream>
 #include "utils/commandline.h"
 #include "utils/exception.h"
+#include "utils/files.h"
 #include "utils/filesystem.h"
 #include "utils/random.h"
 
 namespace lczero {
 
-namespace {
-std::string GetLc0CacheDirectory() {
-  std::string user_cache_path = GetUserCacheDirectory();
-  if (!user_cache_path.empty()) {
-    user_cache_path += "lc0/";
-    CreateDirectory(user_cache_path);
-  }
-  return user_cache_path;
-}
-
-}  // namespace
-
 TrainingDataWriter::TrainingDataWriter(int game_id) {
   static std::string directory =
       GetLc0CacheDirectory() + "data-" + Random::Get().GetString(12);
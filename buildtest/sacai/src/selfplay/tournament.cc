@@ -163,12 +163,20 @@ SelfPlayTournament::SelfPlayTournament(
       kDiscardedStartChance(options.Get<float>(kDiscardedStartChanceId)) {
   std::string book = options.Get<std::string>(kOpeningsFileId);
   if (!book.empty()) {
-    PgnReader book_reader;
-    book_reader.AddPgnFile(book);
-    openings_ = book_reader.ReleaseGames();
-    if (options.Get<std::string>(kOpeningsModeId) == "shuffled") {
-      Random::Get().Shuffle(openings_.begin(), openings_.end());
+    const bool shuffled =
+        options.Get<std::string>(kOpeningsModeId) == "shuffled";
+    // Shuffled openings are used at most once each, so a sample of as many
+    // openings as games is as good as all of them.
+    size_t max_openings = 0;
+    if (shuffled && kTotalGames > 0) {
+      max_openings = options.Get<bool>(kOpeningsMirroredId)
+                         ? (kTotalGames + 1) / 2
+                         : kTotalGames;
     }
+    PgnReader book_reader(max_openings);
+    book_reader.AddPgnFile(book);
+    openings_ = book_reader.ReleaseOpenings();
+    if (shuffled) openings_.Shuffle();
   }
   // If playing just one game, the player1 is white, otherwise randomize.
   if (kTotalGames != 1) {
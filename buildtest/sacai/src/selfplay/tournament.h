@@ -79,7 +79,7 @@ class SelfPlayTournament {
   // Number of games which already started.
   int games_count_ GUARDED_BY(mutex_) = 0;
   bool abort_ GUARDED_BY(mutex_) = false;
-  std::vector<Opening> openings_ GUARDED_BY(mutex_);
+  OpeningBook openings_ GUARDED_BY(mutex_);
   // Games in progress. Exposed here to be able to abort them in case if
   // Abort(). Stored as list and not vector so that threads can keep iterators
   // to them and not worry that it becomes invalid.
@@ -45,6 +45,7 @@
 #include "syzygy/syzygy.h"
 
 #include "utils/exception.h"
+#include "utils/hashcat.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
 
@@ -1456,12 +1457,64 @@ class SyzygyTablebaseImpl {
   std::vector<TbHashEntry> tb_hash_;
 };
 
-SyzygyTablebase::SyzygyTablebase() : max_cardinality_(0) {}
+namespace {
+// Marks stored cache entries, so that empty ones never match.
+constexpr uint64_t kCacheEntryValid = uint64_t{1} << 40;
+// Distinguishes DTZ results from WDL ones of the same position.
+constexpr uint64_t kDtzCacheSalt = 0x5ca1ab1e;
+}  // namespace
+
+void SyzygyProbeCache::Resize(size_t megabytes) {
+  size_t size = 0;
+  if (megabytes > 0) {
+    size = 1;
+    while (size * 2 * sizeof(Entry) <= megabytes << 20) size *= 2;
+  }
+  if (size == size_) return;
+  entries_ = size > 0 ? std::make_unique<Entry[]>(size) : nullptr;
+  size_ = size;
+}
+
+void SyzygyProbeCache::Clear() {
+  for (size_t i = 0; i < size_; i++) {
+    entries_[i].check.store(0, std::memory_order_relaxed);
+    entries_[i].data.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool SyzygyProbeCache::Find(uint64_t key, int* value, ProbeState* state) {
+  if (size_ == 0) return false;
+  probes_.fetch_add(1, std::memory_order_relaxed);
+  const auto& entry = entries_[key & (size_ - 1)];
+  const uint64_t data = entry.data.load(std::memory_order_relaxed);
+  if ((entry.check.load(std::memory_order_relaxed) ^ data) != key ||
+      !(data & kCacheEntryValid)) {
+    return false;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  *value = static_cast<int32_t>(static_cast<uint32_t>(data));
+  *state = static_cast<ProbeState>(static_cast<int>((data >> 32) & 0xff) - 1);
+  return true;
+}
+
+void SyzygyProbeCache::Store(uint64_t key, int value, ProbeState state) {
+  if (size_ == 0) return;
+  const uint64_t data = static_cast<uint32_t>(value) |
+                        static_cast<uint64_t>(state + 1) << 32 |
+                        kCacheEntryValid;
+  auto& entry = entries_[key & (size_ - 1)];
+  entry.check.store(key ^ data, std::memory_order_relaxed);
+  entry.data.store(data, std::memory_order_relaxed);
+}
+
+SyzygyTablebase::SyzygyTablebase()
+    : max_cardinality_(0), cache_(kDefaultCacheSize) {}
 
 SyzygyTablebase::~SyzygyTablebase() = default;
 
 bool SyzygyTablebase::init(const std::string& paths) {
   paths_ = paths;
+  cache_.Clear();
   impl_.reset(new SyzygyTablebaseImpl(paths_));
   max_cardinality_ = impl_->max_cardinality();
   if (max_cardinality_ <= 2) {
@@ -1542,8 +1595,14 @@ WDLScore SyzygyTablebase::search(const Position& pos, ProbeState* result) {
 //  1 : win, but draw under 50-move rule
 //  2 : win
 WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
+  // Like the tables, the results only depend on the board.
+  const uint64_t key = pos.GetBoard().Hash();
+  int value;
+  if (cache_.Find(key, &value, result)) return static_cast<WDLScore>(value);
   *result = OK;
-  return search(pos, result);
+  const WDLScore wdl = search(pos, result);
+  cache_.Store(key, wdl, *result);
+  return wdl;
 }
 
 // Probe the DTZ table for a particular position.
@@ -1572,6 +1631,16 @@ WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
 // In short, if a move is available resulting in dtz + 50-move-counter <= 99,
 // then do not accept moves leading to dtz + 50-move-counter == 100.
 int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
+  const uint64_t key = HashCat(pos.GetBoard().Hash(), kDtzCacheSalt);
+  int dtz;
+  if (cache_.Find(key, &dtz, result)) return dtz;
+  dtz = probe_dtz_uncached(pos, result);
+  cache_.Store(key, dtz, *result);
+  return dtz;
+}
+
+int SyzygyTablebase::probe_dtz_uncached(const Position& pos,
+                                        ProbeState* result) {
   *result = OK;
   const WDLScore wdl = search<true>(pos, result);
   if (*result == FAIL || wdl == WDL_DRAW) {  // DTZ tables don't store draws
@@ -1621,7 +1690,7 @@ int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
 //
 // A return value false indicates that not all probes were successful.
 bool SyzygyTablebase::root_probe(const Position& pos, bool has_repeated,
-                                 std::vector<Move>* safe_moves) {
+                                 MoveList* safe_moves) {
   ProbeState result;
   auto root_moves = pos.GetBoard().GenerateLegalMoves();
   // Obtain 50-move counter for the root position
@@ -1677,7 +1746,7 @@ bool SyzygyTablebase::root_probe(const Position& pos, bool has_repeated,
 //
 // A return value false indicates that not all probes were successful.
 bool SyzygyTablebase::root_probe_wdl(const Position& pos,
-                                     std::vector<Move>* safe_moves) {
+                                     MoveList* safe_moves) {
   static const int WDL_to_rank[] = {-1000, -899, 0, 899, 1000};
   auto root_moves = pos.GetBoard().GenerateLegalMoves();
   ProbeState result;
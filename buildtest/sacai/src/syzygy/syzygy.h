@@ -55,11 +55,52 @@ enum ProbeState {
 
 class SyzygyTablebaseImpl;
 
+// Results of tablebase probes by key. Thread safe without locks: entries are
+// checked against the key they were stored with, so that an entry torn by
+// concurrent stores reads as missing.
+class SyzygyProbeCache {
+ public:
+  struct Stats {
+    uint64_t probes = 0;
+    uint64_t hits = 0;
+  };
+
+  // Uses up to @megabytes of memory, 0 disables the cache.
+  explicit SyzygyProbeCache(size_t megabytes) { Resize(megabytes); }
+
+  // Not thread safe. Keeps the entries if the size doesn't change.
+  void Resize(size_t megabytes);
+  // Not thread safe.
+  void Clear();
+
+  bool Find(uint64_t key, int* value, ProbeState* state);
+  void Store(uint64_t key, int value, ProbeState state);
+
+  Stats stats() const {
+    return {probes_.load(std::memory_order_relaxed),
+            hits_.load(std::memory_order_relaxed)};
+  }
+
+ private:
+  struct Entry {
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> data{0};
+  };
+
+  std::unique_ptr<Entry[]> entries_;
+  size_t size_ = 0;
+  std::atomic<uint64_t> probes_{0};
+  std::atomic<uint64_t> hits_{0};
+};
+
 // Provides methods to load and probe syzygy tablebases.
 // Thread safe methods are thread safe subject to the non-thread sfaety
 // conditions of the init method.
 class SyzygyTablebase {
  public:
+  // Default memory for probe results, in megabytes.
+  static constexpr size_t kDefaultCacheSize = 16;
+
   SyzygyTablebase();
   virtual ~SyzygyTablebase();
   // Current maximum number of pieces on board that can be probed for. Will
@@ -71,6 +112,12 @@ class SyzygyTablebase {
   // running. All other thread safe method calls must be strictly ordered with
   // respect to this method.
   bool init(const std::string& paths);
+  // Sets the memory used to cache probe results, in megabytes. Not thread
+  // safe, like init.
+  void set_cache_size(size_t megabytes) { cache_.Resize(megabytes); }
+  // Probes and cache hits of probe_wdl and probe_dtz so far.
+  // Thread safe.
+  SyzygyProbeCache::Stats cache_stats() const { return cache_.stats(); }
   // Probes WDL tables for the given position to determine a WDLScore.
   // Thread safe.
   // Result is only strictly valid for positions with 0 ply 50 move counter.
@@ -90,23 +137,25 @@ class SyzygyTablebase {
   // Returns false if the position is not in the tablebase.
   // Safe moves are added to the safe_moves output paramater.
   bool root_probe(const Position& pos, bool has_repeated,
-                  std::vector<Move>* safe_moves);
+                  MoveList* safe_moves);
   // Probes WDL tables to determine which moves might be on the optimal play
   // path. If 50 move ply counter is non-zero some (or maybe even all) of the
   // returned safe moves in a 'winning' position, may actually be draws.
   // Returns false if the position is not in the tablebase.
   // Safe moves are added to the safe_moves output paramater.
-  bool root_probe_wdl(const Position& pos, std::vector<Move>* safe_moves);
+  bool root_probe_wdl(const Position& pos, MoveList* safe_moves);
 
  private:
   template <bool CheckZeroingMoves = false>
   WDLScore search(const Position& pos, ProbeState* result);
+  int probe_dtz_uncached(const Position& pos, ProbeState* result);
 
   std::string paths_;
   // Caches the max_cardinality from the impl, as max_cardinality may be a hot
   // path.
   int max_cardinality_;
   std::unique_ptr<SyzygyTablebaseImpl> impl_;
+  SyzygyProbeCache cache_;
 };
 
 }  // namespace lczero
@@ -84,6 +84,13 @@ void TestValidExpectation(SyzygyTablebase* tablebase, const std::string& fen,
   int moves = tablebase->probe_dtz(history.Last(), &result);
   EXPECT_NE(result, FAIL);
   EXPECT_EQ(moves, expected_dtz);
+  // Probing again gives the same results from the cache.
+  const auto stats = tablebase->cache_stats();
+  EXPECT_EQ(tablebase->probe_wdl(history.Last(), &result), expected);
+  EXPECT_NE(result, FAIL);
+  EXPECT_EQ(tablebase->probe_dtz(history.Last(), &result), expected_dtz);
+  EXPECT_NE(result, FAIL);
+  EXPECT_EQ(tablebase->cache_stats().hits, stats.hits + 2);
 }
 
 TEST(Syzygy, Simple3PieceProbes) {
@@ -240,10 +247,36 @@ TEST(Syzygy, Root5PieceProbes) {
                            true);
 }
 
+TEST(Syzygy, ProbeCache) {
+  SyzygyProbeCache cache(1);
+  int value;
+  ProbeState state;
+  EXPECT_FALSE(cache.Find(0, &value, &state));
+  cache.Store(0, -1033, CHANGE_STM);
+  cache.Store(12345, WDL_BLESSED_LOSS, ZEROING_BEST_MOVE);
+  ASSERT_TRUE(cache.Find(0, &value, &state));
+  EXPECT_EQ(value, -1033);
+  EXPECT_EQ(state, CHANGE_STM);
+  ASSERT_TRUE(cache.Find(12345, &value, &state));
+  EXPECT_EQ(value, WDL_BLESSED_LOSS);
+  EXPECT_EQ(state, ZEROING_BEST_MOVE);
+  // Same slot, different key.
+  EXPECT_FALSE(cache.Find(12345 + (1 << 20), &value, &state));
+  EXPECT_EQ(cache.stats().probes, 4u);
+  EXPECT_EQ(cache.stats().hits, 2u);
+
+  cache.Resize(1);
+  EXPECT_TRUE(cache.Find(0, &value, &state));
+  cache.Clear();
+  EXPECT_FALSE(cache.Find(0, &value, &state));
+  cache.Resize(0);
+  cache.Store(0, 1, OK);
+  EXPECT_FALSE(cache.Find(0, &value, &state));
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
@@ -0,0 +1,77 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace lczero {
+
+// Fixed size values in little endian byte order, whatever the byte order of
+// the host. Floats are stored as the bits of their IEEE representation.
+
+namespace endian_internal {
+template <size_t size>
+struct UnsignedOfSize;
+template <>
+struct UnsignedOfSize<1> {
+  using type = uint8_t;
+};
+template <>
+struct UnsignedOfSize<2> {
+  using type = uint16_t;
+};
+template <>
+struct UnsignedOfSize<4> {
+  using type = uint32_t;
+};
+template <>
+struct UnsignedOfSize<8> {
+  using type = uint64_t;
+};
+}  // namespace endian_internal
+
+// Writes the sizeof(T) bytes of @value to @out.
+template <typename T>
+void StoreLittleEndian(T value, char* out) {
+  static_assert(std::is_arithmetic<T>::value, "Not an integer or float");
+  typename endian_internal::UnsignedOfSize<sizeof(T)>::type bits;
+  std::memcpy(&bits, &value, sizeof(T));
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out[i] = static_cast<char>(bits >> (8 * i) & 0xFF);
+  }
+}
+
+// Reads a value written by StoreLittleEndian() from @data.
+template <typename T>
+T LoadLittleEndian(const char* data) {
+  static_assert(std::is_arithmetic<T>::value, "Not an integer or float");
+  typename endian_internal::UnsignedOfSize<sizeof(T)>::type bits = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    bits |= static_cast<decltype(bits)>(static_cast<uint8_t>(data[i]))
+            << (8 * i);
+  }
+  T value;
+  std::memcpy(&value, &bits, sizeof(T));
+  return value;
+}
+
+}  // namespace lczero
@@ -30,6 +30,7 @@
 #include <cstdio>
 
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 
 namespace lczero {
 
@@ -81,4 +82,13 @@ void WriteStringToGzFile(const std::string& filename,
   gzclose(f);
 }
 
+std::string GetLc0CacheDirectory() {
+  std::string user_cache_path = GetUserCacheDirectory();
+  if (!user_cache_path.empty()) {
+    user_cache_path += "lc0/";
+    CreateDirectory(user_cache_path);
+  }
+  return user_cache_path;
+}
+
 }  // namespace lczero
\ No newline at end of file
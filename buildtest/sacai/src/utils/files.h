@@ -39,4 +39,8 @@ void WriteStringToFile(const std::string& filename,
 // Writes string to gz-compressed file. Throws on error.
 void WriteStringToGzFile(const std::string& filename,
                          std::string_view  content);
+
+// Returns the directory (with trailing slash) where Lc0 keeps its cached data,
+// creating it if needed, or an empty string if there is no cache directory.
+std::string GetLc0CacheDirectory();
 }  // namespace lczero
@@ -28,6 +28,8 @@
 #pragma once
 
 #include <time.h>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -65,4 +67,23 @@ std::vector<std::string> GetSystemConfigDirectoryList();
 // Returns a vector of base directories to search for data files.
 std::vector<std::string> GetSystemDataDirectoryList();
 
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  // Maps @filename. Throws exception if it cannot be opened or mapped.
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  // Platform specific handle of the mapping.
+  void* mapping_ = nullptr;
+};
+
 }  // namespace lczero
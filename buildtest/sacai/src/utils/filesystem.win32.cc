@@ -91,5 +91,38 @@ std::vector<std::string> GetSystemDataDirectoryList() {
   return {};
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  const HANDLE fd =
+      CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (fd == INVALID_HANDLE_VALUE) {
+    throw Exception("Cannot open file: " + filename);
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(fd, &size)) {
+    CloseHandle(fd);
+    throw Exception("Cannot get size of file: " + filename);
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ > 0) {
+    mapping_ = CreateFileMapping(fd, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_) {
+      data_ = static_cast<const char*>(
+          MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!data_) {
+      if (mapping_) CloseHandle(mapping_);
+      CloseHandle(fd);
+      throw Exception("Cannot map file: " + filename);
+    }
+  }
+  CloseHandle(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) UnmapViewOfFile(data_);
+  if (mapping_) CloseHandle(mapping_);
+}
+
 
 }  // namespace lczero
@@ -25,14 +25,18 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "utils/fp16_utils.h"
+
 #include <cstdint>
 #include <cstring>
 
 // Define NO_F16C to avoid the F16C intrinsics. Also disabled with NO_POPCNT
-// since it catches most processors without F16C instructions.
+// since it catches most processors without F16C instructions. GCC and clang
+// only provide them when compiling for a processor with F16C.
 
-#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
-    defined(__x86_64__)
+#if (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+     defined(__x86_64__)) &&                                     \
+    (defined(_MSC_VER) || defined(__F16C__))
 #include <immintrin.h>
 #else
 #define NO_F16C
@@ -102,4 +106,20 @@ float FP16toFP32(uint16_t f16) {
 #endif
 }
 
+uint16_t FP32toBF16(float f32) {
+  uint32_t x;
+  memcpy(&x, &f32, sizeof(float));
+  // Keep NaNs quiet, rounding could turn them into infinities.
+  if ((x & 0x7fffffff) > 0x7f800000) return (x >> 16) | 0x40;
+  x += 0x7fff + ((x >> 16) & 1);
+  return x >> 16;
+}
+
+float BF16toFP32(uint16_t bf16) {
+  const uint32_t x = static_cast<uint32_t>(bf16) << 16;
+  float f;
+  memcpy(&f, &x, sizeof(float));
+  return f;
+}
+
 };  // namespace lczero
@@ -25,9 +25,16 @@
   Program grant you additional permission to convey the resulting work.
 */
 #pragma once
+
+#include <cstdint>
+
 namespace lczero {
 
 uint16_t FP32toFP16(float f32);
 float FP16toFP32(uint16_t f16);
 
+// BF16 is the upper half of an FP32, rounded to nearest even.
+uint16_t FP32toBF16(float f32);
+float BF16toFP32(uint16_t bf16);
+
 };  // namespace lczero
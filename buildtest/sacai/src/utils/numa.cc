@@ -34,6 +34,14 @@
 #include <windows.h>
 #endif
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <thread>
+#endif
+
 namespace lczero {
 
 int Numa::threads_per_core_ = 1;
@@ -91,4 +99,33 @@ void Numa::BindThread(int id) {
 #endif
 }
 
+void Numa::BindThreadToCore(int id) {
+#if defined(_WIN64) && _WIN32_WINNT >= 0x0601
+  int group_count = GetActiveProcessorGroupCount();
+  int thread_count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+  int cpu = id % thread_count;
+  GROUP_AFFINITY affinity = {};
+  for (int group_id = 0; group_id < group_count; group_id++) {
+    int group_threads = GetActiveProcessorCount(group_id);
+    if (cpu < group_threads) {
+      affinity.Group = group_id;
+      affinity.Mask = 1ULL << cpu;
+      SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+      break;
+    }
+    cpu -= group_threads;
+  }
+#elif defined(__linux__)
+  const int thread_count =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(id % thread_count, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+  // Silence warning.
+  (void)id;
+#endif
+}
+
 }  // namespace lczero
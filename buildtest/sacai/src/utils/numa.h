@@ -39,6 +39,10 @@ class Numa {
   // Bind thread to processor group.
   static void BindThread(int id);
 
+  // Pin thread to a single logical processor. Ids beyond the number of
+  // processors wrap around.
+  static void BindThreadToCore(int id);
+
  private:
   static int threads_per_core_;
 };
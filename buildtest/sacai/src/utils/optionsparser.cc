@@ -127,6 +127,12 @@ bool OptionsParser::ProcessAllFlags() {
          ProcessFlags(CommandLine::Arguments());
 }
 
+bool OptionsParser::SetDefaultFlag(const std::string& flag,
+                                   const std::string& value) {
+  Option* option = FindOptionByLongFlag(flag);
+  return option && option->ProcessLongFlag(flag, value, &defaults_);
+}
+
 bool OptionsParser::ProcessFlags(const std::vector<std::string>& args) {
   auto show_help = false;
   if (CommandLine::BinaryName().find("pro") != std::string::npos) {
@@ -102,6 +102,10 @@ class OptionsParser {
   bool ProcessAllFlags();
   // Processes either the command line or configuration file flags.
   bool ProcessFlags(const std::vector<std::string>& args);
+  // Changes the default value of the option with the given long flag, so
+  // that values set explicitly still take precedence. Returns false if there
+  // is no such flag.
+  bool SetDefaultFlag(const std::string& flag, const std::string& value);
 
   // Get the options dict for given context.
   const OptionsDict& GetOptionsDict(const std::string& context = {});
@@ -0,0 +1,161 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "utils/softmax.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "utils/fastmath.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_SOFTMAX_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace lczero {
+namespace {
+
+// Exponentiates @values in place and returns their sum.
+using ExpKernel = float (*)(float* values, size_t count, float max,
+                            float temperature);
+
+// Also takes the leftover values of the vector kernels.
+float ExpScalar(float* values, size_t count, float max, float temperature) {
+  float total = 0.0f;
+  for (size_t i = 0; i < count; i++) {
+    values[i] = FastExp((values[i] - max) / temperature);
+    total += values[i];
+  }
+  return total;
+}
+
+#ifdef USE_SOFTMAX_X86_KERNELS
+
+// FastExp() four lanes at a time: 2^x as 2^N * (1 + f * (1 - k + k * f)),
+// with N = x rounded down the same way, which gives the same values.
+inline __m128 FastExpSse2(__m128 x) {
+  const __m128 a = _mm_mul_ps(x, _mm_set1_ps(1.442695040f));
+  const __m128 negative = _mm_cmplt_ps(a, _mm_setzero_ps());
+  const __m128 rounded = _mm_sub_ps(a, _mm_and_ps(negative, _mm_set1_ps(1.0f)));
+  const __m128i exp = _mm_cvttps_epi32(rounded);
+  const __m128 f = _mm_sub_ps(a, _mm_cvtepi32_ps(exp));
+  __m128 out = _mm_add_ps(
+      _mm_set1_ps(0.6602339f), _mm_mul_ps(_mm_set1_ps(0.33976606f), f));
+  out = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, out));
+  out = _mm_castsi128_ps(
+      _mm_add_epi32(_mm_castps_si128(out), _mm_slli_epi32(exp, 23)));
+  // Underflow to zero.
+  return _mm_andnot_ps(_mm_cmplt_ps(a, _mm_set1_ps(-126.0f)), out);
+}
+
+float ExpSse2(float* values, size_t count, float max, float temperature) {
+  const __m128 vmax = _mm_set1_ps(max);
+  const __m128 vtemp = _mm_set1_ps(temperature);
+  __m128 sum = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 x =
+        _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(values + i), vmax), vtemp);
+    const __m128 e = FastExpSse2(x);
+    _mm_storeu_ps(values + i, e);
+    sum = _mm_add_ps(sum, e);
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+         ExpScalar(values + i, count - i, max, temperature);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 FastExpAvx2(__m256 x) {
+  const __m256 a = _mm256_mul_ps(x, _mm256_set1_ps(1.442695040f));
+  const __m256 negative = _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ);
+  const __m256 rounded =
+      _mm256_sub_ps(a, _mm256_and_ps(negative, _mm256_set1_ps(1.0f)));
+  const __m256i exp = _mm256_cvttps_epi32(rounded);
+  const __m256 f = _mm256_sub_ps(a, _mm256_cvtepi32_ps(exp));
+  __m256 out = _mm256_fmadd_ps(_mm256_set1_ps(0.33976606f), f,
+                               _mm256_set1_ps(0.6602339f));
+  out = _mm256_fmadd_ps(f, out, _mm256_set1_ps(1.0f));
+  out = _mm256_castsi256_ps(
+      _mm256_add_epi32(_mm256_castps_si256(out), _mm256_slli_epi32(exp, 23)));
+  const __m256 underflow =
+      _mm256_cmp_ps(a, _mm256_set1_ps(-126.0f), _CMP_LT_OQ);
+  return _mm256_andnot_ps(underflow, out);
+}
+
+__attribute__((target("avx2,fma"))) float ExpAvx2(float* values, size_t count,
+                                                  float max,
+                                                  float temperature) {
+  const __m256 vmax = _mm256_set1_ps(max);
+  const __m256 vtemp = _mm256_set1_ps(temperature);
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 x =
+        _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(values + i), vmax), vtemp);
+    const __m256 e = FastExpAvx2(x);
+    _mm256_storeu_ps(values + i, e);
+    sum = _mm256_add_ps(sum, e);
+  }
+  __m128 half =
+      _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+  float lanes[4];
+  _mm_storeu_ps(lanes, half);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+         ExpScalar(values + i, count - i, max, temperature);
+}
+
+#endif  // USE_SOFTMAX_X86_KERNELS
+
+struct KernelChoice {
+  ExpKernel exp;
+  const char* name;
+};
+
+KernelChoice ChooseKernel() {
+#ifdef USE_SOFTMAX_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {ExpAvx2, "AVX2"};
+  }
+  return {ExpSse2, "SSE2"};
+#else
+  return {ExpScalar, "scalar"};
+#endif
+}
+
+const KernelChoice& GetKernel() {
+  static const KernelChoice kernel = ChooseKernel();
+  return kernel;
+}
+
+}  // namespace
+
+void SoftmaxWithTemperature(float* values, size_t count, float temperature) {
+  if (count == 0) return;
+  const float max = *std::max_element(values, values + count);
+  const float total = GetKernel().exp(values, count, max, temperature);
+  if (!(total > 0.0f)) return;
+  const float scale = 1.0f / total;
+  for (size_t i = 0; i < count; i++) values[i] *= scale;
+}
+
+const char* SoftmaxKernelName() { return GetKernel().name; }
+
+}  // namespace lczero
@@ -0,0 +1,34 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+namespace lczero {
+
+// Replaces the @count logits at @values by their softmax at @temperature, i.e.
+// exp((x - max) / T) normalized to add up to 1, with the FastExp()
+// approximation. Vectorized where the CPU allows it, so the sum may round
+// differently than a plain loop.
+void SoftmaxWithTemperature(float* values, size_t count, float temperature);
+
+// Returns the name of the softmax kernel selected for this CPU.
+const char* SoftmaxKernelName();
+
+}  // namespace lczero
@@ -0,0 +1,88 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2021 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/utils/softmax.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "src/utils/fastmath.h"
+
+namespace lczero {
+namespace {
+
+// The scalar softmax search used before.
+std::vector<float> Reference(const std::vector<float>& logits,
+                             float temperature) {
+  const float max = *std::max_element(logits.begin(), logits.end());
+  std::vector<float> result;
+  float total = 0.0f;
+  for (const float logit : logits) {
+    result.push_back(FastExp((logit - max) / temperature));
+    total += result.back();
+  }
+  for (auto& value : result) value /= total;
+  return result;
+}
+
+}  // namespace
+
+TEST(SoftmaxWithTemperature, MatchesReference) {
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> logits(-20.0f, 20.0f);
+  // Covers the leftovers of the vector kernels and the most legal moves.
+  for (size_t count = 1; count <= 218; count++) {
+    for (const float temperature : {1.0f, 1.359f, 0.5f, 3.0f}) {
+      std::vector<float> values(count);
+      for (auto& value : values) value = logits(gen);
+      const auto expected = Reference(values, temperature);
+      SoftmaxWithTemperature(values.data(), count, temperature);
+      float total = 0.0f;
+      for (size_t i = 0; i < count; i++) {
+        EXPECT_NEAR(expected[i], values[i], 1e-6f + 1e-5f * expected[i])
+            << "count " << count << " move " << i;
+        total += values[i];
+      }
+      EXPECT_NEAR(1.0f, total, 1e-4f);
+    }
+  }
+}
+
+TEST(SoftmaxWithTemperature, UnderflowsToZero) {
+  std::vector<float> values = {0.0f, -200.0f, -1000.0f, 5.0f, -90.0f,
+                               -100.0f, 5.0f, 1.0f, -1e30f};
+  SoftmaxWithTemperature(values.data(), values.size(), 1.0f);
+  EXPECT_EQ(0.0f, values[2]);
+  EXPECT_EQ(0.0f, values[8]);
+  EXPECT_EQ(values[3], values[6]);
+  EXPECT_NEAR(0.5f, values[3], 0.01f);
+}
+
+TEST(SoftmaxWithTemperature, HandlesEmptyInput) {
+  SoftmaxWithTemperature(nullptr, 0, 1.0f);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}